@@ -0,0 +1,56 @@
+#    Copyright (C) 2014 by Project Tox <https://tox.im>
+#
+#    This file is part of qTox, a Qt-based graphical interface for Tox.
+#
+#    This program is libre software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation, either version 3 of the License, or
+#    (at your option) any later version.
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+#
+#    See the COPYING file for more details.
+
+# Offline recompression of a history file, only the database layer is built, see tools/historyrecompress
+# Usage: qmake historyrecompress.pro && make && ./historyrecompress --help
+
+QT       += core sql
+QT       -= gui
+
+TARGET    = historyrecompress
+TEMPLATE  = app
+CONFIG   += c++11 console
+CONFIG   -= app_bundle
+
+INCLUDEPATH += libs/include
+
+win32 {
+    LIBS += -L$$PWD/libs/lib -ltoxencryptsave -ltoxcore -lsodium -lws2_32 -liphlpapi
+} else {
+    LIBS += -L$$PWD/libs/lib -ltoxencryptsave -ltoxcore -lsodium
+}
+
+LIBS += -lsqlite3 -lz
+
+HEADERS  += \
+    src/historykeeper.h \
+    src/historywriter.h \
+    src/historycache.h \
+    src/misc/db/genericddinterface.h \
+    src/misc/db/plaindb.h \
+    src/misc/db/encrypteddb.h \
+    src/misc/db/encryptedvfs.h \
+    src/misc/db/messagecodec.h \
+    tools/common/historycipher.h
+
+SOURCES += \
+    tools/historyrecompress/historyrecompress.cpp \
+    tools/common/historycipher.cpp \
+    src/historywriter.cpp \
+    src/historycache.cpp \
+    src/misc/db/genericddinterface.cpp \
+    src/misc/db/plaindb.cpp \
+    src/misc/db/encrypteddb.cpp \
+    src/misc/db/encryptedvfs.cpp \
+    src/misc/db/messagecodec.cpp
@@ -89,6 +89,12 @@ win32 {
     }
 }
 
+# The encrypted history VFS registers with SQLite directly,
+# so Qt's QSQLITE driver has to be built against the system SQLite (-system-sqlite)
+LIBS += -lsqlite3
+
+# History message compression uses zlib directly, Qt's qCompress has no preset dictionaries
+LIBS += -lz
 
 #### Static linux build
 #LIBS += -Wl,-Bstatic -ltoxcore -ltoxav -lsodium -lvpx -lopus \
@@ -126,6 +132,7 @@ HEADERS  += src/widget/form/addfriendform.h \
     src/video/camera.h \
     src/widget/netcamview.h \
     src/misc/smileypack.h \
+    src/misc/avatarcache.h \
     src/widget/emoticonswidget.h \
     src/misc/style.h \
     src/widget/adjustingscrollarea.h \
@@ -139,6 +146,13 @@ HEADERS  += src/widget/form/addfriendform.h \
     src/corestructs.h \
     src/coredefines.h \
     src/coreav.h \
+    src/corenetwork.h \
+    src/coreeventqueue.h \
+    src/filewriter.h \
+    src/filetransfertable.h \
+    src/filesendscheduler.h \
+    src/transferjournal.h \
+    src/coredispatcher.h \
     src/widget/tool/chatactions/messageaction.h \
     src/widget/tool/chatactions/filetransferaction.h \
     src/widget/tool/chatactions/systemmessageaction.h \
@@ -149,10 +163,17 @@ HEADERS  += src/widget/form/addfriendform.h \
     src/video/cameraworker.h \
     src/widget/videosurface.h \
     src/widget/form/loadhistorydialog.h \
+    src/widget/form/historysearchdialog.h \
+    src/widget/form/historyretentiondialog.h \
     src/historykeeper.h \
+    src/historywriter.h \
+    src/historyexporter.h \
+    src/historycache.h \
     src/misc/db/genericddinterface.h \
     src/misc/db/plaindb.h \
     src/misc/db/encrypteddb.h \
+    src/misc/db/encryptedvfs.h \
+    src/misc/db/messagecodec.h \
     src/widget/form/inputpassworddialog.h \
     src/widget/form/setpassworddialog.h \
     src/widget/form/tabcompleter.h \
@@ -186,12 +207,20 @@ SOURCES += \
     src/video/camera.cpp \
     src/widget/netcamview.cpp \
     src/misc/smileypack.cpp \
+    src/misc/avatarcache.cpp \
     src/widget/emoticonswidget.cpp \
     src/misc/style.cpp \
     src/widget/adjustingscrollarea.cpp \
     src/widget/croppinglabel.cpp \
     src/widget/friendlistwidget.cpp \
     src/coreav.cpp \
+    src/corenetwork.cpp \
+    src/coreeventqueue.cpp \
+    src/filewriter.cpp \
+    src/filetransfertable.cpp \
+    src/filesendscheduler.cpp \
+    src/transferjournal.cpp \
+    src/coredispatcher.cpp \
     src/widget/genericchatroomwidget.cpp \
     src/widget/form/genericchatform.cpp \
     src/widget/tool/chatactions/chataction.cpp \
@@ -207,10 +236,17 @@ SOURCES += \
     src/video/cameraworker.cpp \
     src/widget/videosurface.cpp \
     src/widget/form/loadhistorydialog.cpp \
+    src/widget/form/historysearchdialog.cpp \
+    src/widget/form/historyretentiondialog.cpp \
     src/historykeeper.cpp \
+    src/historywriter.cpp \
+    src/historyexporter.cpp \
+    src/historycache.cpp \
     src/misc/db/genericddinterface.cpp \
     src/misc/db/plaindb.cpp \
     src/misc/db/encrypteddb.cpp \
+    src/misc/db/encryptedvfs.cpp \
+    src/misc/db/messagecodec.cpp \
     src/widget/form/inputpassworddialog.cpp \
     src/widget/form/setpassworddialog.cpp \
     src/video/netvideosource.cpp \
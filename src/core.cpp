@@ -15,6 +15,11 @@
 */
 
 #include "core.h"
+#include "corenetwork.h"
+#include "coreeventqueue.h"
+#include "filewriter.h"
+#include "filesendscheduler.h"
+#include "transferjournal.h"
 #include "misc/cdata.h"
 #include "misc/cstring.h"
 #include "misc/settings.h"
@@ -30,6 +35,7 @@
 #include <QDebug>
 #include <QDir>
 #include <QFile>
+#include <QFileInfo>
 #include <QSaveFile>
 #include <QStandardPaths>
 #include <QThread>
@@ -40,27 +46,67 @@
 #include <QBuffer>
 #include <QMessageBox>
 #include <QMutexLocker>
+#include <QHash>
+#include <QPair>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QtEndian>
+
+/// Checks on the thread pool whether the file we're sending starts like what a friend resuming it has
+class ResumeCheckTask : public QRunnable
+{
+public:
+    ResumeCheckTask(Core* core, int friendId, int fileNum, const QString& path, long long filesize,
+                    long long offset, const QByteArray& digest)
+        : core(core), friendId(friendId), fileNum(fileNum), path(path), filesize(filesize),
+          offset(offset), digest(digest)
+    {
+    }
+
+    void run()
+    {
+        bool match = TransferJournal::resumeDigest(path, filesize, offset) == digest;
+        QMetaObject::invokeMethod(core, "onResumeChecked", Qt::QueuedConnection,
+                                  Q_ARG(int, friendId), Q_ARG(int, fileNum), Q_ARG(qint64, match ? offset : 0));
+    }
+
+private:
+    Core* core;
+    int friendId;
+    int fileNum;
+    QString path;
+    long long filesize;
+    long long offset;
+    QByteArray digest;
+};
 
 const QString Core::CONFIG_FILE_NAME = "data";
 const QString Core::TOX_EXT = ".tox";
-QList<ToxFile> Core::fileSendQueue;
-QList<ToxFile> Core::fileRecvQueue;
+QMutex Core::toxMutex(QMutex::Recursive);
 
 Core::Core(Camera* cam, QThread *coreThread, QString loadPath) :
-    tox(nullptr), camera(cam), loadPath(loadPath)
+    tox(nullptr), network(nullptr), camera(cam), loadPath(loadPath)
 {
     qDebug() << "Core: loading Tox from" << loadPath;
 
+    // Not a child, it stays on the GUI thread when the core is moved to its own
+    eventQueue = new CoreEventQueue([this](const QVector<const CoreEvent*>& events){dispatchEvents(events);});
+    eventQueue->moveToThread(qApp->thread());
+
+    fileWriter = new FileWriter();
+    connect(fileWriter, &FileWriter::finished, this, &Core::fileTransferFinished);
+    connect(fileWriter, &FileWriter::drained, this, &Core::resumeThrottledFileRecv);
+    connect(fileWriter, &FileWriter::failed, this, &Core::cancelFileRecv);
+    fileWriter->start();
+
+    fileScheduler = new FileSendScheduler(this);
+
     videobuf = new uint8_t[videobufsize];
 
     for (int i = 0; i < ptCounter; i++)
         pwsaltedkeys[i] = nullptr;
 
-    toxTimer = new QTimer(this);
-    toxTimer->setSingleShot(true);
-    connect(toxTimer, &QTimer::timeout, this, &Core::process);
-    //connect(fileTimer, &QTimer::timeout, this, &Core::fileHeartbeat);
-    connect(&Settings::getInstance(), &Settings::dhtServerListChanged, this, &Core::process);
+    connect(&Settings::getInstance(), &Settings::dhtServerListChanged, this, &Core::bootstrapDht);
     connect(this, SIGNAL(fileTransferFinished(ToxFile)), this, SLOT(onFileTransferFinished(ToxFile)));
 
     for (int i=0; i<TOXAV_MAX_CALLS;i++)
@@ -107,6 +153,18 @@ Core::Core(Camera* cam, QThread *coreThread, QString loadPath) :
 
 Core::~Core()
 {
+    stopNetwork();
+
+    qDebug() << "Core: queued" << eventQueue->getPushed() << "events," << eventQueue->getSpilled() << "spilled, in"
+             << eventQueue->getBatches() << "batches of at most" << eventQueue->getMaxBatch();
+    delete eventQueue;
+
+    fileWriter->stop();
+    delete fileWriter;
+    for (const ResumeOffer& offer : resumeOffers)
+        delete offer.journal;
+    qDeleteAll(packetTargets);
+
     if (tox) {
         toxav_kill(toxav);
         tox_kill(tox);
@@ -297,7 +355,23 @@ void Core::start()
     else
         qDebug() << "Core: Error loading self avatar";
     
-    process(); // starts its own timer
+    startNetwork();
+}
+
+void Core::startNetwork()
+{
+    network = new CoreNetwork(this, &toxMutex);
+    network->start();
+}
+
+void Core::stopNetwork()
+{
+    if (!network)
+        return;
+
+    network->stop();
+    delete network;
+    network = nullptr;
 }
 
 /* Using the now commented out statements in checkConnection(), I watched how
@@ -309,10 +383,10 @@ void Core::start()
  */
 #define CORE_DISCONNECT_TOLERANCE 30
 
-void Core::process()
+int Core::process()
 {
     if (!tox)
-        return;
+        return CORE_NETWORK_MAX_WAIT;
 
     static int tolerance = CORE_DISCONNECT_TOLERANCE;
     tox_do(tox);
@@ -329,7 +403,7 @@ void Core::process()
         bootstrapDht();
     }
 
-    toxTimer->start(tox_do_interval(tox));
+    return tox_do_interval(tox);
 }
 
 bool Core::checkConnection()
@@ -355,6 +429,10 @@ bool Core::checkConnection()
 
 void Core::bootstrapDht()
 {
+    QMutexLocker locker(&toxMutex);
+    if (!tox)
+        return;
+
     const Settings& s = Settings::getInstance();
     QList<Settings::DhtServer> dhtServerList = s.getDhtServerList();
 
@@ -379,29 +457,100 @@ void Core::bootstrapDht()
     }
 }
 
+void Core::dispatchEvents(const QVector<const CoreEvent*>& events)
+{
+    // Only the last progress of each file is worth showing, shown before whatever came after it
+    QHash<QPair<int, int>, const CoreEvent*> progress;
+    auto flushProgress = [&]()
+    {
+        for (const CoreEvent* event : progress)
+            emit fileTransferInfo(event->id, event->arg, event->size, event->position, ToxFile::RECEIVING);
+        progress.clear();
+    };
+
+    for (const CoreEvent* event : events)
+    {
+        if (event->type != CoreEvent::FileRecvProgress && !progress.isEmpty())
+            flushProgress();
+
+        switch (event->type)
+        {
+        case CoreEvent::FriendMessage:
+            emit friendMessageReceived(event->id, QString::fromUtf8(event->text), false);
+            break;
+        case CoreEvent::FriendAction:
+            emit friendMessageReceived(event->id, QString::fromUtf8(event->text), true);
+            break;
+        case CoreEvent::FriendName:
+            emit friendUsernameChanged(event->id, QString::fromUtf8(event->text));
+            break;
+        case CoreEvent::FriendTyping:
+            emit friendTypingChanged(event->id, event->arg);
+            break;
+        case CoreEvent::FriendStatusMessage:
+            emit friendStatusMessageChanged(event->id, QString::fromUtf8(event->text));
+            break;
+        case CoreEvent::FriendStatus:
+            emit friendStatusChanged(event->id, static_cast<Status>(event->arg));
+            break;
+        case CoreEvent::GroupMessage:
+            emit groupMessageReceived(event->id, QString::fromUtf8(event->text), QString::fromUtf8(event->author),
+                                      QString::fromUtf8(event->authorKey), false);
+            break;
+        case CoreEvent::GroupAction:
+            emit groupMessageReceived(event->id, QString::fromUtf8(event->text), QString::fromUtf8(event->author),
+                                      QString::fromUtf8(event->authorKey), true);
+            break;
+        case CoreEvent::GroupNamelist:
+            emit groupNamelistChanged(event->id, event->arg, event->change);
+            break;
+        case CoreEvent::FileRecvProgress:
+            progress[{event->id, event->arg}] = event;
+            break;
+        case CoreEvent::Call:
+            event->call();
+            break;
+        }
+    }
+
+    flushProgress();
+}
+
 void Core::onFriendRequest(Tox*/* tox*/, const uint8_t* cUserId, const uint8_t* cMessage, uint16_t cMessageSize, void* core)
 {
-    emit static_cast<Core*>(core)->friendRequestReceived(CUserId::toString(cUserId), CString::toString(cMessage, cMessageSize));
+    Core* c = static_cast<Core*>(core);
+    QString userId = CUserId::toString(cUserId);
+    QString message = CString::toString(cMessage, cMessageSize);
+    c->eventQueue->post([=]{ emit c->friendRequestReceived(userId, message); });
 }
 
 void Core::onFriendMessage(Tox*/* tox*/, int friendId, const uint8_t* cMessage, uint16_t cMessageSize, void* core)
 {
-    emit static_cast<Core*>(core)->friendMessageReceived(friendId, CString::toString(cMessage, cMessageSize), false);
+    CoreEventQueue* queue = static_cast<Core*>(core)->eventQueue;
+    queue->prepare(CoreEvent::FriendMessage, friendId).setText(cMessage, cMessageSize);
+    queue->commit();
 }
 
 void Core::onFriendNameChange(Tox*/* tox*/, int friendId, const uint8_t* cName, uint16_t cNameSize, void* core)
 {
-    emit static_cast<Core*>(core)->friendUsernameChanged(friendId, CString::toString(cName, cNameSize));
+    static_cast<Core*>(core)->setPeerName(friendId, CString::toString(cName, cNameSize));
+    CoreEventQueue* queue = static_cast<Core*>(core)->eventQueue;
+    queue->prepare(CoreEvent::FriendName, friendId).setText(cName, cNameSize);
+    queue->commit();
 }
 
 void Core::onFriendTypingChange(Tox*/* tox*/, int friendId, uint8_t isTyping, void *core)
 {
-    emit static_cast<Core*>(core)->friendTypingChanged(friendId, isTyping ? true : false);
+    CoreEventQueue* queue = static_cast<Core*>(core)->eventQueue;
+    queue->prepare(CoreEvent::FriendTyping, friendId).arg = isTyping ? 1 : 0;
+    queue->commit();
 }
 
 void Core::onStatusMessageChanged(Tox*/* tox*/, int friendId, const uint8_t* cMessage, uint16_t cMessageSize, void* core)
 {
-    emit static_cast<Core*>(core)->friendStatusMessageChanged(friendId, CString::toString(cMessage, cMessageSize));
+    CoreEventQueue* queue = static_cast<Core*>(core)->eventQueue;
+    queue->prepare(CoreEvent::FriendStatusMessage, friendId).setText(cMessage, cMessageSize);
+    queue->commit();
 }
 
 void Core::onUserStatusChanged(Tox*/* tox*/, int friendId, uint8_t userstatus, void* core)
@@ -425,74 +574,93 @@ void Core::onUserStatusChanged(Tox*/* tox*/, int friendId, uint8_t userstatus, v
     if (status == Status::Online || status == Status::Away)
         tox_request_avatar_info(static_cast<Core*>(core)->tox, friendId);
 
-    emit static_cast<Core*>(core)->friendStatusChanged(friendId, status);
+    CoreEventQueue* queue = static_cast<Core*>(core)->eventQueue;
+    queue->prepare(CoreEvent::FriendStatus, friendId).arg = static_cast<int>(status);
+    queue->commit();
 }
 
 void Core::onConnectionStatusChanged(Tox*/* tox*/, int friendId, uint8_t status, void* core)
 {
+    Core* c = static_cast<Core*>(core);
     Status friendStatus = status ? Status::Online : Status::Offline;
-    emit static_cast<Core*>(core)->friendStatusChanged(friendId, friendStatus);
+    CoreEventQueue* queue = static_cast<Core*>(core)->eventQueue;
+    queue->prepare(CoreEvent::FriendStatus, friendId).arg = static_cast<int>(friendStatus);
+    queue->commit();
     if (friendStatus == Status::Offline) {
         static_cast<Core*>(core)->checkLastOnline(friendId);
 
-        for (ToxFile& f : fileSendQueue)
+        for (ToxFile* f : static_cast<Core*>(core)->fileTransfers.ofFriend(friendId))
         {
-            if (f.friendId == friendId && f.status == ToxFile::TRANSMITTING)
+            if (f->status == ToxFile::TRANSMITTING)
             {
-                f.status = ToxFile::BROKEN;
-                emit static_cast<Core*>(core)->fileTransferBrokenUnbroken(f, true);
-            }
-        }
-        for (ToxFile& f : fileRecvQueue)
-        {
-            if (f.friendId == friendId && f.status == ToxFile::TRANSMITTING)
-            {
-                f.status = ToxFile::BROKEN;
-                emit static_cast<Core*>(core)->fileTransferBrokenUnbroken(f, true);
+                f->status = ToxFile::BROKEN;
+                ToxFile copy = *f;
+                c->eventQueue->post([=]{ emit c->fileTransferBrokenUnbroken(copy, true); });
             }
         }
     } else {
-        for (ToxFile& f : fileRecvQueue)
+        for (ToxFile* f : static_cast<Core*>(core)->fileTransfers.ofFriend(friendId))
         {
-            if (f.friendId == friendId && f.status == ToxFile::BROKEN)
+            if (f->direction == ToxFile::RECEIVING && f->status == ToxFile::BROKEN)
             {
-                qDebug() << QString("Core::onConnectionStatusChanged: %1: resuming broken filetransfer from position: %2").arg(f.file->fileName()).arg(f.bytesSent);
-                tox_file_send_control(static_cast<Core*>(core)->tox, friendId, 1, f.fileNum, TOX_FILECONTROL_RESUME_BROKEN, reinterpret_cast<const uint8_t*>(&f.bytesSent), sizeof(uint64_t));
-                emit static_cast<Core*>(core)->fileTransferBrokenUnbroken(f, false);
+                qDebug() << QString("Core::onConnectionStatusChanged: %1: resuming broken filetransfer from position: %2").arg(f->file->fileName()).arg(f->bytesSent);
+                tox_file_send_control(static_cast<Core*>(core)->tox, friendId, 1, f->fileNum, TOX_FILECONTROL_RESUME_BROKEN, reinterpret_cast<const uint8_t*>(&f->bytesSent), sizeof(uint64_t));
+                ToxFile copy = *f;
+                c->eventQueue->post([=]{ emit c->fileTransferBrokenUnbroken(copy, false); });
             }
         }
+        QMetaObject::invokeMethod(static_cast<Core*>(core), "offerPendingUploads", Qt::QueuedConnection,
+                                  Q_ARG(int, friendId));
     }
 }
 
 void Core::onAction(Tox*/* tox*/, int friendId, const uint8_t *cMessage, uint16_t cMessageSize, void *core)
 {
-    emit static_cast<Core*>(core)->friendMessageReceived(friendId, CString::toString(cMessage, cMessageSize), true);
+    CoreEventQueue* queue = static_cast<Core*>(core)->eventQueue;
+    queue->prepare(CoreEvent::FriendAction, friendId).setText(cMessage, cMessageSize);
+    queue->commit();
 }
 
 void Core::onGroupAction(Tox*, int groupnumber, int peernumber, const uint8_t *action, uint16_t length, void* _core)
 {
     Core* core = static_cast<Core*>(_core);
-    emit core->groupMessageReceived(groupnumber, CString::toString(action, length),
-                                    core->getGroupPeerName(groupnumber, peernumber), true);
+    CoreEvent& event = core->eventQueue->prepare(CoreEvent::GroupAction, groupnumber);
+    event.setText(action, length);
+    event.author = core->getGroupPeerName(groupnumber, peernumber).toUtf8();
+    event.authorKey = core->getGroupPeerKey(groupnumber, peernumber).toUtf8();
+    core->eventQueue->commit();
 }
 
 void Core::onGroupInvite(Tox*, int friendnumber, const uint8_t *group_public_key, uint16_t length,void *core)
 {
     qDebug() << QString("Core: Group invite by %1").arg(friendnumber);
-    emit static_cast<Core*>(core)->groupInviteReceived(friendnumber, group_public_key,length);
+    // The key only lives as long as the callback, the copy as long as the event
+    Core* c = static_cast<Core*>(core);
+    QByteArray groupKey(reinterpret_cast<const char*>(group_public_key), length);
+    c->eventQueue->post([=]{
+        emit c->groupInviteReceived(friendnumber, reinterpret_cast<const uint8_t*>(groupKey.constData()), groupKey.size());
+    });
 }
 
 void Core::onGroupMessage(Tox*, int groupnumber, int peernumber, const uint8_t * message, uint16_t length, void *_core)
 {
     Core* core = static_cast<Core*>(_core);
-    emit core->groupMessageReceived(groupnumber, CString::toString(message, length),
-                                    core->getGroupPeerName(groupnumber, peernumber), false);
+    CoreEvent& event = core->eventQueue->prepare(CoreEvent::GroupMessage, groupnumber);
+    event.setText(message, length);
+    event.author = core->getGroupPeerName(groupnumber, peernumber).toUtf8();
+    event.authorKey = core->getGroupPeerKey(groupnumber, peernumber).toUtf8();
+    core->eventQueue->commit();
 }
 
 void Core::onGroupNamelistChange(Tox*, int groupnumber, int peernumber, uint8_t change, void *core)
 {
     qDebug() << QString("Core: Group namelist change %1:%2 %3").arg(groupnumber).arg(peernumber).arg(change);
-    emit static_cast<Core*>(core)->groupNamelistChanged(groupnumber, peernumber, change);
+    static_cast<Core*>(core)->cacheGroupPeers(groupnumber); // before the GUI hears of it
+    CoreEventQueue* queue = static_cast<Core*>(core)->eventQueue;
+    CoreEvent& event = queue->prepare(CoreEvent::GroupNamelist, groupnumber);
+    event.arg = peernumber;
+    event.change = change;
+    queue->commit();
 }
 
 void Core::onFileSendRequestCallback(Tox*, int32_t friendnumber, uint8_t filenumber, uint64_t filesize,
@@ -503,35 +671,16 @@ void Core::onFileSendRequestCallback(Tox*, int32_t friendnumber, uint8_t filenum
     ToxFile file{filenumber, friendnumber,
                 CString::toString(filename,filename_length).toUtf8(), "", ToxFile::RECEIVING};
     file.filesize = filesize;
-    fileRecvQueue.append(file);
-    emit static_cast<Core*>(core)->fileReceiveRequested(fileRecvQueue.last());
+    Core* c = static_cast<Core*>(core);
+    ToxFile inserted = *c->fileTransfers.insert(file);
+    c->eventQueue->post([=]{ emit c->fileReceiveRequested(inserted); });
 }
 void Core::onFileControlCallback(Tox* tox, int32_t friendnumber, uint8_t receive_send, uint8_t filenumber,
                                       uint8_t control_type, const uint8_t* data, uint16_t length, void *core)
 {
-    ToxFile* file{nullptr};
-    if (receive_send == 1)
-    {
-        for (ToxFile& f : fileSendQueue)
-        {
-            if (f.fileNum == filenumber && f.friendId == friendnumber)
-            {
-                file = &f;
-                break;
-            }
-        }
-    }
-    else
-    {
-        for (ToxFile& f : fileRecvQueue)
-        {
-            if (f.fileNum == filenumber && f.friendId == friendnumber)
-            {
-                file = &f;
-                break;
-            }
-        }
-    }
+    Core* c = static_cast<Core*>(core);
+    ToxFile* file = static_cast<Core*>(core)->fileTransfers.find(friendnumber, filenumber,
+                                                                 receive_send == 1 ? ToxFile::SENDING : ToxFile::RECEIVING);
     if (!file)
     {
         qWarning("Core::onFileControlCallback: No such file in queue");
@@ -539,71 +688,87 @@ void Core::onFileControlCallback(Tox* tox, int32_t friendnumber, uint8_t receive
     }
     if      (receive_send == 1 && control_type == TOX_FILECONTROL_ACCEPT)
     {
+        // A friend resuming a download it already has part of says where to start
+        if (file->status == ToxFile::STOPPED && length == sizeof(uint64_t))
+        {
+            uint64_t resumePos = *reinterpret_cast<const uint64_t*>(data);
+            // Only where we confirmed that our file has the same content before it
+            if (resumePos > 0 && resumePos == (uint64_t)file->resumeOffset)
+            {
+                qDebug() << "Core::onFileControlCallback: Friend resumes file" << file->fileNum << "from" << resumePos;
+                file->bytesSent = resumePos;
+            }
+            else
+            {
+                qWarning() << "Core::onFileControlCallback: Ignoring an unconfirmed resume of file" << file->fileNum;
+            }
+        }
+        if (file->status == ToxFile::STOPPED)
+            QMetaObject::invokeMethod(static_cast<Core*>(core), "rememberPendingUpload", Qt::QueuedConnection,
+                                      Q_ARG(int, file->friendId), Q_ARG(QString, file->filePath));
         file->status = ToxFile::TRANSMITTING;
-        emit static_cast<Core*>(core)->fileTransferAccepted(*file);
+        ToxFile copy = *file;
+        c->eventQueue->post([=]{ emit c->fileTransferAccepted(copy); });
         qDebug() << "Core: File control callback, file accepted";
-        file->sendTimer = new QTimer(static_cast<Core*>(core));
-        connect(file->sendTimer, &QTimer::timeout, std::bind(sendAllFileData,static_cast<Core*>(core), file));
-        file->sendTimer->setSingleShot(true);
-        file->sendTimer->start(TOX_FILE_INTERVAL);
+        QMetaObject::invokeMethod(static_cast<Core*>(core), "startFileSend", Qt::QueuedConnection,
+                                  Q_ARG(int, friendnumber), Q_ARG(int, filenumber));
     }
     else if (receive_send == 1 && control_type == TOX_FILECONTROL_KILL)
     {
         qDebug() << QString("Core::onFileControlCallback: Transfer of file %1 cancelled by friend %2")
                     .arg(file->fileNum).arg(file->friendId);
         file->status = ToxFile::STOPPED;
-        emit static_cast<Core*>(core)->fileTransferCancelled(file->friendId, file->fileNum, ToxFile::SENDING);
-        // Wait for sendAllFileData to return before deleting the ToxFile, we MUST ensure this or we'll use after free
-        if (file->sendTimer)
-        {
-            QThread::msleep(1);
-            qApp->processEvents();
-            if (file->sendTimer)
-            {
-                delete file->sendTimer;
-                file->sendTimer = nullptr;
-            }
-        }
-        removeFileFromQueue((bool)receive_send, file->friendId, file->fileNum);
+        int friendId = file->friendId, fileNum = file->fileNum;
+        c->eventQueue->post([=]{ emit c->fileTransferCancelled(friendId, fileNum, ToxFile::SENDING); });
+        QMetaObject::invokeMethod(static_cast<Core*>(core), "forgetPendingUpload", Qt::QueuedConnection,
+                                  Q_ARG(int, file->friendId), Q_ARG(QString, file->filePath));
+        static_cast<Core*>(core)->removeStoppedFileSend(file->friendId, file->fileNum);
     }
     else if (receive_send == 1 && control_type == TOX_FILECONTROL_FINISHED)
     {
         qDebug() << QString("Core::onFileControlCallback: Transfer of file %1 to friend %2 is complete")
                     .arg(file->fileNum).arg(file->friendId);
         file->status = ToxFile::STOPPED;
-        emit static_cast<Core*>(core)->fileTransferFinished(*file);
-        removeFileFromQueue((bool)receive_send, file->friendId, file->fileNum);
+        ToxFile copy = *file;
+        c->eventQueue->post([=]{ emit c->fileTransferFinished(copy); });
+        static_cast<Core*>(core)->removeFileTransfer(file->friendId, file->fileNum, file->direction);
     }
     else if (receive_send == 0 && control_type == TOX_FILECONTROL_KILL)
     {
         qDebug() << QString("Core::onFileControlCallback: Transfer of file %1 cancelled by friend %2")
                     .arg(file->fileNum).arg(file->friendId);
         file->status = ToxFile::STOPPED;
-        emit static_cast<Core*>(core)->fileTransferCancelled(file->friendId, file->fileNum, ToxFile::RECEIVING);
-        removeFileFromQueue((bool)receive_send, file->friendId, file->fileNum);
+        int friendId = file->friendId, fileNum = file->fileNum;
+        c->eventQueue->post([=]{ emit c->fileTransferCancelled(friendId, fileNum, ToxFile::RECEIVING); });
+        static_cast<Core*>(core)->fileWriter->cancel(file->friendId, file->fileNum);
+        static_cast<Core*>(core)->removeFileTransfer(file->friendId, file->fileNum, file->direction);
     }
     else if (receive_send == 0 && control_type == TOX_FILECONTROL_FINISHED)
     {
         qDebug() << QString("Core::onFileControlCallback: Reception of file %1 from %2 finished")
                     .arg(file->fileNum).arg(file->friendId);
         file->status = ToxFile::STOPPED;
-        emit static_cast<Core*>(core)->fileTransferFinished(*file);
+        // fileTransferFinished is emitted once the writer has everything on disk
+        static_cast<Core*>(core)->fileWriter->finish(*file);
         // confirm receive is complete
         tox_file_send_control(tox, file->friendId, 1, file->fileNum, TOX_FILECONTROL_FINISHED, nullptr, 0);
-        removeFileFromQueue((bool)receive_send, file->friendId, file->fileNum);
+        static_cast<Core*>(core)->removeFileTransfer(file->friendId, file->fileNum, file->direction);
     }
     else if (receive_send == 0 && control_type == TOX_FILECONTROL_ACCEPT)
     {
         if (file->status == ToxFile::BROKEN)
         {
-            emit static_cast<Core*>(core)->fileTransferBrokenUnbroken(*file, false);
+            ToxFile copy = *file;
+            c->eventQueue->post([=]{ emit c->fileTransferBrokenUnbroken(copy, false); });
             file->status = ToxFile::TRANSMITTING;
         }
-        emit static_cast<Core*>(core)->fileTransferRemotePausedUnpaused(*file, false);
+        ToxFile copy = *file;
+        c->eventQueue->post([=]{ emit c->fileTransferRemotePausedUnpaused(copy, false); });
     }
     else if ((receive_send == 0 || receive_send == 1) && control_type == TOX_FILECONTROL_PAUSE)
     {
-        emit static_cast<Core*>(core)->fileTransferRemotePausedUnpaused(*file, true);
+        ToxFile copy = *file;
+        c->eventQueue->post([=]{ emit c->fileTransferRemotePausedUnpaused(copy, true); });
     }
     else if (receive_send == 1 && control_type == TOX_FILECONTROL_RESUME_BROKEN)
     {
@@ -622,10 +787,12 @@ void Core::onFileControlCallback(Tox* tox, int32_t friendnumber, uint8_t receive
         }
 
         file->status = ToxFile::TRANSMITTING;
-        emit static_cast<Core*>(core)->fileTransferBrokenUnbroken(*file, false);
+        ToxFile copy = *file;
+        c->eventQueue->post([=]{ emit c->fileTransferBrokenUnbroken(copy, false); });
 
         file->bytesSent = resumePos;
         tox_file_send_control(tox, file->friendId, 0, file->fileNum, TOX_FILECONTROL_ACCEPT, nullptr, 0);
+        c->fileScheduler->wake();
     }
     else
     {
@@ -634,28 +801,34 @@ void Core::onFileControlCallback(Tox* tox, int32_t friendnumber, uint8_t receive
     }
 }
 
-void Core::onFileDataCallback(Tox*, int32_t friendnumber, uint8_t filenumber, const uint8_t *data, uint16_t length, void *core)
+void Core::onFileDataCallback(Tox* tox, int32_t friendnumber, uint8_t filenumber, const uint8_t *data, uint16_t length, void *core)
 {
-    ToxFile* file{nullptr};
-    for (ToxFile& f : fileRecvQueue)
-    {
-        if (f.fileNum == filenumber && f.friendId == friendnumber)
-        {
-            file = &f;
-            break;
-        }
-    }
+    ToxFile* file = static_cast<Core*>(core)->fileTransfers.find(friendnumber, filenumber, ToxFile::RECEIVING);
     if (!file)
     {
         qWarning("Core::onFileDataCallback: No such file in queue");
         return;
     }
 
-    file->file->write((char*)data,length);
+    FileWriter::WriteResult result = static_cast<Core*>(core)->fileWriter->write(file->friendId, file->fileNum,
+                                                                                 file->bytesSent, data, length);
     file->bytesSent += length;
-    //qDebug() << QString("Core::onFileDataCallback: received %1/%2 bytes").arg(file->bytesSent).arg(file->filesize);
-    emit static_cast<Core*>(core)->fileTransferInfo(file->friendId, file->fileNum,
-                                            file->filesize, file->bytesSent, ToxFile::RECEIVING);
+    if (result == FileWriter::Buffered)
+        return;
+
+    if (result == FileWriter::QueueFull)
+    {
+        qDebug() << "Core::onFileDataCallback: The disk can't keep up, pausing file" << file->fileNum << "of friend" << file->friendId;
+        tox_file_send_control(tox, file->friendId, 1, file->fileNum, TOX_FILECONTROL_PAUSE, nullptr, 0);
+    }
+
+    // Once per buffer handed to the writer rather than once per packet
+    CoreEventQueue* queue = static_cast<Core*>(core)->eventQueue;
+    CoreEvent& event = queue->prepare(CoreEvent::FileRecvProgress, file->friendId);
+    event.arg = file->fileNum;
+    event.size = file->filesize;
+    event.position = file->bytesSent;
+    queue->commit();
 }
 
 void Core::onAvatarInfoCallback(Tox*, int32_t friendnumber, uint8_t format,
@@ -666,9 +839,10 @@ void Core::onAvatarInfoCallback(Tox*, int32_t friendnumber, uint8_t format,
     if (format == TOX_AVATAR_FORMAT_NONE)
     {
         //qDebug() << "Core: Got null avatar info from" << core->getFriendUsername(friendnumber);
-        emit core->friendAvatarRemoved(friendnumber);
-        QFile::remove(QDir(Settings::getSettingsDirPath()).filePath("avatars/"+core->getFriendAddress(friendnumber).left(64)+".png"));
-        QFile::remove(QDir(Settings::getSettingsDirPath()).filePath("avatars/"+core->getFriendAddress(friendnumber).left(64)+".hash"));
+        core->eventQueue->post([=]{ emit core->friendAvatarRemoved(friendnumber); });
+        QString ownerId = core->getFriendAddress(friendnumber).left(64);
+        QFile::remove(QDir(Settings::getSettingsDirPath()).filePath("avatars/"+ownerId+".png"));
+        QFile::remove(QDir(Settings::getSettingsDirPath()).filePath("avatars/"+ownerId+".hash"));
     }
     else
     {
@@ -692,18 +866,89 @@ void Core::onAvatarDataCallback(Tox*, int32_t friendnumber, uint8_t,
     if (!pic.isNull())
     {
         qDebug() << "Core: Got avatar data from" << static_cast<Core*>(core)->getFriendUsername(friendnumber);
-        Settings::getInstance().saveAvatar(pic, static_cast<Core*>(core)->getFriendAddress(friendnumber));
-        Settings::getInstance().saveAvatarHash(QByteArray((char*)hash, TOX_HASH_LENGTH), static_cast<Core*>(core)->getFriendAddress(friendnumber));
-        emit static_cast<Core*>(core)->friendAvatarChanged(friendnumber, pic);
+        QString ownerId = static_cast<Core*>(core)->getFriendAddress(friendnumber);
+        Settings::getInstance().saveAvatar(pic, ownerId);
+        Settings::getInstance().saveAvatarHash(QByteArray((char*)hash, TOX_HASH_LENGTH), ownerId);
+        Core* c = static_cast<Core*>(core);
+        c->eventQueue->post([=]{ emit c->friendAvatarChanged(friendnumber, pic); });
     }
 }
 
+int Core::onResumePacket(void* target, const uint8_t* data, uint32_t length)
+{
+    // The packet id, the file number and the offset, then the digest for an offer
+    const uint32_t headerSize = 2 + sizeof(uint64_t);
+    if (length < headerSize)
+        return -1;
+
+    Core* core = static_cast<PacketTarget*>(target)->core;
+    int friendId = static_cast<PacketTarget*>(target)->friendId;
+    int fileNum = data[1];
+    uint64_t offset = qFromLittleEndian<quint64>(data + 2);
+
+    if (data[0] == QTOX_PACKET_RESUME_OFFER)
+    {
+        ToxFile* file = core->fileTransfers.find(friendId, fileNum, ToxFile::SENDING);
+        if (!file || file->status != ToxFile::STOPPED || length != headerSize + TRANSFER_JOURNAL_DIGEST_SIZE)
+            return -1;
+        if (!Settings::getInstance().getResumeTransfers())
+        {
+            // Unanswered, the friend downloads it from the start once it gives up waiting
+            qDebug() << "Core::onResumePacket: Resuming transfers is disabled, ignoring the offer for file" << fileNum;
+            return 0;
+        }
+
+        // Hashing what the friend says it has can take a while, the answer is sent by onResumeChecked
+        QByteArray digest(reinterpret_cast<const char*>(data) + headerSize, TRANSFER_JOURNAL_DIGEST_SIZE);
+        qDebug() << "Core::onResumePacket: Friend offers to resume file" << fileNum << "from" << offset;
+        QThreadPool::globalInstance()->start(new ResumeCheckTask(core, friendId, fileNum, file->filePath, file->filesize,
+                                                                 offset < (uint64_t)file->filesize ? offset : 0, digest));
+    }
+    else if (data[0] == QTOX_PACKET_RESUME_CONFIRM)
+    {
+        ToxFile* file = core->fileTransfers.find(friendId, fileNum, ToxFile::RECEIVING);
+        auto it = core->resumeOffers.find(FileTransferTable::key(friendId, fileNum, ToxFile::RECEIVING));
+        if (!file || it == core->resumeOffers.end() || length != headerSize)
+            return -1;
+
+        ResumeOffer offer = *it;
+        core->resumeOffers.erase(it);
+        if (offset != offer.offset)
+            qDebug() << "Core::onResumePacket: Friend's" << file->fileName << "isn't what we have, downloading it from the start";
+        core->startFileRecv(file, offer.journal, offset == offer.offset ? offer.offset : 0);
+    }
+    return 0;
+}
+
+void Core::registerResumePackets(int friendId)
+{
+    PacketTarget*& target = packetTargets[friendId];
+    if (!target)
+        target = new PacketTarget{this, friendId};
+
+    // Friend numbers are reused, registering again is harmless
+    tox_lossless_packet_registerhandler(tox, friendId, QTOX_PACKET_RESUME_OFFER, onResumePacket, target);
+    tox_lossless_packet_registerhandler(tox, friendId, QTOX_PACKET_RESUME_CONFIRM, onResumePacket, target);
+}
+
+bool Core::sendResumePacket(int friendId, uint8_t type, int fileNum, uint64_t offset, const QByteArray& digest)
+{
+    QByteArray packet(2 + sizeof(uint64_t), 0);
+    packet[0] = type;
+    packet[1] = static_cast<char>(fileNum);
+    qToLittleEndian<quint64>(offset, reinterpret_cast<uchar*>(packet.data()) + 2);
+    packet += digest;
+    return tox_send_lossless_packet(tox, friendId, reinterpret_cast<const uint8_t*>(packet.constData()), packet.size()) == 0;
+}
+
 void Core::acceptFriendRequest(const QString& userId)
 {
+    QMutexLocker locker(&toxMutex);
     int friendId = tox_add_friend_norequest(tox, CUserId(userId).data());
     if (friendId == -1) {
         emit failedToAddFriend(userId);
     } else {
+        cacheFriend(friendId);
         saveConfiguration();
         emit friendAdded(friendId, userId);
     }
@@ -711,6 +956,7 @@ void Core::acceptFriendRequest(const QString& userId)
 
 void Core::requestFriendship(const QString& friendAddress, const QString& message)
 {
+    QMutexLocker locker(&toxMutex);
     qDebug() << "Core: requesting friendship of "+friendAddress;
     CString cMessage(message);
 
@@ -719,19 +965,8 @@ void Core::requestFriendship(const QString& friendAddress, const QString& messag
     if (friendId < 0) {
         emit failedToAddFriend(userId);
     } else {
-        // Update our friendAddresses
-        bool found=false;
-        QList<QString>& friendAddresses = Settings::getInstance().friendAddresses;
-        for (QString& addr : friendAddresses)
-        {
-            if (addr.toUpper().contains(friendAddress))
-            {
-                addr = friendAddress;
-                found = true;
-            }
-        }
-        if (!found)
-            friendAddresses.append(friendAddress);
+        Settings::getInstance().updateFriendAddress(friendAddress);
+        cacheFriend(friendId);
         emit friendAdded(friendId, userId);
     }
     saveConfiguration();
@@ -739,6 +974,7 @@ void Core::requestFriendship(const QString& friendAddress, const QString& messag
 
 void Core::sendMessage(int friendId, const QString& message)
 {
+    QMutexLocker locker(&toxMutex);
     QList<CString> cMessages = splitMessage(message);
 
     for (auto &cMsg :cMessages)
@@ -751,6 +987,7 @@ void Core::sendMessage(int friendId, const QString& message)
 
 void Core::sendAction(int friendId, const QString &action)
 {
+    QMutexLocker locker(&toxMutex);
     CString cMessage(action);
     int ret = tox_send_action(tox, friendId, cMessage.data(), cMessage.size());
     emit actionSentResult(friendId, action, ret);
@@ -758,6 +995,7 @@ void Core::sendAction(int friendId, const QString &action)
 
 void Core::sendTyping(int friendId, bool typing)
 {
+    QMutexLocker locker(&toxMutex);
     int ret = tox_set_user_is_typing(tox, friendId, typing);
     if (ret == -1)
         emit failedToSetTyping(typing);
@@ -765,6 +1003,7 @@ void Core::sendTyping(int friendId, bool typing)
 
 void Core::sendGroupMessage(int groupId, const QString& message)
 {
+    QMutexLocker locker(&toxMutex);
     QList<CString> cMessages = splitMessage(message);
 
     for (auto &cMsg :cMessages)
@@ -778,6 +1017,7 @@ void Core::sendGroupMessage(int groupId, const QString& message)
 
 void Core::sendGroupAction(int groupId, const QString& message)
 {
+    QMutexLocker locker(&toxMutex);
     QList<CString> cMessages = splitMessage(message);
 
     for (auto &cMsg :cMessages)
@@ -791,6 +1031,7 @@ void Core::sendGroupAction(int groupId, const QString& message)
 
 void Core::sendFile(int32_t friendId, QString Filename, QString FilePath, long long filesize)
 {
+    QMutexLocker locker(&toxMutex);
     QMutexLocker mlocker(&fileSendMutex);
 
     QByteArray fileName = Filename.toUtf8();
@@ -802,6 +1043,7 @@ void Core::sendFile(int32_t friendId, QString Filename, QString FilePath, long l
         return;
     }
     qDebug() << QString("Core::sendFile: Created file sender %1 with friend %2").arg(fileNum).arg(friendId);
+    registerResumePackets(friendId); // where a friend with part of it offers to resume
 
     ToxFile file{fileNum, friendId, fileName, FilePath, ToxFile::SENDING};
     file.filesize = filesize;
@@ -809,22 +1051,13 @@ void Core::sendFile(int32_t friendId, QString Filename, QString FilePath, long l
     {
         qWarning() << QString("Core::sendFile: Can't open file, error: %1").arg(file.file->errorString());
     }
-    fileSendQueue.append(file);
-
-    emit fileSendStarted(fileSendQueue.last());
+    emit fileSendStarted(*fileTransfers.insert(file));
 }
 
 void Core::pauseResumeFileSend(int friendId, int fileNum)
 {
-    ToxFile* file{nullptr};
-    for (ToxFile& f : fileSendQueue)
-    {
-        if (f.fileNum == fileNum && f.friendId == friendId)
-        {
-            file = &f;
-            break;
-        }
-    }
+    QMutexLocker locker(&toxMutex);
+    ToxFile* file = fileTransfers.find(friendId, fileNum, ToxFile::SENDING);
     if (!file)
     {
         qWarning("Core::pauseResumeFileSend: No such file in queue");
@@ -841,6 +1074,7 @@ void Core::pauseResumeFileSend(int friendId, int fileNum)
         file->status = ToxFile::TRANSMITTING;
         emit fileTransferAccepted(*file);
         tox_file_send_control(tox, file->friendId, 0, file->fileNum, TOX_FILECONTROL_ACCEPT, nullptr, 0);
+        fileScheduler->wake();
     }
     else
         qWarning() << "Core::pauseResumeFileSend: File is stopped";
@@ -848,15 +1082,8 @@ void Core::pauseResumeFileSend(int friendId, int fileNum)
 
 void Core::pauseResumeFileRecv(int friendId, int fileNum)
 {
-    ToxFile* file{nullptr};
-    for (ToxFile& f : fileRecvQueue)
-    {
-        if (f.fileNum == fileNum && f.friendId == friendId)
-        {
-            file = &f;
-            break;
-        }
-    }
+    QMutexLocker locker(&toxMutex);
+    ToxFile* file = fileTransfers.find(friendId, fileNum, ToxFile::RECEIVING);
     if (!file)
     {
         qWarning("Core::cancelFileRecv: No such file in queue");
@@ -880,15 +1107,8 @@ void Core::pauseResumeFileRecv(int friendId, int fileNum)
 
 void Core::cancelFileSend(int friendId, int fileNum)
 {
-    ToxFile* file{nullptr};
-    for (ToxFile& f : fileSendQueue)
-    {
-        if (f.fileNum == fileNum && f.friendId == friendId)
-        {
-            file = &f;
-            break;
-        }
-    }
+    QMutexLocker locker(&toxMutex);
+    ToxFile* file = fileTransfers.find(friendId, fileNum, ToxFile::SENDING);
     if (!file)
     {
         qWarning("Core::cancelFileSend: No such file in queue");
@@ -897,21 +1117,14 @@ void Core::cancelFileSend(int friendId, int fileNum)
     file->status = ToxFile::STOPPED;
     emit fileTransferCancelled(file->friendId, file->fileNum, ToxFile::SENDING);
     tox_file_send_control(tox, file->friendId, 0, file->fileNum, TOX_FILECONTROL_KILL, nullptr, 0);
-    while (file->sendTimer) QThread::msleep(1); // Wait until sendAllFileData returns before deleting
-    removeFileFromQueue(true, friendId, fileNum);
+    forgetPendingUpload(friendId, file->filePath);
+    removeStoppedFileSend(friendId, fileNum);
 }
 
 void Core::cancelFileRecv(int friendId, int fileNum)
 {
-    ToxFile* file{nullptr};
-    for (ToxFile& f : fileRecvQueue)
-    {
-        if (f.fileNum == fileNum && f.friendId == friendId)
-        {
-            file = &f;
-            break;
-        }
-    }
+    QMutexLocker locker(&toxMutex);
+    ToxFile* file = fileTransfers.find(friendId, fileNum, ToxFile::RECEIVING);
     if (!file)
     {
         qWarning("Core::cancelFileRecv: No such file in queue");
@@ -920,20 +1133,15 @@ void Core::cancelFileRecv(int friendId, int fileNum)
     file->status = ToxFile::STOPPED;
     emit fileTransferCancelled(file->friendId, file->fileNum, ToxFile::RECEIVING);
     tox_file_send_control(tox, file->friendId, 1, file->fileNum, TOX_FILECONTROL_KILL, nullptr, 0);
-    removeFileFromQueue(true, friendId, fileNum);
+    fileWriter->cancel(friendId, fileNum);
+    Settings::getInstance().setPartialDownload(getFriendAddress(friendId), QString::fromUtf8(file->fileName), file->filesize, "");
+    removeFileTransfer(friendId, fileNum, ToxFile::RECEIVING);
 }
 
 void Core::rejectFileRecvRequest(int friendId, int fileNum)
 {
-    ToxFile* file{nullptr};
-    for (ToxFile& f : fileRecvQueue)
-    {
-        if (f.fileNum == fileNum && f.friendId == friendId)
-        {
-            file = &f;
-            break;
-        }
-    }
+    QMutexLocker locker(&toxMutex);
+    ToxFile* file = fileTransfers.find(friendId, fileNum, ToxFile::RECEIVING);
     if (!file)
     {
         qWarning("Core::rejectFileRecvRequest: No such file in queue");
@@ -942,43 +1150,233 @@ void Core::rejectFileRecvRequest(int friendId, int fileNum)
     file->status = ToxFile::STOPPED;
     emit fileTransferCancelled(file->friendId, file->fileNum, ToxFile::SENDING);
     tox_file_send_control(tox, file->friendId, 1, file->fileNum, TOX_FILECONTROL_KILL, nullptr, 0);
-    removeFileFromQueue(false, friendId, fileNum);
+    removeFileTransfer(friendId, fileNum, ToxFile::RECEIVING);
 }
 
 void Core::acceptFileRecvRequest(int friendId, int fileNum, QString path)
 {
-    ToxFile* file{nullptr};
-    for (ToxFile& f : fileRecvQueue)
+    long long filesize;
     {
-        if (f.fileNum == fileNum && f.friendId == friendId)
+        QMutexLocker locker(&toxMutex);
+        ToxFile* file = fileTransfers.find(friendId, fileNum, ToxFile::RECEIVING);
+        if (!file)
         {
-            file = &f;
-            break;
+            qWarning("Core::acceptFileRecvRequest: No such file in queue");
+            return;
         }
+        filesize = file->filesize;
     }
+
+    // Reading back what a previous attempt left doesn't need the toxcore lock
+    TransferJournal* journal = new TransferJournal(path, filesize);
+    uint64_t resumePos = 0;
+    if (Settings::getInstance().getResumeTransfers() && journal->load())
+        resumePos = journal->resumeOffset();
+
+    QMutexLocker locker(&toxMutex);
+    ToxFile* file = fileTransfers.find(friendId, fileNum, ToxFile::RECEIVING);
     if (!file)
     {
         qWarning("Core::acceptFileRecvRequest: No such file in queue");
+        delete journal;
         return;
     }
     file->setFilePath(path);
     if (!file->open(true))
     {
         qWarning() << "Core::acceptFileRecvRequest: Unable to open file";
+        delete journal;
         return;
     }
+    file->file->close(); // the writer has a handle of its own on its thread
+    Settings::getInstance().setPartialDownload(getFriendAddress(friendId), QString::fromUtf8(file->fileName), file->filesize, path);
     file->status = ToxFile::TRANSMITTING;
     emit fileTransferAccepted(*file);
-    tox_file_send_control(tox, file->friendId, 1, file->fileNum, TOX_FILECONTROL_ACCEPT, nullptr, 0);
+    if (resumePos > 0)
+    {
+        // Nothing is skipped until the friend proved its file starts like ours, friends without qTox never answer
+        registerResumePackets(friendId);
+        if (sendResumePacket(friendId, QTOX_PACKET_RESUME_OFFER, fileNum, resumePos, journal->resumeDigest(resumePos)))
+        {
+            qDebug() << "Core::acceptFileRecvRequest: Offering to resume" << path << "from" << resumePos;
+            resumeOffers.insert(FileTransferTable::key(friendId, fileNum, ToxFile::RECEIVING), {journal, resumePos});
+            QMetaObject::invokeMethod(this, "startResumeTimeout", Qt::QueuedConnection,
+                                      Q_ARG(int, friendId), Q_ARG(int, fileNum));
+            return;
+        }
+    }
+    startFileRecv(file, journal, 0);
+}
+
+void Core::startFileRecv(ToxFile* file, TransferJournal* journal, uint64_t resumePos)
+{
+    if (resumePos == 0)
+    {
+        // What a previous attempt left is overwritten
+        delete journal;
+        journal = new TransferJournal(file->filePath, file->filesize);
+    }
+    file->bytesSent = resumePos;
+    fileWriter->open(file->friendId, file->fileNum, file->filePath, file->filesize, journal);
+    if (resumePos > 0)
+    {
+        // The writer checks the block the friend sends first against the one we had before writing it
+        qDebug() << "Core::startFileRecv: Resuming" << file->filePath << "from" << resumePos;
+        tox_file_send_control(tox, file->friendId, 1, file->fileNum, TOX_FILECONTROL_ACCEPT,
+                              reinterpret_cast<const uint8_t*>(&resumePos), sizeof(uint64_t));
+        int friendId = file->friendId, fileNum = file->fileNum;
+        qint64 size = file->filesize;
+        eventQueue->post([=]{ emit fileTransferInfo(friendId, fileNum, size, resumePos, ToxFile::RECEIVING); });
+    }
+    else
+    {
+        tox_file_send_control(tox, file->friendId, 1, file->fileNum, TOX_FILECONTROL_ACCEPT, nullptr, 0);
+    }
+}
+
+void Core::startResumeTimeout(int friendId, int fileNum)
+{
+    QTimer* timeout = new QTimer(this);
+    timeout->setSingleShot(true);
+    connect(timeout, &QTimer::timeout, [this, friendId, fileNum, timeout]()
+    {
+        timeout->deleteLater();
+        QMutexLocker locker(&toxMutex);
+        ToxFile* file = fileTransfers.find(friendId, fileNum, ToxFile::RECEIVING);
+        auto it = resumeOffers.find(FileTransferTable::key(friendId, fileNum, ToxFile::RECEIVING));
+        if (!file || it == resumeOffers.end())
+            return; // answered or cancelled already
+
+        qDebug() << "Core::startResumeTimeout: No answer to the resume offer, downloading" << file->filePath << "from the start";
+        TransferJournal* journal = it->journal;
+        resumeOffers.erase(it);
+        startFileRecv(file, journal, 0);
+    });
+    timeout->start(QTOX_FILE_RESUME_TIMEOUT);
+}
+
+void Core::onResumeChecked(int friendId, int fileNum, qint64 offset)
+{
+    QMutexLocker locker(&toxMutex);
+    ToxFile* file = fileTransfers.find(friendId, fileNum, ToxFile::SENDING);
+    if (!file || file->status != ToxFile::STOPPED)
+        return;
+
+    qDebug() << "Core::onResumeChecked: Friend" << friendId << "may resume file" << fileNum << "from" << offset;
+    file->resumeOffset = offset;
+    sendResumePacket(friendId, QTOX_PACKET_RESUME_CONFIRM, fileNum, offset);
+}
+
+QString Core::getPartialDownload(int friendId, const QString& fileName, long long filesize) const
+{
+    if (!Settings::getInstance().getResumeTransfers())
+        return QString();
+
+    QString path = Settings::getInstance().getPartialDownload(getFriendAddress(friendId), fileName, filesize);
+    if (path.isEmpty() || !TransferJournal::exists(path))
+        return QString();
+    return path;
+}
+
+void Core::offerPendingUploads(int friendId)
+{
+    if (!Settings::getInstance().getResumeTransfers())
+        return;
+
+    // A friend that was only disconnected resumes broken uploads by itself, one that restarted never will
+    QTimer* grace = new QTimer(this);
+    grace->setSingleShot(true);
+    connect(grace, &QTimer::timeout, [this, friendId, grace]()
+    {
+        grace->deleteLater();
+        reofferPendingUploads(friendId);
+    });
+    grace->start(TOX_FILE_RESUME_GRACE);
+}
+
+void Core::reofferPendingUploads(int friendId)
+{
+    QString address = getFriendAddress(friendId);
+    for (const QString& path : Settings::getInstance().getPendingUploads(address))
+    {
+        bool inProgress = false;
+        {
+            QMutexLocker locker(&toxMutex);
+            if (!tox || tox_get_friend_connection_status(tox, friendId) != 1)
+                return;
+
+            for (ToxFile* f : fileTransfers.ofFriend(friendId))
+            {
+                if (f->direction != ToxFile::SENDING || f->filePath != path)
+                    continue;
+                if (f->status != ToxFile::BROKEN)
+                {
+                    inProgress = true;
+                    break;
+                }
+                // The friend forgot about it, it gets a new offer below
+                int fileNum = f->fileNum;
+                f->status = ToxFile::STOPPED;
+                emit fileTransferCancelled(friendId, fileNum, ToxFile::SENDING);
+                removeStoppedFileSend(friendId, fileNum);
+                break;
+            }
+        }
+        if (inProgress)
+            continue;
+
+        QFileInfo info(path);
+        if (!info.exists())
+        {
+            Settings::getInstance().removePendingUpload(address, path);
+            continue;
+        }
+        qDebug() << "Core::offerPendingUploads: Offering" << path << "to friend" << friendId << "again";
+        sendFile(friendId, info.fileName(), path, info.size());
+    }
+}
+
+void Core::forgetPendingUpload(int friendId, QString path)
+{
+    Settings::getInstance().removePendingUpload(getFriendAddress(friendId), path);
+}
+
+void Core::rememberPendingUpload(int friendId, QString path)
+{
+    if (!Settings::getInstance().getResumeTransfers())
+        return;
+    Settings::getInstance().addPendingUpload(getFriendAddress(friendId), path);
+}
+
+void Core::resumeThrottledFileRecv(int friendId, int fileNum)
+{
+    QMutexLocker locker(&toxMutex);
+    ToxFile* file = fileTransfers.find(friendId, fileNum, ToxFile::RECEIVING);
+    // Not if the user paused it in the meantime
+    if (file && file->status == ToxFile::TRANSMITTING)
+    {
+        qDebug() << "Core::resumeThrottledFileRecv: Resuming file" << fileNum << "of friend" << friendId;
+        tox_file_send_control(tox, friendId, 1, fileNum, TOX_FILECONTROL_ACCEPT, nullptr, 0);
+    }
 }
 
 void Core::removeFriend(int friendId)
 {
+    QMutexLocker locker(&toxMutex);
     if (!tox)
         return;
+    uint8_t clientId[TOX_CLIENT_ID_SIZE];
+    bool knownId = tox_get_client_id(tox, friendId, clientId) == 0;
     if (tox_del_friend(tox, friendId) == -1) {
         emit failedToRemoveFriend(friendId);
     } else {
+        {
+            QMutexLocker stateLocker(&stateMutex);
+            friendAddresses.remove(friendId);
+            friendNames.remove(friendId);
+            if (knownId)
+                peerNames.remove(CUserId::toString(clientId));
+        }
         saveConfiguration();
         emit friendRemoved(friendId);
     }
@@ -986,29 +1384,30 @@ void Core::removeFriend(int friendId)
 
 void Core::removeGroup(int groupId)
 {
+    QMutexLocker locker(&toxMutex);
     if (!tox)
         return;
     tox_del_groupchat(tox, groupId);
+
+    QMutexLocker stateLocker(&stateMutex);
+    groupPeers.remove(groupId);
 }
 
 QString Core::getUsername() const
 {
-    QString sname;
-    int size = tox_get_self_name_size(tox);
-    uint8_t* name = new uint8_t[size];
-    if (tox_get_self_name(tox, name) == size)
-        sname = CString::toString(name, size);
-    delete[] name;
-    return sname;
+    QMutexLocker locker(&stateMutex);
+    return selfName;
 }
 
 void Core::setUsername(const QString& username)
 {
+    QMutexLocker locker(&toxMutex);
     CString cUsername(username);
 
     if (tox_set_name(tox, cUsername.data(), cUsername.size()) == -1) {
         emit failedToSetUsername(username);
     } else {
+        cacheSelf();
         emit usernameSet(username);
         saveConfiguration();
     }
@@ -1016,6 +1415,7 @@ void Core::setUsername(const QString& username)
 
 void Core::setAvatar(uint8_t format, const QByteArray& data)
 {
+    QMutexLocker locker(&toxMutex);
     if (tox_set_avatar(tox, format, (uint8_t*)data.constData(), data.size()) != 0)
     {
         qWarning() << "Core: Failed to set self avatar";
@@ -1036,9 +1436,8 @@ void Core::setAvatar(uint8_t format, const QByteArray& data)
 
 ToxID Core::getSelfId() const
 {
-    uint8_t friendAddress[TOX_FRIEND_ADDRESS_SIZE];
-    tox_get_address(tox, friendAddress);
-    return ToxID::fromString(CFriendAddress::toString(friendAddress));
+    QMutexLocker locker(&stateMutex);
+    return selfId;
 }
 
 QString Core::getIDString() const
@@ -1050,22 +1449,19 @@ QString Core::getIDString() const
 
 QString Core::getStatusMessage() const
 {
-    QString sname;
-    int size = tox_get_self_status_message_size(tox);
-    uint8_t* name = new uint8_t[size];
-    if (tox_get_self_status_message(tox, name, size) == size)
-        sname = CString::toString(name, size);
-    delete[] name;
-    return sname;
+    QMutexLocker locker(&stateMutex);
+    return selfStatusMessage;
 }
 
 void Core::setStatusMessage(const QString& message)
 {
+    QMutexLocker locker(&toxMutex);
     CString cMessage(message);
 
     if (tox_set_status_message(tox, cMessage.data(), cMessage.size()) == -1) {
         emit failedToSetStatusMessage(message);
     } else {
+        cacheSelf();
         saveConfiguration();
         emit statusMessageSet(message);
     }
@@ -1073,6 +1469,7 @@ void Core::setStatusMessage(const QString& message)
 
 void Core::setStatus(Status status)
 {
+    QMutexLocker locker(&toxMutex);
     TOX_USERSTATUS userstatus;
     switch (status) {
         case Status::Online:
@@ -1100,9 +1497,43 @@ void Core::setStatus(Status status)
 void Core::onFileTransferFinished(ToxFile file)
 {
      if (file.direction == file.SENDING)
+     {
+          forgetPendingUpload(file.friendId, file.filePath);
           emit fileUploadFinished(file.filePath);
+     }
      else
+     {
+          Settings::getInstance().setPartialDownload(getFriendAddress(file.friendId), QString::fromUtf8(file.fileName),
+                                                     file.filesize, "");
           emit fileDownloadFinished(file.filePath);
+     }
+}
+
+void Core::startFileSend(int friendId, int fileNum)
+{
+    QMutexLocker locker(&toxMutex);
+    ToxFile* file = fileTransfers.find(friendId, fileNum, ToxFile::SENDING);
+    if (!file || file->status != ToxFile::TRANSMITTING)
+        return;
+
+    fileScheduler->add(friendId, fileNum);
+}
+
+void Core::removeStoppedFileSend(int friendId, int fileNum)
+{
+    QMutexLocker locker(&toxMutex);
+    fileScheduler->remove(friendId, fileNum);
+    removeFileTransfer(friendId, fileNum, ToxFile::SENDING);
+}
+
+long long Core::getFileSendRate(int friendId, int fileNum) const
+{
+    return fileScheduler->getRate(friendId, fileNum);
+}
+
+void Core::setFileSendPriority(int friendId, int fileNum, int priority)
+{
+    fileScheduler->setPriority(friendId, fileNum, priority);
 }
 
 QString Core::sanitize(QString name)
@@ -1195,6 +1626,7 @@ bool Core::loadConfiguration(QString path)
     configurationFile.close();
 
     // set GUI with user and statusmsg
+    cacheSelf();
     QString name = getUsername();
     if (!name.isEmpty())
         emit usernameSet(name);
@@ -1307,6 +1739,7 @@ void Core::saveConfiguration(const QString& path)
 
     qDebug() << "Core: writing tox_save to " << path;
 
+    QMutexLocker locker(&toxMutex);
     uint32_t fileSize; bool encrypt = Settings::getInstance().getEncryptTox();
     if (encrypt)
         fileSize = tox_encrypted_size(tox);
@@ -1321,7 +1754,9 @@ void Core::saveConfiguration(const QString& path)
             if (!pwsaltedkeys[ptMain])
             {
                 // probably zero chance event
+                locker.unlock(); // the GUI may need it while the box is shown
                 Widget::getInstance()->showWarningMsgBox(tr("NO Password"), tr("Will be saved without encryption!"));
+                locker.relock();
                 tox_save(tox, data);
             }
             else
@@ -1353,14 +1788,27 @@ void Core::switchConfiguration(const QString& profile)
     saveConfiguration();
     clearPassword(ptMain);
     clearPassword(ptHistory);
-    toxTimer->stop();
+    stopNetwork();
     
     Widget::getInstance()->setEnabledThreadsafe(false);
-    if (tox) {
-        toxav_kill(toxav);
-        toxav = nullptr;
-        tox_kill(tox);
-        tox = nullptr;
+    {
+        QMutexLocker locker(&toxMutex); // not across the blocking signal below, the GUI may need it
+        if (tox) {
+            toxav_kill(toxav);
+            toxav = nullptr;
+            tox_kill(tox);
+            tox = nullptr;
+        }
+    }
+    {
+        QMutexLocker locker(&stateMutex);
+        selfName.clear();
+        selfStatusMessage.clear();
+        selfId = ToxID();
+        friendAddresses.clear();
+        friendNames.clear();
+        peerNames.clear();
+        groupPeers.clear();
     }
     emit selfAvatarChanged(QPixmap(":/img/contact_dark.png"));
     emit blockingClearContacts(); // we need this to block, but signals are required for thread safety
@@ -1386,13 +1834,16 @@ void Core::loadFriends()
         uint8_t clientId[TOX_CLIENT_ID_SIZE];
         for (int32_t i = 0; i < static_cast<int32_t>(friendCount); ++i) {
             if (tox_get_client_id(tox, ids[i], clientId) == 0) {
+                cacheFriend(ids[i]);
                 emit friendAdded(ids[i], CUserId::toString(clientId));
 
                 const int nameSize = tox_get_name_size(tox, ids[i]);
                 if (nameSize > 0) {
                     uint8_t *name = new uint8_t[nameSize];
                     if (tox_get_name(tox, ids[i], name) == nameSize) {
-                        emit friendUsernameChanged(ids[i], CString::toString(name, nameSize));
+                        QString sname = CString::toString(name, nameSize);
+                        setPeerName(ids[i], sname);
+                        emit friendUsernameChanged(ids[i], sname);
                     }
                     delete[] name;
                 }
@@ -1412,216 +1863,251 @@ void Core::loadFriends()
         }
         delete[] ids;
     }
+    emit friendsLoaded(friendCount);
+}
+
+void Core::setPeerName(int friendId, const QString& name)
+{
+    uint8_t clientId[TOX_CLIENT_ID_SIZE];
+    if (tox_get_client_id(tox, friendId, clientId) != 0)
+        return;
+
+    QString publicKey = CUserId::toString(clientId);
+    QMutexLocker locker(&stateMutex);
+    peerNames[publicKey] = name;
+    friendNames[friendId] = name;
+}
+
+void Core::cacheSelf()
+{
+    if (!tox)
+        return;
+
+    QString name, statusMessage;
+    int size = tox_get_self_name_size(tox);
+    uint8_t* cName = new uint8_t[size];
+    if (tox_get_self_name(tox, cName) == size)
+        name = CString::toString(cName, size);
+    delete[] cName;
+
+    size = tox_get_self_status_message_size(tox);
+    uint8_t* cStatusMessage = new uint8_t[size];
+    if (tox_get_self_status_message(tox, cStatusMessage, size) == size)
+        statusMessage = CString::toString(cStatusMessage, size);
+    delete[] cStatusMessage;
+
+    uint8_t friendAddress[TOX_FRIEND_ADDRESS_SIZE];
+    tox_get_address(tox, friendAddress);
+
+    QMutexLocker locker(&stateMutex);
+    selfName = name;
+    selfStatusMessage = statusMessage;
+    selfId = ToxID::fromString(CFriendAddress::toString(friendAddress));
+}
+
+void Core::cacheFriend(int friendId)
+{
+    uint8_t rawid[TOX_CLIENT_ID_SIZE];
+    if (tox_get_client_id(tox, friendId, rawid) != 0)
+        return;
+    QString id = CUserId::toString(rawid);
+
+    // If we don't know the full address of the client, keep just the id
+    QString addr = Settings::getInstance().getFriendAddress(id);
+    if (addr.isEmpty())
+        addr = id;
+
+    uint8_t name[TOX_MAX_NAME_LENGTH];
+    int nameSize = tox_get_name(tox, friendId, name);
+
+    QMutexLocker locker(&stateMutex);
+    friendAddresses[friendId] = addr;
+    if (nameSize >= 0)
+    {
+        QString sname = CString::toString(name, nameSize);
+        friendNames[friendId] = sname;
+        peerNames[id] = sname;
+    }
+}
+
+void Core::cacheGroupPeers(int groupId)
+{
+    int nPeers = tox_group_number_peers(tox, groupId);
+    QVector<GroupPeer> peers;
+    for (int i = 0; i < nPeers; i++)
+    {
+        GroupPeer peer;
+        uint8_t name[TOX_MAX_NAME_LENGTH];
+        int length = tox_group_peername(tox, groupId, i, name);
+        if (length >= 0)
+            peer.name = CString::toString(name, length);
+        uint8_t key[TOX_CLIENT_ID_SIZE];
+        if (tox_group_peer_pubkey(tox, groupId, i, key) != -1)
+            peer.key = CUserId::toString(key);
+        peers.append(peer);
+    }
+
+    QMutexLocker locker(&stateMutex);
+    if (nPeers < 0)
+        groupPeers.remove(groupId);
+    else
+        groupPeers[groupId] = peers;
 }
 
 void Core::checkLastOnline(int friendId) {
     const uint64_t lastOnline = tox_get_last_online(tox, friendId);
     if (lastOnline > 0) {
-        emit friendLastSeenChanged(friendId, QDateTime::fromTime_t(lastOnline));
+        QDateTime lastSeen = QDateTime::fromTime_t(lastOnline);
+        eventQueue->post([=]{ emit friendLastSeenChanged(friendId, lastSeen); });
     }
 }
 
 int Core::getGroupNumberPeers(int groupId) const
 {
-    return tox_group_number_peers(tox, groupId);
+    QMutexLocker locker(&stateMutex);
+    auto it = groupPeers.constFind(groupId);
+    if (it == groupPeers.constEnd())
+        return -1;
+    return it->size();
 }
 
 QString Core::getGroupPeerName(int groupId, int peerId) const
 {
-    QString name;
-    uint8_t nameArray[TOX_MAX_NAME_LENGTH];
-    int length = tox_group_peername(tox, groupId, peerId, nameArray);
-    if (length == -1)
+    QMutexLocker locker(&stateMutex);
+    const QVector<GroupPeer> peers = groupPeers.value(groupId);
+    if (peerId < 0 || peerId >= peers.size())
     {
-        qWarning() << "Core::getGroupPeerName: Unknown error";
-        return name;
+        qWarning() << "Core::getGroupPeerName: Unknown peer" << peerId << "in group" << groupId;
+        return QString();
     }
-    name = CString::toString(nameArray, length);
-    return name;
+    return peers[peerId].name;
 }
 
-QList<QString> Core::getGroupPeerNames(int groupId) const
+QString Core::getGroupPeerKey(int groupId, int peerId) const
 {
-    QList<QString> names;
-    int nPeers = getGroupNumberPeers(groupId);
-    if (nPeers == -1)
+    QMutexLocker locker(&stateMutex);
+    const QVector<GroupPeer> peers = groupPeers.value(groupId);
+    if (peerId < 0 || peerId >= peers.size())
     {
-        qWarning() << "Core::getGroupPeerNames: Unable to get number of peers";
-        return names;
+        qWarning() << "Core::getGroupPeerKey: Unknown peer" << peerId << "in group" << groupId;
+        return QString();
     }
-    uint8_t namesArray[nPeers][TOX_MAX_NAME_LENGTH];
-    uint16_t* lengths = new uint16_t[nPeers];
-    int result = tox_group_get_names(tox, groupId, namesArray, lengths, nPeers);
-    if (result != nPeers)
+    return peers[peerId].key;
+}
+
+QList<QString> Core::getGroupPeerNames(int groupId) const
+{
+    QMutexLocker locker(&stateMutex);
+    QList<QString> names;
+    auto it = groupPeers.constFind(groupId);
+    if (it == groupPeers.constEnd())
     {
-        qWarning() << "Core::getGroupPeerNames: Unexpected result";
+        qWarning() << "Core::getGroupPeerNames: Unknown group" << groupId;
         return names;
     }
-    for (int i=0; i<nPeers; i++)
-       names.push_back(CString::toString(namesArray[i], lengths[i]));
+    for (const GroupPeer& peer : *it)
+       names.push_back(peer.name);
     return names;
 }
 
-int Core::joinGroupchat(int32_t friendnumber, const uint8_t* friend_group_public_key,uint16_t length) const
+int Core::joinGroupchat(int32_t friendnumber, const uint8_t* friend_group_public_key,uint16_t length)
 {
+    QMutexLocker locker(&toxMutex);
     qDebug() << QString("Trying to join groupchat invite by friend %1").arg(friendnumber);
-    return tox_join_groupchat(tox, friendnumber, friend_group_public_key,length);
+    int groupId = tox_join_groupchat(tox, friendnumber, friend_group_public_key,length);
+    if (groupId >= 0)
+        cacheGroupPeers(groupId);
+    return groupId;
 }
 
-void Core::quitGroupChat(int groupId) const
+void Core::quitGroupChat(int groupId)
 {
+    QMutexLocker locker(&toxMutex);
     tox_del_groupchat(tox, groupId);
+
+    QMutexLocker stateLocker(&stateMutex);
+    groupPeers.remove(groupId);
 }
 
-void Core::removeFileFromQueue(bool sendQueue, int friendId, int fileId)
+void Core::removeFileTransfer(int friendId, int fileNum, ToxFile::FileDirection direction)
 {
-    bool found = false;
-    if (sendQueue)
-    {
-        for (int i=0; i<fileSendQueue.size();)
-        {
-            if (fileSendQueue[i].friendId == friendId && fileSendQueue[i].fileNum == fileId)
-            {
-                found = true;
-                fileSendQueue[i].file->close();
-                delete fileSendQueue[i].file;
-                fileSendQueue.removeAt(i);
-                continue;
-            }
-            i++;
-        }
-    }
-    else
+    if (!fileTransfers.remove(friendId, fileNum, direction))
+        qWarning() << "Core::removeFileTransfer: No such file in queue";
+
+    auto it = resumeOffers.find(FileTransferTable::key(friendId, fileNum, direction));
+    if (it != resumeOffers.end())
     {
-        for (int i=0; i<fileRecvQueue.size();)
-        {
-            if (fileRecvQueue[i].friendId == friendId && fileRecvQueue[i].fileNum == fileId)
-            {
-                found = true;
-                fileRecvQueue[i].file->close();
-                delete fileRecvQueue[i].file;
-                fileRecvQueue.removeAt(i);
-                continue;
-            }
-            i++;
-        }
+        delete it->journal;
+        resumeOffers.erase(it);
     }
-    if (!found)
-        qWarning() << "Core::removeFileFromQueue: No such file in queue";
 }
 
-void Core::sendAllFileData(Core *core, ToxFile* file)
+long long Core::sendFileData(ToxFile* file, const char* data, long long length)
 {
-    if (file->status == ToxFile::PAUSED)
-    {
-        file->sendTimer->start(5+TOX_FILE_INTERVAL);
-        return;
-    }
-    else if (file->status == ToxFile::STOPPED)
-    {
-        qWarning("Core::sendAllFileData: File is stopped");
-        file->sendTimer->disconnect();
-        delete file->sendTimer;
-        file->sendTimer = nullptr;
-        return;
-    }
-    emit core->fileTransferInfo(file->friendId, file->fileNum, file->filesize, file->bytesSent, ToxFile::SENDING);
-//    qApp->processEvents();
-    long long chunkSize = tox_file_data_size(core->tox, file->friendId);
+    long long chunkSize = tox_file_data_size(tox, file->friendId);
     if (chunkSize == -1)
     {
-        qWarning("Core::fileHeartbeat: Error getting preffered chunk size, aborting file send");
-        file->status = ToxFile::STOPPED;
-        emit core->fileTransferCancelled(file->friendId, file->fileNum, ToxFile::SENDING);
-        tox_file_send_control(core->tox, file->friendId, 0, file->fileNum, TOX_FILECONTROL_KILL, nullptr, 0);
-        removeFileFromQueue(true, file->friendId, file->fileNum);
-        return;
-    }
-    //qDebug() << "chunkSize: " << chunkSize;
-    chunkSize = std::min(chunkSize, file->filesize);
-    uint8_t* data = new uint8_t[chunkSize];
-    file->file->seek(file->bytesSent);
-    int readSize = file->file->read((char*)data, chunkSize);
-    if (readSize == -1)
-    {
-        qWarning() << QString("Core::sendAllFileData: Error reading from file: %1").arg(file->file->errorString());
-        delete[] data;
-        file->status = ToxFile::STOPPED;
-        emit core->fileTransferCancelled(file->friendId, file->fileNum, ToxFile::SENDING);
-        tox_file_send_control(core->tox, file->friendId, 0, file->fileNum, TOX_FILECONTROL_KILL, nullptr, 0);
-        removeFileFromQueue(true, file->friendId, file->fileNum);
-        return;
-    }
-    else if (readSize == 0)
-    {
-        qWarning() << QString("Core::sendAllFileData: Nothing to read from file: %1").arg(file->file->errorString());
-        delete[] data;
-        file->status = ToxFile::STOPPED;
-        emit core->fileTransferCancelled(file->friendId, file->fileNum, ToxFile::SENDING);
-        tox_file_send_control(core->tox, file->friendId, 0, file->fileNum, TOX_FILECONTROL_KILL, nullptr, 0);
-        removeFileFromQueue(true, file->friendId, file->fileNum);
-        return;
-    }
-    if (tox_file_send_data(core->tox, file->friendId, file->fileNum, data, readSize) == -1)
-    {
-        //qWarning("Core::fileHeartbeat: Error sending data chunk");
-        //core->process();
-        delete[] data;
-        //QThread::msleep(1);
-        file->sendTimer->start(1+TOX_FILE_INTERVAL);
-        return;
+        qWarning("Core::sendFileData: Error getting preffered chunk size, aborting file send");
+        abortFileSend(this, file);
+        return 0;
     }
-    delete[] data;
-    file->bytesSent += readSize;
-    //qDebug() << QString("Core::fileHeartbeat: sent %1/%2 bytes").arg(file->bytesSent).arg(file->fileData.size());
 
-    if (file->bytesSent < file->filesize)
+    // Send until toxcore's queue is full, a refused chunk is offered again on the next turn
+    length = std::min(length, file->filesize - file->bytesSent);
+    long long sent = 0;
+    while (sent < length)
     {
-        file->sendTimer->start(TOX_FILE_INTERVAL);
-        return;
+        int chunk = std::min(chunkSize, length - sent);
+        if (tox_file_send_data(tox, file->friendId, file->fileNum, reinterpret_cast<const uint8_t*>(data) + sent, chunk) == -1)
+            break;
+        file->bytesSent += chunk;
+        sent += chunk;
     }
-    else
+    if (sent > 0)
+        emit fileTransferInfo(file->friendId, file->fileNum, file->filesize, file->bytesSent, ToxFile::SENDING);
+
+    if (file->bytesSent >= file->filesize)
     {
-        //qDebug("Core: File transfer finished");
-        file->sendTimer->disconnect();
-        delete file->sendTimer;
-        file->sendTimer = nullptr;
-        tox_file_send_control(core->tox, file->friendId, 0, file->fileNum, TOX_FILECONTROL_FINISHED, nullptr, 0);
-        //emit core->fileTransferFinished(*file);
+        tox_file_send_control(tox, file->friendId, 0, file->fileNum, TOX_FILECONTROL_FINISHED, nullptr, 0);
     }
+    return sent;
+}
+
+void Core::abortFileSend(Core* core, ToxFile* file)
+{
+    QMetaObject::invokeMethod(core, "forgetPendingUpload", Qt::QueuedConnection,
+                              Q_ARG(int, file->friendId), Q_ARG(QString, file->filePath));
+    file->status = ToxFile::STOPPED;
+    emit core->fileTransferCancelled(file->friendId, file->fileNum, ToxFile::SENDING);
+    tox_file_send_control(core->tox, file->friendId, 0, file->fileNum, TOX_FILECONTROL_KILL, nullptr, 0);
+    core->removeFileTransfer(file->friendId, file->fileNum, ToxFile::SENDING);
 }
 
 void Core::groupInviteFriend(int friendId, int groupId)
 {
+    QMutexLocker locker(&toxMutex);
     tox_invite_friend(tox, friendId, groupId);
 }
 
 void Core::createGroup()
 {
-    emit emptyGroupCreated(tox_add_groupchat(tox));
+    QMutexLocker locker(&toxMutex);
+    int groupId = tox_add_groupchat(tox);
+    if (groupId >= 0)
+        cacheGroupPeers(groupId);
+    emit emptyGroupCreated(groupId);
 }
 
 QString Core::getFriendAddress(int friendNumber) const
 {
-    // If we don't know the full address of the client, return just the id, otherwise get the full address
-    uint8_t rawid[TOX_CLIENT_ID_SIZE];
-    tox_get_client_id(tox, friendNumber, rawid);
-    QByteArray data((char*)rawid,TOX_CLIENT_ID_SIZE);
-    QString id = data.toHex().toUpper();
-
-    QList<QString>& friendAddresses = Settings::getInstance().friendAddresses;
-    for (QString addr : friendAddresses)
-        if (addr.toUpper().contains(id))
-            return addr;
-
-    return id;
+    QMutexLocker locker(&stateMutex);
+    return friendAddresses.value(friendNumber);
 }
 
 QString Core::getFriendUsername(int friendnumber) const
 {
-    uint8_t name[TOX_MAX_NAME_LENGTH];
-    tox_get_name(tox, friendnumber, name);
-    return CString::toString(name, tox_get_name_size(tox, friendnumber));
+    QMutexLocker locker(&stateMutex);
+    return friendNames.value(friendnumber);
 }
 
 QList<CString> Core::splitMessage(const QString &message)
@@ -1682,30 +2168,51 @@ void Core::clearPassword(PasswordType passtype)
 }
 
 QByteArray Core::encryptData(const QByteArray& data, PasswordType passtype)
+{
+    return encryptData(data, getPasswordKey(passtype));
+}
+
+QByteArray Core::decryptData(const QByteArray& data, PasswordType passtype)
+{
+    return decryptData(data, getPasswordKey(passtype));
+}
+
+QByteArray Core::getPasswordKey(PasswordType passtype) const
 {
     if (!pwsaltedkeys[passtype])
         return QByteArray();
-    uint8_t encrypted[data.size() + tox_pass_encryption_extra_length()];
-    if (tox_pass_key_encrypt(reinterpret_cast<const uint8_t*>(data.data()), data.size(), pwsaltedkeys[passtype], encrypted) == -1)
+    return QByteArray(reinterpret_cast<const char*>(pwsaltedkeys[passtype]), tox_pass_key_length());
+}
+
+QByteArray Core::encryptData(const QByteArray& data, const QByteArray& key)
+{
+    if (key.size() != static_cast<int>(tox_pass_key_length()))
+        return QByteArray();
+    QByteArray encrypted(data.size() + tox_pass_encryption_extra_length(), 0);
+    if (tox_pass_key_encrypt(reinterpret_cast<const uint8_t*>(data.data()), data.size(),
+                             reinterpret_cast<const uint8_t*>(key.constData()),
+                             reinterpret_cast<uint8_t*>(encrypted.data())) == -1)
     {
         qWarning() << "Core::encryptData: encryption failed";
         return QByteArray();
     }
-    return QByteArray(reinterpret_cast<char*>(encrypted), data.size() + tox_pass_encryption_extra_length());
+    return encrypted;
 }
 
-QByteArray Core::decryptData(const QByteArray& data, PasswordType passtype)
+QByteArray Core::decryptData(const QByteArray& data, const QByteArray& key)
 {
-    if (!pwsaltedkeys[passtype])
-        return QByteArray();
     int sz = data.size() - tox_pass_encryption_extra_length();
-    uint8_t decrypted[sz];
-    if (tox_pass_key_decrypt(reinterpret_cast<const uint8_t*>(data.data()), data.size(), pwsaltedkeys[passtype], decrypted) != sz)
+    if (key.size() != static_cast<int>(tox_pass_key_length()) || sz <= 0)
+        return QByteArray();
+    QByteArray decrypted(sz, 0);
+    if (tox_pass_key_decrypt(reinterpret_cast<const uint8_t*>(data.data()), data.size(),
+                             reinterpret_cast<const uint8_t*>(key.constData()),
+                             reinterpret_cast<uint8_t*>(decrypted.data())) != sz)
     {
         qWarning() << "Core::decryptData: decryption failed";
         return QByteArray();
     }
-    return QByteArray(reinterpret_cast<char*>(decrypted), sz);
+    return decrypted;
 }
 
 bool Core::isPasswordSet(PasswordType passtype)
@@ -1718,32 +2225,6 @@ bool Core::isPasswordSet(PasswordType passtype)
 
 QString Core::getPeerName(const ToxID& id) const
 {
-    QString name;
-    CUserId cid(id.toString());
-
-    int friendId = tox_get_friend_number(tox, (uint8_t*)cid.data());
-    if (friendId < 0)
-    {
-        qWarning() << "Core::getPeerName: No such peer "+id.toString();
-        return name;
-    }
-
-    const int nameSize = tox_get_name_size(tox, friendId);
-    if (nameSize <= 0)
-    {
-        qWarning() << "Core::getPeerName: Can't get name of friend "+QString().setNum(friendId)+" ("+id.toString()+")";
-        return name;
-    }
-
-    uint8_t* cname = new uint8_t[nameSize<TOX_MAX_NAME_LENGTH ? TOX_MAX_NAME_LENGTH : nameSize];
-    if (tox_get_name(tox, friendId, cname) != nameSize)
-    {
-        qWarning() << "Core::getPeerName: Can't get name of friend "+QString().setNum(friendId)+" ("+id.toString()+")";
-        delete[] cname;
-        return name;
-    }
-
-    name = name.fromLocal8Bit((char*)cname, nameSize);
-    delete[] cname;
-    return name;
+    QMutexLocker locker(&stateMutex);
+    return peerNames.value(id.publicKey);
 }
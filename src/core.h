@@ -20,17 +20,27 @@
 #include <cstdint>
 #include <QObject>
 #include <QMutex>
+#include <QHash>
+#include <QVector>
 
 #include "corestructs.h"
 #include "coreav.h"
 #include "coredefines.h"
+#include "filetransfertable.h"
 
 template <typename T> class QList;
+template <typename T> class QVector;
 class Camera;
 class QTimer;
 class QString;
 class CString;
 class VideoSource;
+class CoreNetwork;
+class CoreEventQueue;
+class FileWriter;
+class FileSendScheduler;
+class TransferJournal;
+struct CoreEvent;
 
 class Core : public QObject
 {
@@ -46,15 +56,19 @@ public:
     static const QString CONFIG_FILE_NAME;
     static QString sanitize(QString name);
 
-    QString getPeerName(const ToxID& id) const;
+    QString getPeerName(const ToxID& id) const; ///< Thread safe, answered from a cache and never calls into toxcore
 
+    // The getters below are thread safe and answered from copies of toxcore's state, they never wait on the network thread
     int getGroupNumberPeers(int groupId) const; ///< Return the number of peers in the group chat on success, or -1 on failure
     QString getGroupPeerName(int groupId, int peerId) const; ///< Get the name of a peer of a group
+    QString getGroupPeerKey(int groupId, int peerId) const; ///< Get the public key of a peer of a group, empty if unknown
     QList<QString> getGroupPeerNames(int groupId) const; ///< Get the names of the peers of a group
     QString getFriendAddress(int friendNumber) const; ///< Get the full address if known, or Tox ID of a friend
     QString getFriendUsername(int friendNumber) const; ///< Get the username of a friend
-    int joinGroupchat(int32_t friendNumber, const uint8_t* pubkey,uint16_t length) const; ///< Accept a groupchat invite
-    void quitGroupChat(int groupId) const; ///< Quit a groupchat
+    long long getFileSendRate(int friendId, int fileNum) const; ///< Bytes per second the upload achieved lately
+    QString getPartialDownload(int friendId, const QString& fileName, long long filesize) const; ///< Where to resume it, if anywhere
+    int joinGroupchat(int32_t friendNumber, const uint8_t* pubkey,uint16_t length); ///< Accept a groupchat invite
+    void quitGroupChat(int groupId); ///< Quit a groupchat
 
     void saveConfiguration();
     void saveConfiguration(const QString& path);
@@ -72,7 +86,6 @@ public:
 
 public slots:
     void start(); ///< Initializes the core, must be called before anything else
-    void process(); ///< Processes toxcore events and ensure we stay connected, called by its own timer
     void bootstrapDht(); ///< Connects us to the Tox network
     void switchConfiguration(const QString& profile); ///< Load a different profile and restart the core
 
@@ -102,6 +115,7 @@ public slots:
     void acceptFileRecvRequest(int friendId, int fileNum, QString path);
     void pauseResumeFileSend(int friendId, int fileNum);
     void pauseResumeFileRecv(int friendId, int fileNum);
+    void setFileSendPriority(int friendId, int fileNum, int priority); ///< Against the friend's other uploads, 1 by default
 
     void answerCall(int callId);
     void hangupCall(int callId);
@@ -115,6 +129,9 @@ public slots:
     void clearPassword(PasswordType passtype);
     QByteArray encryptData(const QByteArray& data, PasswordType passtype);
     QByteArray decryptData(const QByteArray& data, PasswordType passtype);
+    QByteArray getPasswordKey(PasswordType passtype) const; ///< A copy of the derived key, empty if no password is set
+    static QByteArray encryptData(const QByteArray& data, const QByteArray& key); ///< Thread safe, empty on failure
+    static QByteArray decryptData(const QByteArray& data, const QByteArray& key); ///< Thread safe, empty on failure
 
 signals:
     void connected();
@@ -126,6 +143,7 @@ signals:
     void friendMessageReceived(int friendId, const QString& message, bool isAction);
 
     void friendAdded(int friendId, const QString& userId);
+    void friendsLoaded(int count); ///< After the friendAdded of every saved friend
 
     void friendStatusChanged(int friendId, Status status);
     void friendStatusMessageChanged(int friendId, const QString& message);
@@ -140,7 +158,7 @@ signals:
 
     void emptyGroupCreated(int groupnumber);
     void groupInviteReceived(int friendnumber, const uint8_t *group_public_key,uint16_t length);
-    void groupMessageReceived(int groupnumber, const QString& message, const QString& author, bool isAction);
+    void groupMessageReceived(int groupnumber, const QString& message, const QString& author, const QString& authorKey, bool isAction);
     void groupNamelistChanged(int groupnumber, int peernumber, uint8_t change);
 
     void usernameSet(const QString& username);
@@ -212,6 +230,7 @@ private:
     static void onFileDataCallback(Tox *tox, int32_t friendnumber, uint8_t filenumber, const uint8_t *data, uint16_t length, void *userdata);
     static void onAvatarInfoCallback(Tox* tox, int32_t friendnumber, uint8_t format, uint8_t *hash, void *userdata);
     static void onAvatarDataCallback(Tox* tox, int32_t friendnumber, uint8_t format, uint8_t *hash, uint8_t *data, uint32_t datalen, void *userdata);
+    static int onResumePacket(void* target, const uint8_t* data, uint32_t length); ///< Our resume handshake, in lossless custom packets
 
     static void onAvInvite(void* toxav, int32_t call_index, void* core);
     static void onAvStart(void* toxav, int32_t call_index, void* core);
@@ -233,14 +252,29 @@ private:
     static void playCallVideo(ToxAv* toxav, int32_t callId, vpx_image_t* img, void *user_data);
     void sendCallVideo(int callId);
 
+    int process(); ///< Processes toxcore events and ensures we stay connected, returns the ms until it's due again
+    void dispatchEvents(const QVector<const CoreEvent*>& events); ///< On the GUI thread, for the events queued by the callbacks
     bool checkConnection();
 
     bool loadConfiguration(QString path); // Returns false for a critical error, true otherwise
     void make_tox();
     void loadFriends();
-
-    static void sendAllFileData(Core* core, ToxFile* file);
-    static void removeFileFromQueue(bool sendQueue, int friendId, int fileId);
+    void setPeerName(int friendId, const QString& name);
+    // Copy toxcore's state for the getters, toxMutex must be held
+    void cacheSelf();
+    void cacheFriend(int friendId);
+    void cacheGroupPeers(int groupId);
+
+    long long sendFileData(ToxFile* file, const char* data, long long length); ///< data is the file from bytesSent on, returns how many bytes went out
+    static void abortFileSend(Core* core, ToxFile* file); ///< Kills a send that can't go on
+    void removeStoppedFileSend(int friendId, int fileNum);
+    void reofferPendingUploads(int friendId);
+    void startNetwork();
+    void stopNetwork();
+    void removeFileTransfer(int friendId, int fileNum, ToxFile::FileDirection direction);
+    void startFileRecv(ToxFile* file, TransferJournal* journal, uint64_t resumePos); ///< Accepts it for the writer
+    void registerResumePackets(int friendId); ///< toxMutex must be held
+    bool sendResumePacket(int friendId, uint8_t type, int fileNum, uint64_t offset, const QByteArray& digest = QByteArray());
 
     void checkLastOnline(int friendId);
 
@@ -248,18 +282,59 @@ private:
 
 private slots:
      void onFileTransferFinished(ToxFile file);
+     void startFileSend(int friendId, int fileNum); ///< The scheduler's timer lives on the core thread
+     void resumeThrottledFileRecv(int friendId, int fileNum); ///< Once the file writer caught up
+     void offerPendingUploads(int friendId); ///< Sends again what the friend didn't get all of, once it's online
+     void forgetPendingUpload(int friendId, QString path);
+     void rememberPendingUpload(int friendId, QString path); ///< Once the friend accepted it
+     void startResumeTimeout(int friendId, int fileNum); ///< Downloads from the start if a resume isn't confirmed
+     void onResumeChecked(int friendId, int fileNum, qint64 offset); ///< Our file matched up to offset, or 0
 
 private:
     Tox* tox;
     ToxAv* toxav;
-    QTimer *toxTimer, *fileTimer; //, *saveTimer;
+    CoreNetwork* network;
+    CoreEventQueue* eventQueue;
+    FileWriter* fileWriter;
+    FileSendScheduler* fileScheduler;
     Camera* camera;
     QString loadPath; // meaningless after start() is called
     QList<DhtServer> dhtServerList;
     int dhtServerId;
-    static QList<ToxFile> fileSendQueue, fileRecvQueue;
+    FileTransferTable fileTransfers; ///< Guarded by toxMutex
+    struct ResumeOffer
+    {
+        TransferJournal* journal;
+        uint64_t offset;
+    };
+    QHash<quint64, ResumeOffer> resumeOffers; ///< Downloads waiting for the friend to confirm a resume, guarded by toxMutex
+    struct PacketTarget
+    {
+        Core* core;
+        int friendId; ///< toxcore's custom packet handlers aren't told who sent the packet
+    };
+    QHash<int, PacketTarget*> packetTargets; ///< Guarded by toxMutex
     static ToxCall calls[];
     QMutex fileSendMutex;
+    /// Serializes the calls into toxcore. The network thread holds it for a whole iteration, callbacks included,
+    /// so the GUI must only ever read the copies guarded by stateMutex
+    static QMutex toxMutex;
+    /// Guards the copies below, not toxMutex, so the GUI doesn't wait on a network iteration to render a name.
+    /// Always taken after toxMutex, never the other way round
+    mutable QMutex stateMutex;
+    QString selfName, selfStatusMessage;
+    ToxID selfId;
+    QHash<int, QString> friendAddresses; ///< By friend number
+    QHash<int, QString> friendNames; ///< By friend number
+    QHash<QString, QString> peerNames; ///< Friend names by public key
+    struct GroupPeer
+    {
+        QString key, name;
+    };
+    QHash<int, QVector<GroupPeer>> groupPeers; ///< By group number, then peer number
+
+    friend class CoreNetwork;
+    friend class FileSendScheduler;
 
     uint8_t* pwsaltedkeys[PasswordType::ptCounter]; // use the pw's hash as the "pw"
 
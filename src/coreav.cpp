@@ -15,6 +15,7 @@
 */
 
 #include "core.h"
+#include "coreeventqueue.h"
 #include "video/camera.h"
 #include <QDebug>
 #include <QTimer>
@@ -59,12 +60,13 @@ void Core::prepareCall(int friendId, int callId, ToxAv* toxav, bool videoEnabled
     calls[callId].sendAudioTimer->setInterval(5);
     calls[callId].sendAudioTimer->setSingleShot(true);
     connect(calls[callId].sendAudioTimer, &QTimer::timeout, [=](){sendCallAudio(callId,toxav);});
-    calls[callId].sendAudioTimer->start();
+    // called back from the network thread, the timers live on the core thread
+    QMetaObject::invokeMethod(calls[callId].sendAudioTimer, "start");
     calls[callId].sendVideoTimer->setInterval(50);
     calls[callId].sendVideoTimer->setSingleShot(true);
     if (calls[callId].videoEnabled)
     {
-        calls[callId].sendVideoTimer->start();
+        QMetaObject::invokeMethod(calls[callId].sendVideoTimer, "start");
         Camera::getInstance()->subscribe();
     }
 }
@@ -84,16 +86,16 @@ void Core::onAvMediaChange(void* toxav, int32_t callId, void* core)
     if (settings.call_type == TypeAudio)
     {
         calls[callId].videoEnabled = false;
-        calls[callId].sendVideoTimer->stop();
+        QMetaObject::invokeMethod(calls[callId].sendVideoTimer, "stop");
         Camera::getInstance()->unsubscribe();
-        emit ((Core*)core)->avMediaChange(friendId, callId, false);
+        static_cast<Core*>(core)->eventQueue->post([=]{ emit static_cast<Core*>(core)->avMediaChange(friendId, callId, false); });
     }
     else
     {
         Camera::getInstance()->subscribe();
         calls[callId].videoEnabled = true;
-        calls[callId].sendVideoTimer->start();
-        emit ((Core*)core)->avMediaChange(friendId, callId, true);
+        QMetaObject::invokeMethod(calls[callId].sendVideoTimer, "start");
+        static_cast<Core*>(core)->eventQueue->post([=]{ emit static_cast<Core*>(core)->avMediaChange(friendId, callId, true); });
     }
     return;
 
@@ -104,6 +106,7 @@ fail: // Centralized error handling
 
 void Core::answerCall(int callId)
 {
+    QMutexLocker locker(&toxMutex);
     int friendId = toxav_get_peer_id(toxav, callId, 0);
     if (friendId < 0)
     {
@@ -136,6 +139,7 @@ void Core::answerCall(int callId)
 
 void Core::hangupCall(int callId)
 {
+    QMutexLocker locker(&toxMutex);
     qDebug() << QString("Core: hanging up call %1").arg(callId);
     calls[callId].active = false;
     toxav_hangup(toxav, callId);
@@ -143,6 +147,7 @@ void Core::hangupCall(int callId)
 
 void Core::startCall(int friendId, bool video)
 {
+    QMutexLocker locker(&toxMutex);
     int callId;
     ToxAvCSettings cSettings = av_DefaultSettings;
     cSettings.max_video_width = TOXAV_MAX_VIDEO_WIDTH;
@@ -182,6 +187,7 @@ void Core::startCall(int friendId, bool video)
 
 void Core::cancelCall(int callId, int friendId)
 {
+    QMutexLocker locker(&toxMutex);
     qDebug() << QString("Core: Cancelling call with %1").arg(friendId);
     calls[callId].active = false;
     toxav_cancel(toxav, callId, friendId, 0);
@@ -192,8 +198,8 @@ void Core::cleanupCall(int callId)
     qDebug() << QString("Core: cleaning up call %1").arg(callId);
     calls[callId].active = false;
     disconnect(calls[callId].sendAudioTimer,0,0,0);
-    calls[callId].sendAudioTimer->stop();
-    calls[callId].sendVideoTimer->stop();
+    QMetaObject::invokeMethod(calls[callId].sendAudioTimer, "stop");
+    QMetaObject::invokeMethod(calls[callId].sendVideoTimer, "stop");
     if (calls[callId].videoEnabled)
         Camera::getInstance()->unsubscribe();
     alcCaptureStop(alInDev);
@@ -213,6 +219,7 @@ void Core::playCallAudio(ToxAv* toxav, int32_t callId, int16_t *data, int sample
 
 void Core::sendCallAudio(int callId, ToxAv* toxav)
 {
+    QMutexLocker locker(&toxMutex);
     if (!calls[callId].active)
         return;
 
@@ -264,6 +271,7 @@ void Core::playCallVideo(ToxAv*, int32_t callId, vpx_image_t* img, void *user_da
 
 void Core::sendCallVideo(int callId)
 {
+    QMutexLocker locker(&toxMutex);
     if (!calls[callId].active || !calls[callId].videoEnabled)
         return;
 
@@ -321,7 +329,7 @@ void Core::onAvCancel(void* _toxav, int32_t callId, void* core)
 
     calls[callId].active = false;
 
-    emit static_cast<Core*>(core)->avCancel(friendId, callId);
+    static_cast<Core*>(core)->eventQueue->post([=]{ emit static_cast<Core*>(core)->avCancel(friendId, callId); });
 }
 
 void Core::onAvReject(void* _toxav, int32_t callId, void* core)
@@ -336,7 +344,7 @@ void Core::onAvReject(void* _toxav, int32_t callId, void* core)
 
     qDebug() << QString("Core: AV reject from %1").arg(friendId);
 
-    emit static_cast<Core*>(core)->avRejected(friendId, callId);
+    static_cast<Core*>(core)->eventQueue->post([=]{ emit static_cast<Core*>(core)->avRejected(friendId, callId); });
 }
 
 void Core::onAvEnd(void* _toxav, int32_t call_index, void* core)
@@ -353,7 +361,7 @@ void Core::onAvEnd(void* _toxav, int32_t call_index, void* core)
 
     cleanupCall(call_index);
 
-    emit static_cast<Core*>(core)->avEnd(friendId, call_index);
+    static_cast<Core*>(core)->eventQueue->post([=]{ emit static_cast<Core*>(core)->avEnd(friendId, call_index); });
 }
 
 void Core::onAvRinging(void* _toxav, int32_t call_index, void* core)
@@ -370,12 +378,12 @@ void Core::onAvRinging(void* _toxav, int32_t call_index, void* core)
     if (calls[call_index].videoEnabled)
     {
         qDebug() << QString("Core: AV ringing with %1 with video").arg(friendId);
-        emit static_cast<Core*>(core)->avRinging(friendId, call_index, true);
+        static_cast<Core*>(core)->eventQueue->post([=]{ emit static_cast<Core*>(core)->avRinging(friendId, call_index, true); });
     }
     else
     {
         qDebug() << QString("Core: AV ringing with %1 without video").arg(friendId);
-        emit static_cast<Core*>(core)->avRinging(friendId, call_index, false);
+        static_cast<Core*>(core)->eventQueue->post([=]{ emit static_cast<Core*>(core)->avRinging(friendId, call_index, false); });
     }
 }
 
@@ -403,13 +411,13 @@ void Core::onAvStarting(void* _toxav, int32_t call_index, void* core)
     {
         qDebug() << QString("Core: AV starting from %1 with video").arg(friendId);
         prepareCall(friendId, call_index, toxav, true);
-        emit static_cast<Core*>(core)->avStarting(friendId, call_index, true);
+        static_cast<Core*>(core)->eventQueue->post([=]{ emit static_cast<Core*>(core)->avStarting(friendId, call_index, true); });
     }
     else
     {
         qDebug() << QString("Core: AV starting from %1 without video").arg(friendId);
         prepareCall(friendId, call_index, toxav, false);
-        emit static_cast<Core*>(core)->avStarting(friendId, call_index, false);
+        static_cast<Core*>(core)->eventQueue->post([=]{ emit static_cast<Core*>(core)->avStarting(friendId, call_index, false); });
     }
 
     delete transSettings;
@@ -429,7 +437,7 @@ void Core::onAvEnding(void* _toxav, int32_t call_index, void* core)
 
     cleanupCall(call_index);
 
-    emit static_cast<Core*>(core)->avEnding(friendId, call_index);
+    static_cast<Core*>(core)->eventQueue->post([=]{ emit static_cast<Core*>(core)->avEnding(friendId, call_index); });
 }
 
 void Core::onAvRequestTimeout(void* _toxav, int32_t call_index, void* core)
@@ -446,7 +454,7 @@ void Core::onAvRequestTimeout(void* _toxav, int32_t call_index, void* core)
 
     cleanupCall(call_index);
 
-    emit static_cast<Core*>(core)->avRequestTimeout(friendId, call_index);
+    static_cast<Core*>(core)->eventQueue->post([=]{ emit static_cast<Core*>(core)->avRequestTimeout(friendId, call_index); });
 }
 
 void Core::onAvPeerTimeout(void* _toxav, int32_t call_index, void* core)
@@ -463,7 +471,7 @@ void Core::onAvPeerTimeout(void* _toxav, int32_t call_index, void* core)
 
     cleanupCall(call_index);
 
-    emit static_cast<Core*>(core)->avPeerTimeout(friendId, call_index);
+    static_cast<Core*>(core)->eventQueue->post([=]{ emit static_cast<Core*>(core)->avPeerTimeout(friendId, call_index); });
 }
 
 
@@ -490,12 +498,12 @@ void Core::onAvInvite(void* _toxav, int32_t call_index, void* core)
     if (transSettings->call_type == TypeVideo)
     {
         qDebug() << QString("Core: AV invite from %1 with video").arg(friendId);
-        emit static_cast<Core*>(core)->avInvite(friendId, call_index, true);
+        static_cast<Core*>(core)->eventQueue->post([=]{ emit static_cast<Core*>(core)->avInvite(friendId, call_index, true); });
     }
     else
     {
         qDebug() << QString("Core: AV invite from %1 without video").arg(friendId);
-        emit static_cast<Core*>(core)->avInvite(friendId, call_index, false);
+        static_cast<Core*>(core)->eventQueue->post([=]{ emit static_cast<Core*>(core)->avInvite(friendId, call_index, false); });
     }
 
     delete transSettings;
@@ -525,13 +533,13 @@ void Core::onAvStart(void* _toxav, int32_t call_index, void* core)
     {
         qDebug() << QString("Core: AV start from %1 with video").arg(friendId);
         prepareCall(friendId, call_index, toxav, true);
-        emit static_cast<Core*>(core)->avStart(friendId, call_index, true);
+        static_cast<Core*>(core)->eventQueue->post([=]{ emit static_cast<Core*>(core)->avStart(friendId, call_index, true); });
     }
     else
     {
         qDebug() << QString("Core: AV start from %1 without video").arg(friendId);
         prepareCall(friendId, call_index, toxav, false);
-        emit static_cast<Core*>(core)->avStart(friendId, call_index, false);
+        static_cast<Core*>(core)->eventQueue->post([=]{ emit static_cast<Core*>(core)->avStart(friendId, call_index, false); });
     }
 
     delete transSettings;
@@ -4,6 +4,12 @@
 #define TOXAV_MAX_CALLS 16
 #define GROUPCHAT_MAX_SIZE 32
 #define TOX_FILE_INTERVAL 1
+#define TOX_FILE_READ_AHEAD 262144 // bytes read from disk at once for a file being sent, on the thread pool
+#define TOX_FILE_MAX_SEND_PER_TICK 1048576 // bytes, bounds how long a tick of a send holds the toxcore lock
+#define TOX_FILE_RESUME_GRACE 10000 // ms a reconnected friend has to resume broken uploads before they're offered again
+#define QTOX_PACKET_RESUME_OFFER 176 // lossless custom packet, receiver to sender: file number, offset and the digest of what we have up to it
+#define QTOX_PACKET_RESUME_CONFIRM 177 // lossless custom packet, sender to receiver: file number, the offset if our file matches the digest, else 0
+#define QTOX_FILE_RESUME_TIMEOUT 5000 // ms to wait for a confirmation before downloading a file from the start
 #define TOXAV_RINGING_TIME 45
 
 // TODO: Put that in the settings
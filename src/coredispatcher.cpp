@@ -0,0 +1,274 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+
+#include "coredispatcher.h"
+#include "core.h"
+#include "filetransfertable.h"
+#include "filetransferinstance.h"
+#include "friend.h"
+#include "friendlist.h"
+#include "misc/avatarcache.h"
+#include "widget/form/chatform.h"
+#include "widget/friendwidget.h"
+
+CoreDispatcher::CoreDispatcher(Core* core, QObject* parent)
+    : QObject(parent)
+{
+    connect(core, &Core::fileSendStarted, this, &CoreDispatcher::onFileSendStarted);
+    connect(core, &Core::fileReceiveRequested, this, &CoreDispatcher::onFileReceiveRequested);
+    connect(core, &Core::fileSendFailed, this, &CoreDispatcher::onFileSendFailed);
+    connect(core, &Core::fileTransferAccepted, this, &CoreDispatcher::onFileTransferAccepted);
+    connect(core, &Core::fileTransferCancelled, this, &CoreDispatcher::onFileTransferCancelled);
+    connect(core, &Core::fileTransferFinished, this, &CoreDispatcher::onFileTransferFinished);
+    connect(core, &Core::fileTransferPaused, this, &CoreDispatcher::onFileTransferPaused);
+    connect(core, &Core::fileTransferInfo, this, &CoreDispatcher::onFileTransferInfo);
+    connect(core, &Core::fileTransferRemotePausedUnpaused, this, &CoreDispatcher::onFileTransferRemotePausedUnpaused);
+    connect(core, &Core::fileTransferBrokenUnbroken, this, &CoreDispatcher::onFileTransferBrokenUnbroken);
+
+    connect(core, &Core::avInvite, this, &CoreDispatcher::onAvInvite);
+    connect(core, &Core::avStart, this, &CoreDispatcher::onAvStart);
+    connect(core, &Core::avCancel, this, &CoreDispatcher::onAvCancel);
+    connect(core, &Core::avEnd, this, &CoreDispatcher::onAvEnd);
+    connect(core, &Core::avRinging, this, &CoreDispatcher::onAvRinging);
+    connect(core, &Core::avStarting, this, &CoreDispatcher::onAvStarting);
+    connect(core, &Core::avEnding, this, &CoreDispatcher::onAvEnding);
+    connect(core, &Core::avRequestTimeout, this, &CoreDispatcher::onAvRequestTimeout);
+    connect(core, &Core::avPeerTimeout, this, &CoreDispatcher::onAvPeerTimeout);
+    connect(core, &Core::avMediaChange, this, &CoreDispatcher::onAvMediaChange);
+    connect(core, &Core::avCallFailed, this, &CoreDispatcher::onAvCallFailed);
+    connect(core, &Core::avRejected, this, &CoreDispatcher::onAvRejected);
+
+    connect(core, &Core::friendAvatarChanged, this, &CoreDispatcher::onFriendAvatarChanged);
+    connect(core, &Core::friendAvatarRemoved, this, &CoreDispatcher::onFriendAvatarRemoved);
+    connect(&AvatarCache::getInstance(), &AvatarCache::avatarReady, this, &CoreDispatcher::onAvatarReady);
+}
+
+void CoreDispatcher::subscribeTransfer(int friendId, int fileNum, ToxFile::FileDirection direction, FileTransferInstance* transfer)
+{
+    quint64 key = FileTransferTable::key(friendId, fileNum, direction);
+
+    // File numbers are reused, a transfer still holding this one is done with it
+    FileTransferInstance* old = transfers.value(key);
+    if (old)
+    {
+        transferKeys.remove(old);
+        disconnect(old, &QObject::destroyed, this, &CoreDispatcher::onTransferDestroyed);
+    }
+
+    transfers[key] = transfer;
+    transferKeys[transfer] = key;
+    connect(transfer, &QObject::destroyed, this, &CoreDispatcher::onTransferDestroyed);
+}
+
+void CoreDispatcher::onTransferDestroyed(QObject* transfer)
+{
+    auto it = transferKeys.find(transfer);
+    if (it == transferKeys.end())
+        return;
+
+    transfers.remove(it.value());
+    transferKeys.erase(it);
+}
+
+ChatForm* CoreDispatcher::findForm(int friendId)
+{
+    Friend* f = FriendList::findFriend(friendId);
+    return f ? f->getChatForm() : nullptr;
+}
+
+FileTransferInstance* CoreDispatcher::findTransfer(int friendId, int fileNum, ToxFile::FileDirection direction)
+{
+    return transfers.value(FileTransferTable::key(friendId, fileNum, direction));
+}
+
+void CoreDispatcher::onFileSendStarted(ToxFile file)
+{
+    if (ChatForm* form = findForm(file.friendId))
+        form->startFileSend(file);
+}
+
+void CoreDispatcher::onFileReceiveRequested(ToxFile file)
+{
+    if (ChatForm* form = findForm(file.friendId))
+        form->onFileRecvRequest(file);
+}
+
+void CoreDispatcher::onFileSendFailed(int friendId, const QString& fname)
+{
+    if (ChatForm* form = findForm(friendId))
+        form->onFileSendFailed(friendId, fname);
+}
+
+void CoreDispatcher::onFileTransferAccepted(ToxFile file)
+{
+    if (FileTransferInstance* transfer = findTransfer(file.friendId, file.fileNum, file.direction))
+        transfer->onFileTransferAccepted(file);
+}
+
+void CoreDispatcher::onFileTransferCancelled(int friendId, int fileNum, ToxFile::FileDirection direction)
+{
+    quint64 key = FileTransferTable::key(friendId, fileNum, direction);
+    FileTransferInstance* transfer = transfers.take(key);
+    if (!transfer)
+        return;
+
+    transferKeys.remove(transfer);
+    disconnect(transfer, &QObject::destroyed, this, &CoreDispatcher::onTransferDestroyed);
+    transfer->onFileTransferCancelled(friendId, fileNum, direction);
+}
+
+void CoreDispatcher::onFileTransferFinished(ToxFile file)
+{
+    quint64 key = FileTransferTable::key(file.friendId, file.fileNum, file.direction);
+    FileTransferInstance* transfer = transfers.take(key);
+    if (!transfer)
+        return;
+
+    transferKeys.remove(transfer);
+    disconnect(transfer, &QObject::destroyed, this, &CoreDispatcher::onTransferDestroyed);
+    transfer->onFileTransferFinished(file);
+}
+
+void CoreDispatcher::onFileTransferPaused(int friendId, int fileNum, ToxFile::FileDirection direction)
+{
+    if (FileTransferInstance* transfer = findTransfer(friendId, fileNum, direction))
+        transfer->onFileTransferPaused(friendId, fileNum, direction);
+}
+
+void CoreDispatcher::onFileTransferInfo(int friendId, int fileNum, int64_t filesize, int64_t bytesSent, ToxFile::FileDirection direction)
+{
+    if (FileTransferInstance* transfer = findTransfer(friendId, fileNum, direction))
+        transfer->onFileTransferInfo(friendId, fileNum, filesize, bytesSent, direction);
+}
+
+void CoreDispatcher::onFileTransferRemotePausedUnpaused(ToxFile file, bool paused)
+{
+    if (FileTransferInstance* transfer = findTransfer(file.friendId, file.fileNum, file.direction))
+        transfer->onFileTransferRemotePausedUnpaused(file, paused);
+}
+
+void CoreDispatcher::onFileTransferBrokenUnbroken(ToxFile file, bool broken)
+{
+    if (FileTransferInstance* transfer = findTransfer(file.friendId, file.fileNum, file.direction))
+        transfer->onFileTransferBrokenUnbroken(file, broken);
+}
+
+void CoreDispatcher::onAvInvite(int friendId, int callIndex, bool video)
+{
+    if (ChatForm* form = findForm(friendId))
+        form->onAvInvite(friendId, callIndex, video);
+}
+
+void CoreDispatcher::onAvStart(int friendId, int callIndex, bool video)
+{
+    if (ChatForm* form = findForm(friendId))
+        form->onAvStart(friendId, callIndex, video);
+}
+
+void CoreDispatcher::onAvCancel(int friendId, int callIndex)
+{
+    if (ChatForm* form = findForm(friendId))
+        form->onAvCancel(friendId, callIndex);
+}
+
+void CoreDispatcher::onAvEnd(int friendId, int callIndex)
+{
+    if (ChatForm* form = findForm(friendId))
+        form->onAvEnd(friendId, callIndex);
+}
+
+void CoreDispatcher::onAvRinging(int friendId, int callIndex, bool video)
+{
+    if (ChatForm* form = findForm(friendId))
+        form->onAvRinging(friendId, callIndex, video);
+}
+
+void CoreDispatcher::onAvStarting(int friendId, int callIndex, bool video)
+{
+    if (ChatForm* form = findForm(friendId))
+        form->onAvStarting(friendId, callIndex, video);
+}
+
+void CoreDispatcher::onAvEnding(int friendId, int callIndex)
+{
+    if (ChatForm* form = findForm(friendId))
+        form->onAvEnding(friendId, callIndex);
+}
+
+void CoreDispatcher::onAvRequestTimeout(int friendId, int callIndex)
+{
+    if (ChatForm* form = findForm(friendId))
+        form->onAvRequestTimeout(friendId, callIndex);
+}
+
+void CoreDispatcher::onAvPeerTimeout(int friendId, int callIndex)
+{
+    if (ChatForm* form = findForm(friendId))
+        form->onAvPeerTimeout(friendId, callIndex);
+}
+
+void CoreDispatcher::onAvMediaChange(int friendId, int callIndex, bool videoEnabled)
+{
+    if (ChatForm* form = findForm(friendId))
+        form->onAvMediaChange(friendId, callIndex, videoEnabled);
+}
+
+void CoreDispatcher::onAvCallFailed(int friendId)
+{
+    if (ChatForm* form = findForm(friendId))
+        form->onAvCallFailed(friendId);
+}
+
+void CoreDispatcher::onAvRejected(int friendId, int callIndex)
+{
+    if (ChatForm* form = findForm(friendId))
+        form->onAvRejected(friendId, callIndex);
+}
+
+void CoreDispatcher::onFriendAvatarChanged(int friendId, const QPixmap&)
+{
+    Friend* f = FriendList::findFriend(friendId);
+    if (!f)
+        return;
+
+    // Core saved it already, decoding it again off this thread beats scaling it here
+    AvatarCache::getInstance().reload(f->userId);
+}
+
+void CoreDispatcher::onFriendAvatarRemoved(int friendId)
+{
+    Friend* f = FriendList::findFriend(friendId);
+    if (!f)
+        return;
+
+    AvatarCache::getInstance().remove(f->userId);
+    if (f->hasChatForm())
+        f->getChatForm()->onAvatarRemoved(friendId);
+    f->widget->onAvatarRemoved(friendId);
+}
+
+void CoreDispatcher::onAvatarReady(const QString& ownerId, const QPixmap& pic, const QColor& background)
+{
+    Friend* f = FriendList::findFriend(ownerId);
+    if (!f)
+        return;
+
+    // A form built later asks the cache itself
+    if (f->hasChatForm())
+        f->getChatForm()->setAvatar(pic, background);
+    f->widget->setAvatar(pic, background);
+}
@@ -0,0 +1,81 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+
+#ifndef COREDISPATCHER_H
+#define COREDISPATCHER_H
+
+#include <QObject>
+#include <QHash>
+#include <QPixmap>
+#include "corestructs.h"
+
+class Core;
+class ChatForm;
+class FileTransferInstance;
+
+/// Connects once to the per friend and per transfer signals of Core and hands every event
+/// to its one receiver, the friend's from FriendList or the transfer subscribed under (friend id, file number, direction)
+class CoreDispatcher : public QObject
+{
+    Q_OBJECT
+public:
+    CoreDispatcher(Core* core, QObject* parent = nullptr);
+
+    /// Transfers unsubscribe themselves when they finish, are cancelled or destroyed
+    void subscribeTransfer(int friendId, int fileNum, ToxFile::FileDirection direction, FileTransferInstance* transfer);
+
+private slots:
+    void onFileSendStarted(ToxFile file);
+    void onFileReceiveRequested(ToxFile file);
+    void onFileSendFailed(int friendId, const QString& fname);
+    void onFileTransferAccepted(ToxFile file);
+    void onFileTransferCancelled(int friendId, int fileNum, ToxFile::FileDirection direction);
+    void onFileTransferFinished(ToxFile file);
+    void onFileTransferPaused(int friendId, int fileNum, ToxFile::FileDirection direction);
+    void onFileTransferInfo(int friendId, int fileNum, int64_t filesize, int64_t bytesSent, ToxFile::FileDirection direction);
+    void onFileTransferRemotePausedUnpaused(ToxFile file, bool paused);
+    void onFileTransferBrokenUnbroken(ToxFile file, bool broken);
+
+    void onAvInvite(int friendId, int callIndex, bool video);
+    void onAvStart(int friendId, int callIndex, bool video);
+    void onAvCancel(int friendId, int callIndex);
+    void onAvEnd(int friendId, int callIndex);
+    void onAvRinging(int friendId, int callIndex, bool video);
+    void onAvStarting(int friendId, int callIndex, bool video);
+    void onAvEnding(int friendId, int callIndex);
+    void onAvRequestTimeout(int friendId, int callIndex);
+    void onAvPeerTimeout(int friendId, int callIndex);
+    void onAvMediaChange(int friendId, int callIndex, bool videoEnabled);
+    void onAvCallFailed(int friendId);
+    void onAvRejected(int friendId, int callIndex);
+
+    void onFriendAvatarChanged(int friendId, const QPixmap& pic);
+    void onFriendAvatarRemoved(int friendId);
+
+    void onTransferDestroyed(QObject* transfer);
+    void onAvatarReady(const QString& ownerId, const QPixmap& pic, const QColor& background);
+
+private:
+    ChatForm* findForm(int friendId); ///< Builds the form if the friend didn't have one yet
+    FileTransferInstance* findTransfer(int friendId, int fileNum, ToxFile::FileDirection direction);
+
+private:
+    QHash<quint64, FileTransferInstance*> transfers;
+    QHash<QObject*, quint64> transferKeys; ///< Reverse of transfers, to forget a destroyed one without a scan
+};
+
+#endif // COREDISPATCHER_H
@@ -0,0 +1,183 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+#include "coreeventqueue.h"
+
+#include <QMutexLocker>
+
+#define INDEX_MASK (2 * CORE_EVENT_QUEUE_SIZE - 1)
+#define SLOT_MASK (CORE_EVENT_QUEUE_SIZE - 1)
+
+CoreEventQueue::CoreEventQueue(Handler handler)
+    : handler(handler)
+    , ring(CORE_EVENT_QUEUE_SIZE)
+    , head(0)
+    , tail(0)
+    , preparedSpare(false)
+    , draining(false)
+    , missedWakeup(false)
+    , wakePending(0)
+    , spilling(0)
+    , pushed(0)
+    , spilled(0)
+    , batches(0)
+    , maxBatch(0)
+{
+    for (CoreEvent& event : ring)
+        event.text.reserve(CORE_EVENT_TEXT_RESERVE);
+}
+
+CoreEventQueue::~CoreEventQueue()
+{
+}
+
+CoreEvent& CoreEventQueue::prepare(CoreEvent::Type type, int id)
+{
+    int h = head.load();
+    bool full = ((h - tail.loadAcquire()) & INDEX_MASK) == CORE_EVENT_QUEUE_SIZE;
+
+    CoreEvent* event;
+    preparedSpare = full || spilling.loadAcquire();
+    if (preparedSpare)
+        event = &spare;
+    else
+        event = &ring[h & SLOT_MASK];
+
+    event->type = type;
+    event->id = id;
+    event->arg = 0;
+    event->change = 0;
+    event->size = 0;
+    event->position = 0;
+    event->text.resize(0); // keeps the reserved capacity
+    event->author.clear();
+    event->authorKey.clear();
+
+    return *event;
+}
+
+void CoreEventQueue::commit()
+{
+    if (preparedSpare)
+    {
+        QMutexLocker locker(&spillMutex);
+        spill.append(spare);
+        spilling.storeRelease(1);
+        spilled.ref();
+    } else {
+        head.storeRelease((head.load() + 1) & INDEX_MASK);
+    }
+    pushed.ref();
+    wake();
+}
+
+void CoreEventQueue::post(std::function<void()> call)
+{
+    CoreEvent event;
+    event.type = CoreEvent::Call;
+    event.id = 0;
+    event.arg = 0;
+    event.change = 0;
+    event.size = 0;
+    event.position = 0;
+    event.call = std::move(call);
+
+    // Through the spill list as it may come from any thread, what the producer pushes next lands behind it
+    {
+        QMutexLocker locker(&spillMutex);
+        spill.append(event);
+        spilling.storeRelease(1);
+    }
+    pushed.ref();
+    wake();
+}
+
+void CoreEventQueue::wake()
+{
+    // one wakeup for all the events pushed until the consumer gets to them
+    if (wakePending.testAndSetOrdered(0, 1))
+        QMetaObject::invokeMethod(this, "drain", Qt::QueuedConnection);
+}
+
+int CoreEventQueue::getPushed()
+{
+    return pushed.load();
+}
+
+int CoreEventQueue::getSpilled()
+{
+    return spilled.load();
+}
+
+int CoreEventQueue::getBatches()
+{
+    return batches.load();
+}
+
+int CoreEventQueue::getMaxBatch()
+{
+    return maxBatch.load();
+}
+
+void CoreEventQueue::drain()
+{
+    // A handler running a nested event loop must not see the same events again
+    if (draining)
+    {
+        missedWakeup = true;
+        return;
+    }
+
+    wakePending.storeRelease(0); // what is pushed from now on gets another wakeup
+
+    // Once spilling the producer leaves the ring alone, so everything in it is older than the spilled events
+    bool spilt = spilling.loadAcquire();
+    int t = tail.load();
+    int h = head.loadAcquire();
+
+    batch.resize(0);
+    for (int i = t; i != h; i = (i + 1) & INDEX_MASK)
+        batch.append(&ring[i & SLOT_MASK]);
+
+    QList<CoreEvent> spillBatch;
+    if (spilt)
+    {
+        QMutexLocker locker(&spillMutex);
+        spillBatch.swap(spill);
+        spilling.storeRelease(0);
+    }
+    for (const CoreEvent& event : spillBatch)
+        batch.append(&event);
+
+    if (batch.isEmpty())
+        return;
+
+    batches.ref();
+    if (batch.size() > maxBatch.load())
+        maxBatch.store(batch.size());
+
+    draining = true;
+    handler(batch);
+    draining = false;
+
+    tail.storeRelease(h); // the slots can be reused once handled
+
+    if (missedWakeup)
+    {
+        missedWakeup = false;
+        QMetaObject::invokeMethod(this, "drain", Qt::QueuedConnection);
+    }
+}
@@ -0,0 +1,102 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+#ifndef COREEVENTQUEUE_H
+#define COREEVENTQUEUE_H
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QMutex>
+#include <QVector>
+#include <QByteArray>
+#include <functional>
+#include <cstring>
+#include <cstdint>
+
+#define CORE_EVENT_QUEUE_SIZE 1024 // records, must be a power of two
+#define CORE_EVENT_TEXT_RESERVE 1400 // bytes preallocated for the text of every record, a message fits
+
+/// What toxcore called back with, the text is kept as the UTF-8 it arrived in and decoded by the receiver
+struct CoreEvent
+{
+    enum Type {FriendMessage = 0, FriendAction, FriendName, FriendTyping, FriendStatusMessage, FriendStatus,
+               GroupMessage, GroupAction, GroupNamelist, FileRecvProgress, Call};
+
+    Type type;
+    int id; ///< The friend or group number
+    int arg; ///< Status, typing, peer number or file number, depending on the type
+    int change; ///< Group namelist change
+    qint64 size, position; ///< Of a file transfer
+    QByteArray text;
+    QByteArray author; ///< Group messages only, resolved when received as the peer may be gone by the time it's read
+    QByteArray authorKey; ///< Group messages only, the public key of the author
+    std::function<void()> call; ///< Call events only, emits a signal whose arguments don't fit in a record
+
+    /// Copies into the preallocated buffer, doesn't allocate for anything up to CORE_EVENT_TEXT_RESERVE
+    void setText(const uint8_t* data, int length)
+    {
+        text.resize(length);
+        memcpy(text.data(), data, length);
+    }
+};
+
+/// Bounded single producer single consumer ring buffer, from the network thread to the thread the queue lives on.
+/// The consumer is woken up once per batch instead of once per event, a full ring spills into a locked list.
+/// Events posted from other threads go through that list too, so every signal toxcore causes arrives in order
+class CoreEventQueue : public QObject
+{
+    Q_OBJECT
+public:
+    typedef std::function<void(const QVector<const CoreEvent*>&)> Handler;
+
+    explicit CoreEventQueue(Handler handler);
+    ~CoreEventQueue();
+
+    /// Producer only, the returned record is to be filled then published with commit()
+    CoreEvent& prepare(CoreEvent::Type type, int id);
+    void commit();
+    /// Thread safe, call is run on the consumer's thread after everything queued before it
+    void post(std::function<void()> call);
+
+    int getPushed(); ///< Thread safe, like all the counters
+    int getSpilled(); ///< Events that didn't fit in the ring
+    int getBatches();
+    int getMaxBatch();
+
+private slots:
+    void drain();
+
+private:
+    void wake();
+
+private:
+    Handler handler;
+    QVector<CoreEvent> ring;
+    QAtomicInt head, tail; // modulo twice the size to tell full from empty, head is written by the producer only, tail by the consumer only
+    CoreEvent spare; // filled when the ring is full
+    bool preparedSpare;
+    bool draining, missedWakeup; // consumer only
+    QAtomicInt wakePending;
+
+    QMutex spillMutex;
+    QList<CoreEvent> spill;
+    QAtomicInt spilling; ///< While set the producer only appends to spill, so that the order is kept
+
+    QVector<const CoreEvent*> batch;
+    QAtomicInt pushed, spilled, batches, maxBatch;
+};
+
+#endif // COREEVENTQUEUE_H
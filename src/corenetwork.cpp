@@ -0,0 +1,123 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+#include "corenetwork.h"
+#include "core.h"
+
+#include <QThread>
+#include <QElapsedTimer>
+#include <QVector>
+#include <QDebug>
+
+#include <tox/tox.h>
+
+CoreNetwork::CoreNetwork(Core *core, QMutex *lock)
+    : core(core)
+    , lock(lock)
+    , thread(nullptr)
+    , stopping(0)
+    , lateIterations(0)
+    , maxLateness(0)
+{
+}
+
+void CoreNetwork::start()
+{
+    if (thread)
+        return;
+
+    stopping.store(0);
+    thread = new QThread();
+    thread->setObjectName("qTox Network");
+    moveToThread(thread);
+
+    connect(thread, &QThread::started, this, &CoreNetwork::run);
+
+    thread->start(QThread::HighPriority);
+}
+
+void CoreNetwork::stop()
+{
+    if (!thread)
+        return;
+
+    stopping.store(1);
+    thread->quit();
+    thread->wait();
+
+    delete thread;
+    thread = nullptr;
+
+    qDebug() << "CoreNetwork: stopped," << lateIterations.load() << "late iterations, at most"
+             << maxLateness.load() << "ms late";
+}
+
+int CoreNetwork::getLateIterations()
+{
+    return lateIterations.load();
+}
+
+int CoreNetwork::getMaxLateness()
+{
+    return maxLateness.load();
+}
+
+void CoreNetwork::run()
+{
+    QVector<uint8_t> waitData(tox_wait_data_size());
+    QElapsedTimer clock; // monotonic
+    clock.start();
+    qint64 deadline = 0;
+
+    while (!stopping.load())
+    {
+        int interval;
+        {
+            QMutexLocker locker(lock);
+
+            int lateness = clock.elapsed() - deadline;
+            if (lateness > CORE_NETWORK_LATE)
+            {
+                lateIterations.ref();
+                if (lateness > maxLateness.load())
+                    maxLateness.store(lateness);
+            }
+
+            interval = qBound(0, core->process(), CORE_NETWORK_MAX_WAIT);
+            deadline = clock.elapsed() + interval;
+
+            if (!core->tox || tox_wait_prepare(core->tox, waitData.data()) < 0)
+                waitData.clear();
+        }
+
+        // Without the lock, so that the core thread can call into toxcore while we sleep
+        qint64 remaining = deadline - clock.elapsed();
+        if (waitData.isEmpty())
+        {
+            if (remaining > 0)
+                QThread::msleep(remaining);
+            waitData.resize(tox_wait_data_size());
+            continue;
+        }
+
+        if (remaining > 0)
+            tox_wait_execute(waitData.data(), remaining / 1000, (remaining % 1000) * 1000);
+
+        QMutexLocker locker(lock);
+        if (core->tox)
+            tox_wait_cleanup(core->tox, waitData.data());
+    }
+}
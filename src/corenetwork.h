@@ -0,0 +1,55 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+#ifndef CORENETWORK_H
+#define CORENETWORK_H
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QMutex>
+
+#define CORE_NETWORK_MAX_WAIT 50 // ms, the longest the thread sleeps when toxcore asks for more
+#define CORE_NETWORK_LATE 20 // ms, iterations starting later than this past their deadline are counted
+
+class Core;
+class QThread;
+
+/// Runs toxcore's event loop on a thread of its own, sleeping on the network sockets until data comes in or toxcore is due
+class CoreNetwork : public QObject
+{
+    Q_OBJECT
+public:
+    /// Every call into toxcore must hold lock, including the callbacks run from here
+    CoreNetwork(Core* core, QMutex* lock);
+
+    void start();
+    void stop(); ///< Blocks until the thread has exited, toxcore is idle afterwards
+
+    int getLateIterations(); ///< Thread safe
+    int getMaxLateness(); ///< ms, thread safe
+
+private slots:
+    void run();
+
+private:
+    Core* core;
+    QMutex* lock;
+    QThread* thread;
+    QAtomicInt stopping;
+    QAtomicInt lateIterations, maxLateness;
+};
+
+#endif // CORENETWORK_H
@@ -4,7 +4,7 @@
 
 ToxFile::ToxFile(int FileNum, int FriendId, QByteArray FileName, QString FilePath, FileDirection Direction)
     : fileNum(FileNum), friendId(FriendId), fileName{FileName}, filePath{FilePath}, file{new QFile(filePath)},
-    bytesSent{0}, filesize{0}, status{STOPPED}, direction{Direction}, sendTimer{nullptr}
+    bytesSent{0}, filesize{0}, status{STOPPED}, direction{Direction}, resumeOffset{0}
 {
 }
 
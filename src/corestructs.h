@@ -6,7 +6,6 @@
 
 #include <QString>
 class QFile;
-class QTimer;
 
 enum class Status : int {Online = 0, Away, Busy, Offline};
 
@@ -67,7 +66,7 @@ struct ToxFile
     long long filesize;
     FileStatus status;
     FileDirection direction;
-    QTimer* sendTimer;
+    long long resumeOffset; ///< Sending only, where the friend may start, once our file matched what it has
 };
 
 #endif // CORESTRUCTS_H
@@ -0,0 +1,377 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+
+#include "filesendscheduler.h"
+#include "core.h"
+#include "filetransfertable.h"
+#include "misc/settings.h"
+
+#include <QTimer>
+#include <QMutexLocker>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QPointer>
+#include <QFile>
+#include <QDebug>
+
+/// Reads the next part of a file being sent on the thread pool, an empty result means it couldn't be read
+class ReadAheadTask : public QRunnable
+{
+public:
+    ReadAheadTask(FileSendScheduler* scheduler, quint64 key, const QString& path, long long position)
+        : scheduler(scheduler), key(key), path(path), position(position)
+    {
+    }
+
+    void run()
+    {
+        QFile file(path);
+        QByteArray data;
+        if (file.open(QIODevice::ReadOnly) && file.seek(position))
+            data = file.read(TOX_FILE_READ_AHEAD);
+        if (data.isEmpty())
+            qWarning() << "FileSendScheduler: Unable to read" << path << "at" << position << file.errorString();
+
+        if (scheduler)
+            QMetaObject::invokeMethod(scheduler, "onReadAhead", Qt::QueuedConnection,
+                                      Q_ARG(quint64, key), Q_ARG(qint64, position), Q_ARG(QByteArray, data));
+    }
+
+private:
+    QPointer<FileSendScheduler> scheduler;
+    quint64 key;
+    QString path;
+    long long position;
+};
+
+FileSendScheduler::FileSendScheduler(Core* core)
+    : QObject(core)
+    , core(core)
+    , tokens(0)
+{
+    timer = new QTimer(this);
+    timer->setSingleShot(true);
+    connect(timer, &QTimer::timeout, this, &FileSendScheduler::tick);
+
+    tokenClock.start();
+    rateClock.start();
+}
+
+void FileSendScheduler::add(int friendId, int fileNum)
+{
+    QMutexLocker locker(&Core::toxMutex);
+    quint64 key = FileTransferTable::key(friendId, fileNum, ToxFile::SENDING);
+    if (!streams.contains(key))
+    {
+        Stream stream;
+        stream.friendId = friendId;
+        stream.fileNum = fileNum;
+        stream.windowBytes = 0;
+        stream.clock.start();
+        ToxFile* file = core->fileTransfers.find(friendId, fileNum, ToxFile::SENDING);
+        stream.startPos = file ? file->bytesSent : 0;
+        stream.bufferPos = 0;
+        stream.reading = false;
+        streams.insert(key, stream);
+
+        if (!friends.contains(friendId))
+        {
+            friends[friendId].deficit = 0;
+            friendOrder.append(friendId);
+        }
+        friends[friendId].streams.append(key);
+
+        QMutexLocker statsLocker(&statsMutex);
+        priorities.insert(key, 1);
+        rates.insert(key, 0);
+    }
+
+    // Also when a friend accepts again after pausing a stream we already have
+    rearm();
+}
+
+void FileSendScheduler::remove(int friendId, int fileNum)
+{
+    QMutexLocker locker(&Core::toxMutex);
+    dropStream(FileTransferTable::key(friendId, fileNum, ToxFile::SENDING));
+}
+
+void FileSendScheduler::wake()
+{
+    // The timer lives on the core thread, this may be called from the network thread
+    QMetaObject::invokeMethod(this, "rearm", Qt::QueuedConnection);
+}
+
+void FileSendScheduler::rearm()
+{
+    if (!timer->isActive())
+        timer->start(TOX_FILE_INTERVAL);
+}
+
+void FileSendScheduler::setPriority(int friendId, int fileNum, int priority)
+{
+    QMutexLocker locker(&statsMutex);
+    auto it = priorities.find(FileTransferTable::key(friendId, fileNum, ToxFile::SENDING));
+    if (it != priorities.end())
+        *it = qMax(1, priority);
+}
+
+long long FileSendScheduler::getRate(int friendId, int fileNum) const
+{
+    QMutexLocker locker(&statsMutex);
+    return rates.value(FileTransferTable::key(friendId, fileNum, ToxFile::SENDING));
+}
+
+void FileSendScheduler::dropStream(quint64 key)
+{
+    auto it = streams.find(key);
+    if (it == streams.end())
+        return;
+
+    int friendId = it->friendId;
+    streams.erase(it);
+
+    FriendQueue& queue = friends[friendId];
+    queue.streams.removeOne(key);
+    if (queue.streams.isEmpty())
+    {
+        friends.remove(friendId);
+        friendOrder.removeOne(friendId);
+    }
+
+    QMutexLocker statsLocker(&statsMutex);
+    priorities.remove(key);
+    rates.remove(key);
+}
+
+long long FileSendScheduler::buffered(const Stream& stream, const ToxFile* file) const
+{
+    long long offset = file->bytesSent - stream.bufferPos;
+    if (offset < 0 || offset >= stream.buffer.size())
+        return 0;
+    return stream.buffer.size() - offset;
+}
+
+void FileSendScheduler::readAhead(quint64 key, Stream& stream, const ToxFile* file)
+{
+    long long left = buffered(stream, file);
+    if (stream.reading || left >= TOX_FILE_READ_AHEAD / 2 || file->bytesSent + left >= file->filesize)
+        return;
+
+    // Whatever is left stays until the read is back, a send that moved elsewhere (a resume) starts over
+    if (left == 0)
+    {
+        stream.buffer.clear();
+        stream.bufferPos = file->bytesSent;
+    }
+    stream.reading = true;
+    QThreadPool::globalInstance()->start(new ReadAheadTask(this, key, file->filePath,
+                                                           stream.bufferPos + stream.buffer.size()));
+}
+
+void FileSendScheduler::onReadAhead(quint64 key, qint64 position, QByteArray data)
+{
+    QMutexLocker locker(&Core::toxMutex);
+    auto it = streams.find(key);
+    if (it == streams.end())
+        return; // stopped meanwhile
+
+    Stream& stream = *it;
+    stream.reading = false;
+    ToxFile* file = core->fileTransfers.find(stream.friendId, stream.fileNum, ToxFile::SENDING);
+    if (!file)
+        return;
+
+    if (data.isEmpty())
+    {
+        dropStream(key);
+        Core::abortFileSend(core, file);
+        return;
+    }
+
+    // Dropped if the send moved elsewhere while reading, the next tick reads from where it is now
+    long long consumed = file->bytesSent - stream.bufferPos;
+    if (position != stream.bufferPos + stream.buffer.size() || consumed < 0 || consumed > stream.buffer.size())
+        return;
+
+    stream.buffer.remove(0, consumed);
+    stream.bufferPos += consumed;
+    stream.buffer.append(data);
+    rearm();
+}
+
+long long FileSendScheduler::refillTokens()
+{
+    long long limit = Settings::getInstance().getFileUploadLimit() * 1024LL; // bytes per second
+    qint64 elapsed = tokenClock.restart();
+    if (limit <= 0)
+        return -1;
+
+    tokens = qMin(tokens + elapsed * limit / 1000, qMax(limit * FILE_SCHEDULER_BURST / 1000, 1LL));
+    return qMax(tokens, 0LL);
+}
+
+void FileSendScheduler::updateRates()
+{
+    qint64 elapsed = rateClock.elapsed();
+    if (elapsed < FILE_SCHEDULER_RATE_WINDOW)
+        return;
+
+    QMutexLocker statsLocker(&statsMutex);
+    for (auto it = streams.begin(); it != streams.end(); ++it)
+    {
+        rates[it.key()] = it->windowBytes * 1000 / elapsed;
+        it->windowBytes = 0;
+    }
+    rateClock.restart();
+}
+
+void FileSendScheduler::tick()
+{
+    QMutexLocker locker(&Core::toxMutex);
+
+    long long budget = TOX_FILE_MAX_SEND_PER_TICK;
+    long long available = refillTokens();
+    if (available >= 0)
+        budget = qMin(budget, available);
+
+    QHash<quint64, int> weights;
+    {
+        QMutexLocker statsLocker(&statsMutex);
+        weights = priorities;
+    }
+
+    // Deficit round robin: every round each friend earns a quantum and spends it on its transfers, by priority.
+    // Rounds go on until the budget of this tick is spent or nobody could send anything more
+    long long sentThisTick = 0;
+    bool progress = true;
+    while (budget > 0 && progress && !friendOrder.isEmpty())
+    {
+        progress = false;
+        const QList<int> order = friendOrder;
+        for (int friendId : order)
+        {
+            if (budget <= 0)
+                break;
+            if (!friends.contains(friendId))
+                continue;
+
+            FriendQueue& queue = friends[friendId];
+            queue.deficit += FILE_SCHEDULER_QUANTUM;
+
+            // toxcore sends whole chunks, shares are rounded to them so that no packet goes out half empty
+            long long chunkSize = qMax((long long)tox_file_data_size(core->tox, friendId), 1LL);
+
+            const QList<quint64> keys = queue.streams;
+            int totalPriority = 0;
+            for (quint64 key : keys)
+            {
+                ToxFile* file = core->fileTransfers.find(streams[key].friendId, streams[key].fileNum, ToxFile::SENDING);
+                if (file && file->status == ToxFile::TRANSMITTING)
+                    totalPriority += weights.value(key, 1);
+            }
+
+            long long deficit = queue.deficit;
+            long long friendSent = 0;
+            for (quint64 key : keys)
+            {
+                Stream& stream = streams[key];
+                ToxFile* file = core->fileTransfers.find(stream.friendId, stream.fileNum, ToxFile::SENDING);
+                if (!file || file->status == ToxFile::STOPPED || file->bytesSent >= file->filesize)
+                {
+                    dropStream(key);
+                    continue;
+                }
+                if (file->status != ToxFile::TRANSMITTING || totalPriority == 0)
+                    continue; // paused or broken, it keeps its place
+
+                readAhead(key, stream, file);
+
+                long long share = deficit * weights.value(key, 1) / totalPriority;
+                share = qMax(share - share % chunkSize, chunkSize);
+                long long left = budget - friendSent;
+                share = qMin(share, left - left % chunkSize);
+                // Only the end of the file may be sent as a smaller chunk
+                long long ready = buffered(stream, file);
+                if (file->bytesSent + ready < file->filesize)
+                    ready -= ready % chunkSize;
+                share = qMin(share, ready);
+                if (share <= 0)
+                    continue;
+
+                long long offset = file->bytesSent - stream.bufferPos;
+                long long sent = core->sendFileData(file, stream.buffer.constData() + offset, share);
+                stream.windowBytes += sent;
+                friendSent += sent;
+
+                // An aborted send is gone from the table, a completed one waits for the friend's confirmation
+                file = core->fileTransfers.find(stream.friendId, stream.fileNum, ToxFile::SENDING);
+                if (file && file->bytesSent >= file->filesize)
+                {
+                    qint64 elapsed = qMax(stream.clock.elapsed(), 1LL);
+                    qDebug() << "FileSendScheduler: File" << stream.fileNum << "to friend" << stream.friendId << "sent,"
+                             << file->bytesSent - stream.startPos << "bytes in" << elapsed << "ms,"
+                             << (file->bytesSent - stream.startPos) * 1000 / elapsed / 1024 << "KiB/s including pauses";
+                }
+                if (!file || file->status == ToxFile::STOPPED || file->bytesSent >= file->filesize)
+                    dropStream(key);
+            }
+
+            budget -= friendSent;
+            sentThisTick += friendSent;
+            if (friendSent > 0)
+                progress = true;
+
+            if (!friends.contains(friendId))
+                continue;
+            // A friend that couldn't use its turn doesn't hoard credit for later
+            FriendQueue& remaining = friends[friendId];
+            remaining.deficit = friendSent > 0 ? qMin(remaining.deficit - friendSent, (long long)FILE_SCHEDULER_QUANTUM) : 0;
+        }
+    }
+
+    if (available >= 0)
+        tokens -= sentThisTick;
+
+    // Whoever went first this time goes last next time
+    if (friendOrder.size() > 1)
+        friendOrder.append(friendOrder.takeFirst());
+
+    updateRates();
+
+    // With everything paused or broken the timer stops, wake() or add() start it again
+    bool transmitting = false;
+    for (const Stream& stream : streams)
+    {
+        ToxFile* file = core->fileTransfers.find(stream.friendId, stream.fileNum, ToxFile::SENDING);
+        if (file && file->status == ToxFile::TRANSMITTING)
+        {
+            transmitting = true;
+            break;
+        }
+    }
+    if (!transmitting)
+    {
+        QMutexLocker statsLocker(&statsMutex);
+        for (long long& rate : rates)
+            rate = 0;
+        return;
+    }
+
+    // Back off a little when toxcore's queues are full or the disk hasn't caught up
+    timer->start(sentThisTick > 0 ? TOX_FILE_INTERVAL : 5+TOX_FILE_INTERVAL);
+}
@@ -0,0 +1,96 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+
+#ifndef FILESENDSCHEDULER_H
+#define FILESENDSCHEDULER_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QByteArray>
+#include <QMutex>
+#include <QElapsedTimer>
+
+#define FILE_SCHEDULER_QUANTUM 65536 // bytes a friend may send per round before the next friend's turn
+#define FILE_SCHEDULER_BURST 100 // ms of the upload limit that may be sent at once after an idle period
+#define FILE_SCHEDULER_RATE_WINDOW 1000 // ms over which the achieved rates are measured
+
+class Core;
+class QTimer;
+struct ToxFile;
+
+/// Owns every outgoing transfer that is sending data, and shares the upload between them from a single timer.
+/// Friends take turns in deficit round robin, so a huge upload to one friend doesn't starve the others.
+/// A friend's share is split between its transfers by priority, and the total can be capped by the upload limit setting.
+/// Lives on the core thread, the state is guarded by Core::toxMutex, except for the rates and priorities the GUI uses.
+/// Files are read ahead on the thread pool, the lock is only held to hand what was read to toxcore
+class FileSendScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FileSendScheduler(Core* core);
+
+    void add(int friendId, int fileNum); ///< Must be called on the core thread
+    void remove(int friendId, int fileNum);
+    void wake(); ///< Thread safe, a transfer that was paused or broken may send again
+    void setPriority(int friendId, int fileNum, int priority); ///< Weight against the friend's other transfers, at least 1
+    long long getRate(int friendId, int fileNum) const; ///< Bytes per second over the last measured window
+
+private slots:
+    void tick();
+    void rearm();
+    void onReadAhead(quint64 key, qint64 position, QByteArray data);
+
+private:
+    struct Stream
+    {
+        int friendId;
+        int fileNum;
+        long long windowBytes; ///< Sent since the rate window started
+        QElapsedTimer clock; ///< Since the stream was added, for the average logged at the end
+        long long startPos;
+        QByteArray buffer; ///< The file from bufferPos on, read ahead of the sends
+        long long bufferPos;
+        bool reading;
+    };
+
+    struct FriendQueue
+    {
+        QList<quint64> streams;
+        long long deficit;
+    };
+
+    void dropStream(quint64 key);
+    long long buffered(const Stream& stream, const ToxFile* file) const; ///< Read ahead and not sent yet
+    void readAhead(quint64 key, Stream& stream, const ToxFile* file);
+    long long refillTokens(); ///< The upload budget available now, or -1 if unlimited
+    void updateRates();
+
+private:
+    Core* core;
+    QTimer* timer;
+    QHash<quint64, Stream> streams;
+    mutable QMutex statsMutex; ///< Guards priorities and rates only
+    QHash<quint64, int> priorities;
+    QHash<quint64, long long> rates;
+    QHash<int, FriendQueue> friends;
+    QList<int> friendOrder; ///< Round robin order, the friend at the front goes first on the next tick
+    long long tokens;
+    QElapsedTimer tokenClock, rateClock;
+};
+
+#endif // FILESENDSCHEDULER_H
@@ -27,12 +27,13 @@
 
 #define MAX_CONTENT_WIDTH 250
 #define MAX_PREVIEW_SIZE 25*1024*1024
+#define MAX_SEND_PRIORITY 4 // clicking the priority doubles it up to this, then goes back to 1
 
 uint FileTransferInstance::Idconter = 0;
 
 FileTransferInstance::FileTransferInstance(ToxFile File)
     : lastBytesSent{0},
-      fileNum{File.fileNum}, friendId{File.friendId}, direction{File.direction}
+      fileNum{File.fileNum}, friendId{File.friendId}, priority{1}, direction{File.direction}
 {
     id = Idconter++;
     state = tsPending;
@@ -40,6 +41,7 @@ FileTransferInstance::FileTransferInstance(ToxFile File)
     lastUpdateTime = QDateTime::currentDateTime();
 
     filename = File.fileName;
+    totalBytes = File.filesize;
 
     // update this whenever you change the font in innerStyle.css
     QFontMetrics fm(Style::getFont(Style::Small));
@@ -93,7 +95,11 @@ void FileTransferInstance::onFileTransferInfo(int FriendId, int FileNum, int64_t
     long avgspeed = (BytesSent - previousBytesSent) / timediff * 1000;
     long recentspeed = (BytesSent - lastBytesSent) / recenttimediff * 1000;
 
-    speed = getHumanReadableSize(recentspeed)+"/s";
+    // Uploads are paced by the send scheduler, which measures what each one really got
+    if (direction == ToxFile::SENDING)
+        speed = getHumanReadableSize(Core::getInstance()->getFileSendRate(friendId, fileNum))+"/s";
+    else
+        speed = getHumanReadableSize(recentspeed)+"/s";
     size = getHumanReadableSize(Filesize);
     totalBytes = Filesize;
 
@@ -113,7 +119,6 @@ void FileTransferInstance::onFileTransferCancelled(int FriendId, int FileNum, To
 {
     if (FileNum != fileNum || FriendId != friendId || Direction != direction)
             return;
-    disconnect(Core::getInstance(),0,this,0);
     state = tsCanceled;
 
     emit stateUpdated();
@@ -123,7 +128,6 @@ void FileTransferInstance::onFileTransferFinished(ToxFile File)
 {
     if (File.fileNum != fileNum || File.friendId != friendId || File.direction != direction)
             return;
-    disconnect(Core::getInstance(),0,this,0);
 
     if (File.direction == ToxFile::RECEIVING)
     {
@@ -207,6 +211,27 @@ bool isFileWritable(QString& path)
 }
 
 void FileTransferInstance::acceptRecvRequest()
+{
+    // An interrupted download of the same file goes on where it stopped
+    QString path = Core::getInstance()->getPartialDownload(friendId, filename, totalBytes);
+    if (!path.isEmpty())
+        qDebug() << "File: resuming the download into" << path;
+    else
+        path = chooseSavePath();
+    if (path.isEmpty())
+        return;
+
+    savePath = path;
+
+    Core::getInstance()->acceptFileRecvRequest(friendId, fileNum, path);
+    state = tsProcessing;
+
+    effStartTime = QDateTime::currentDateTime();
+
+    emit stateUpdated();
+}
+
+QString FileTransferInstance::chooseSavePath()
 {
     QString path = Settings::getInstance().getAutoAcceptDir(Core::getInstance()->getFriendAddress(friendId));
     if (path.isEmpty()) path = Settings::getInstance().getGlobalAutoAcceptDir();
@@ -233,7 +258,7 @@ void FileTransferInstance::acceptRecvRequest()
         {
             path = QFileDialog::getSaveFileName(0, tr("Save a file","Title of the file saving dialog"), QDir::home().filePath(filename));
             if (path.isEmpty())
-                return;
+                return path;
             else
             {
                 if (isFileWritable(path))
@@ -246,14 +271,7 @@ void FileTransferInstance::acceptRecvRequest()
         }
     }
 
-    savePath = path;
-
-    Core::getInstance()->acceptFileRecvRequest(friendId, fileNum, path);
-    state = tsProcessing;
-
-    effStartTime = QDateTime::currentDateTime();
-
-    emit stateUpdated();
+    return path;
 }
 
 void FileTransferInstance::pauseResumeRecv()
@@ -294,6 +312,17 @@ void FileTransferInstance::pauseResumeSend()
     emit stateUpdated();
 }
 
+void FileTransferInstance::cyclePriority()
+{
+    if (!(state == tsProcessing || state == tsPaused))
+        return;
+
+    priority = priority >= MAX_SEND_PRIORITY ? 1 : priority * 2;
+    Core::getInstance()->setFileSendPriority(friendId, fileNum, priority);
+
+    emit stateUpdated();
+}
+
 QString FileTransferInstance::QImage2base64(const QImage &img)
 {
     QByteArray ba;
@@ -355,6 +384,8 @@ void FileTransferInstance::pressFromHtml(QString code)
             cancelTransfer();
         else if (code == "btnB")
             pauseResumeSend();
+        else if (code == "prio")
+            cyclePriority();
     } else {
         if (code == "btnA")
             rejectRecvRequest();
@@ -416,7 +447,10 @@ QString FileTransferInstance::draw2ButtonsForm(const QString &type, const QImage
     content  = "<p>" + filenameElided + "</p>";
     content += "<table cellspacing=\"0\"><tr>";
     content += "<td>" + size + "</td>";
-    content += "<td align=center>" + speed + "</td>";
+    content += "<td align=center>" + speed;
+    if (direction == ToxFile::SENDING && (state == tsProcessing || state == tsPaused))
+        content += " <img src=\"data:ftrans." + widgetId + ".prio/png;base64," + QImage2base64(drawPriorityImg()) + "\">";
+    content += "</td>";
     content += "<td align=right>" + tr("ETA") + ": " + eta + "</td>";
     content += "</tr><tr><td colspan=3>";
     content += progrBar;
@@ -488,6 +522,24 @@ QImage FileTransferInstance::drawProgressBarImg(const double &part, int w, int h
     return progressBar;
 }
 
+QImage FileTransferInstance::drawPriorityImg()
+{
+    QFont font = Style::getFont(Style::Small);
+    QFontMetrics fm(font);
+    QString text = QString("x%1").arg(priority);
+
+    QImage img(fm.width(text) + 4, fm.height(), QImage::Format_ARGB32);
+    img.fill(Qt::transparent);
+
+    QPainter qPainter(&img);
+    qPainter.setFont(font);
+    qPainter.setPen(Qt::black);
+    qPainter.drawRect(0, 0, img.width() - 1, img.height() - 1);
+    qPainter.drawText(img.rect(), Qt::AlignCenter, text);
+
+    return img;
+}
+
 void FileTransferInstance::onFileTransferBrokenUnbroken(ToxFile File, bool broken)
 {
     if (File.fileNum != fileNum || File.friendId != friendId || File.direction != direction)
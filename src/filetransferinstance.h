@@ -55,8 +55,10 @@ private slots:
     void acceptRecvRequest();
     void pauseResumeRecv();
     void pauseResumeSend();
+    void cyclePriority();
 
 private:
+    QString chooseSavePath(); ///< Asks unless files are auto accepted, empty if the user gave up
     QString getHumanReadableSize(unsigned long long size);
     QString QImage2base64(const QImage &img);
     QString drawButtonlessForm(const QString &type);
@@ -64,6 +66,7 @@ private:
     QString insertMiniature(const QString &type);
     QString wrapIntoForm(const QString &content, const QString &type, const QString &imgAstr, const QString &imgBstr);
     QImage drawProgressBarImg(const double &part, int w, int h);
+    QImage drawPriorityImg();
 
 private:
     static uint Idconter;
@@ -79,6 +82,7 @@ private:
     int fileNum;
     int friendId;
     int contentPrefWidth;
+    int priority; ///< Weight against our other uploads to the same friend
     QString savePath;
     ToxFile::FileDirection direction;
     QString stopFileButtonStylesheet, pauseFileButtonStylesheet, acceptFileButtonStylesheet;
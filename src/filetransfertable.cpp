@@ -0,0 +1,81 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+
+#include "filetransfertable.h"
+
+#include <QFile>
+#include <QDebug>
+
+FileTransferTable::~FileTransferTable()
+{
+    for (ToxFile* file : entries)
+        destroy(file);
+}
+
+quint64 FileTransferTable::key(int friendId, int fileNum, ToxFile::FileDirection direction)
+{
+    return (static_cast<quint64>(static_cast<quint32>(friendId)) << 32)
+            | (static_cast<quint64>(static_cast<quint32>(fileNum)) << 1)
+            | (direction == ToxFile::RECEIVING ? 1 : 0);
+}
+
+ToxFile* FileTransferTable::find(int friendId, int fileNum, ToxFile::FileDirection direction) const
+{
+    return entries.value(key(friendId, fileNum, direction));
+}
+
+ToxFile* FileTransferTable::insert(const ToxFile& file)
+{
+    quint64 k = key(file.friendId, file.fileNum, file.direction);
+
+    // toxcore reuses file numbers, whatever still held this one is over
+    ToxFile* old = entries.value(k);
+    if (old)
+    {
+        qWarning() << "FileTransferTable::insert: Replacing a stale transfer of file" << file.fileNum;
+        byFriend.remove(old->friendId, old);
+        destroy(old);
+    }
+
+    ToxFile* entry = new ToxFile(file);
+    entries[k] = entry;
+    byFriend.insert(entry->friendId, entry);
+    return entry;
+}
+
+bool FileTransferTable::remove(int friendId, int fileNum, ToxFile::FileDirection direction)
+{
+    ToxFile* file = entries.take(key(friendId, fileNum, direction));
+    if (!file)
+        return false;
+
+    byFriend.remove(friendId, file);
+    destroy(file);
+    return true;
+}
+
+QList<ToxFile*> FileTransferTable::ofFriend(int friendId) const
+{
+    return byFriend.values(friendId);
+}
+
+void FileTransferTable::destroy(ToxFile* file)
+{
+    file->file->close();
+    delete file->file;
+    delete file;
+}
@@ -0,0 +1,52 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+
+#ifndef FILETRANSFERTABLE_H
+#define FILETRANSFERTABLE_H
+
+#include <QHash>
+#include <QMultiHash>
+#include <QList>
+#include "corestructs.h"
+
+/// The file transfers in progress, by friend, file number and direction.
+/// Entries are owned by the table and stay where they are until removed, so a ToxFile* is valid until then.
+/// Not thread safe, Core guards it with the toxcore lock
+class FileTransferTable
+{
+public:
+    FileTransferTable() = default;
+    FileTransferTable(const FileTransferTable&) = delete;
+    FileTransferTable& operator=(const FileTransferTable&) = delete;
+    ~FileTransferTable(); ///< Closes and deletes whatever is left
+
+    ToxFile* find(int friendId, int fileNum, ToxFile::FileDirection direction) const;
+    ToxFile* insert(const ToxFile& file); ///< Takes ownership of file.file, replaces a stale entry with the same number
+    bool remove(int friendId, int fileNum, ToxFile::FileDirection direction); ///< Also closes and deletes the QFile
+    QList<ToxFile*> ofFriend(int friendId) const;
+
+    static quint64 key(int friendId, int fileNum, ToxFile::FileDirection direction);
+
+private:
+    void destroy(ToxFile* file);
+
+private:
+    QHash<quint64, ToxFile*> entries;
+    QMultiHash<int, ToxFile*> byFriend;
+};
+
+#endif // FILETRANSFERTABLE_H
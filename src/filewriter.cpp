@@ -0,0 +1,327 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+
+#include "filewriter.h"
+#include "transferjournal.h"
+
+#include <QThread>
+#include <QFile>
+#include <QMutexLocker>
+#include <QDebug>
+
+FileWriter::FileWriter()
+    : thread(nullptr)
+    , stopping(false)
+    , queuedBytes(0)
+    , maxQueuedBytes(0)
+{
+}
+
+void FileWriter::start()
+{
+    if (thread)
+        return;
+
+    stopping = false;
+    thread = new QThread();
+    thread->setObjectName("qTox File I/O");
+    moveToThread(thread);
+
+    connect(thread, &QThread::started, this, &FileWriter::run);
+
+    thread->start();
+}
+
+void FileWriter::stop()
+{
+    if (!thread)
+        return;
+
+    {
+        QMutexLocker locker(&mutex);
+        // What was received so far of unfinished transfers still belongs on disk
+        for (auto it = pending.begin(); it != pending.end(); ++it)
+            if (!it->buffer.isEmpty())
+                flush(it.key(), *it);
+        pending.clear();
+        throttled.clear();
+        stopping = true;
+        wakeup.wakeAll();
+    }
+    thread->quit();
+    thread->wait();
+
+    delete thread;
+    thread = nullptr;
+
+    qDebug() << "FileWriter: stopped, at most" << maxQueuedBytes << "bytes were waiting for the disk";
+}
+
+quint64 FileWriter::makeKey(int friendId, int fileNum)
+{
+    return (static_cast<quint64>(static_cast<quint32>(friendId)) << 32) | static_cast<quint32>(fileNum);
+}
+
+QByteArray FileWriter::takeBuffer()
+{
+    if (!pool.isEmpty())
+        return pool.takeLast();
+
+    QByteArray buffer;
+    buffer.reserve(FILE_WRITER_BUFFER_SIZE);
+    return buffer;
+}
+
+void FileWriter::enqueue(const Job& job)
+{
+    jobs.enqueue(job);
+    wakeup.wakeOne();
+}
+
+FileWriter::WriteResult FileWriter::flush(quint64 key, Pending& pending)
+{
+    Job job;
+    job.type = Job::Write;
+    job.key = key;
+    job.position = pending.position;
+    job.data = pending.buffer;
+    pending.buffer = QByteArray();
+
+    queuedBytes += job.data.size();
+    maxQueuedBytes = qMax(maxQueuedBytes, queuedBytes);
+    enqueue(job);
+
+    if (queuedBytes < FILE_WRITER_HIGH_WATER || throttled.contains(key))
+        return Queued;
+
+    throttled.insert(key);
+    return QueueFull;
+}
+
+void FileWriter::open(int friendId, int fileNum, const QString& path, long long filesize, TransferJournal* journal)
+{
+    Q_ASSERT(journal);
+    if (!journal)
+        qWarning() << "FileWriter::open: No journal for" << path << ", it can't be resumed";
+
+    QMutexLocker locker(&mutex);
+    Job job;
+    job.type = Job::Open;
+    job.key = makeKey(friendId, fileNum);
+    job.position = filesize;
+    job.path = path;
+    job.journal = journal;
+    enqueue(job);
+}
+
+FileWriter::WriteResult FileWriter::write(int friendId, int fileNum, long long position, const uint8_t* data, int length)
+{
+    QMutexLocker locker(&mutex);
+    quint64 key = makeKey(friendId, fileNum);
+    Pending& p = pending[key];
+
+    WriteResult result = Buffered;
+    if (!p.buffer.isEmpty()
+            && (p.position + p.buffer.size() != position || p.buffer.size() + length > FILE_WRITER_BUFFER_SIZE))
+        result = flush(key, p);
+
+    if (p.buffer.isEmpty())
+    {
+        p.position = position;
+        if (p.buffer.capacity() < FILE_WRITER_BUFFER_SIZE)
+            p.buffer = takeBuffer();
+    }
+    p.buffer.append(reinterpret_cast<const char*>(data), length);
+
+    return result;
+}
+
+void FileWriter::finish(const ToxFile& file)
+{
+    QMutexLocker locker(&mutex);
+    quint64 key = makeKey(file.friendId, file.fileNum);
+    auto it = pending.find(key);
+    if (it != pending.end())
+    {
+        if (!it->buffer.isEmpty())
+            flush(key, *it);
+        pending.erase(it);
+    }
+    throttled.remove(key);
+
+    Job job;
+    job.type = Job::Finish;
+    job.key = key;
+    job.file = file;
+    enqueue(job);
+}
+
+void FileWriter::cancel(int friendId, int fileNum)
+{
+    QMutexLocker locker(&mutex);
+    quint64 key = makeKey(friendId, fileNum);
+    pending.remove(key);
+    throttled.remove(key);
+
+    for (auto it = jobs.begin(); it != jobs.end();)
+    {
+        if (it->key == key && it->type == Job::Write)
+        {
+            queuedBytes -= it->data.size();
+            it = jobs.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    Job job;
+    job.type = Job::Cancel;
+    job.key = key;
+    enqueue(job);
+}
+
+void FileWriter::run()
+{
+    QMutexLocker locker(&mutex);
+    forever
+    {
+        while (jobs.isEmpty() && !stopping)
+            wakeup.wait(&mutex);
+        if (jobs.isEmpty())
+            break;
+
+        Job job = jobs.dequeue();
+        locker.unlock();
+        process(job);
+        locker.relock();
+
+        if (job.type != Job::Write)
+            continue;
+
+        queuedBytes -= job.data.size();
+        if (pool.size() < FILE_WRITER_POOL_SIZE)
+        {
+            job.data.resize(0); // keeps the reserved capacity
+            pool.append(job.data);
+        }
+
+        if (queuedBytes < FILE_WRITER_LOW_WATER && !throttled.isEmpty())
+        {
+            for (quint64 key : throttled)
+                emit drained(static_cast<int>(key >> 32), static_cast<int>(key & 0xFFFFFFFF));
+            throttled.clear();
+        }
+    }
+    locker.unlock();
+
+    // Unfinished downloads stay resumable
+    for (quint64 key : files.keys())
+        close(key, true);
+}
+
+void FileWriter::close(quint64 key, bool keepJournal)
+{
+    QFile* file = files.take(key);
+    TransferJournal* journal = journals.take(key);
+    held.remove(key);
+    if (journal)
+    {
+        if (!keepJournal)
+            journal->remove();
+        else if (file && file->flush())
+            journal->save();
+        delete journal;
+    }
+    delete file; // closes
+}
+
+void FileWriter::process(Job& job)
+{
+    int friendId = static_cast<int>(job.key >> 32);
+    int fileNum = static_cast<int>(job.key & 0xFFFFFFFF);
+
+    if (job.type == Job::Open)
+    {
+        close(job.key, true);
+        QFile* file = new QFile(job.path);
+        if (!file->open(QIODevice::ReadWrite))
+        {
+            qWarning() << "FileWriter: Unable to open" << job.path << file->errorString();
+            delete file;
+            delete job.journal;
+            emit failed(friendId, fileNum);
+            return;
+        }
+        // Also truncates whatever a previous file of that name left past the end, a resumed one is the right size
+        if (file->size() != job.position && !file->resize(job.position))
+            qWarning() << "FileWriter: Unable to preallocate" << job.path << file->errorString();
+        files.insert(job.key, file);
+        journals.insert(job.key, job.journal);
+    }
+    else if (job.type == Job::Write)
+    {
+        QFile* file = files.value(job.key);
+        if (!file)
+            return;
+
+        // The block a resume starts with is only written once it matched what we had, a mismatch leaves the file as it was
+        TransferJournal* journal = journals.value(job.key); // null only if open() was misused, then nothing is recorded
+        long long position = job.position;
+        QByteArray data = job.data;
+        if (journal && journal->getVerifyEnd() > 0)
+        {
+            Pending& h = held[job.key];
+            if (h.buffer.isEmpty())
+                h.position = job.position;
+            h.buffer.append(job.data);
+            if (h.position + h.buffer.size() < journal->getVerifyEnd())
+                return;
+            position = h.position;
+            data = h.buffer;
+            held.remove(job.key);
+        }
+
+        if (journal && !journal->addData(position, data))
+        {
+            qWarning() << "FileWriter: The friend isn't resuming" << file->fileName() << "where we left off";
+            close(job.key, false);
+            emit failed(friendId, fileNum);
+            return;
+        }
+        if (file->pos() != position)
+            file->seek(position);
+        if (file->write(data) != data.size())
+        {
+            qWarning() << "FileWriter: Unable to write to" << file->fileName() << file->errorString();
+            close(job.key, false);
+            emit failed(friendId, fileNum);
+            return;
+        }
+        if (journal && journal->needsSave() && file->flush())
+            journal->save();
+    }
+    else
+    {
+        // Gone already if it couldn't be opened or written to, failed() was emitted instead
+        bool wasOpen = files.contains(job.key);
+        close(job.key, false);
+        if (wasOpen && job.type == Job::Finish)
+            emit finished(job.file);
+    }
+}
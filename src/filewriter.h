@@ -0,0 +1,117 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+
+#ifndef FILEWRITER_H
+#define FILEWRITER_H
+
+#include <QObject>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+#include <QHash>
+#include <QSet>
+#include <QByteArray>
+#include <cstdint>
+#include "corestructs.h"
+
+#define FILE_WRITER_BUFFER_SIZE 262144 // bytes gathered per transfer before they're handed to the I/O thread
+#define FILE_WRITER_POOL_SIZE 16 // spare buffers kept around for reuse
+#define FILE_WRITER_HIGH_WATER 16777216 // bytes waiting for the disk at which receiving transfers get paused
+#define FILE_WRITER_LOW_WATER 4194304 // bytes waiting for the disk below which paused transfers are resumed
+
+class QThread;
+class QFile;
+class TransferJournal;
+
+/// Writes the files being received on a thread of its own, in large sequential writes into preallocated files.
+/// toxcore's callbacks only copy the data into a pooled buffer, they never wait on the disk
+class FileWriter : public QObject
+{
+    Q_OBJECT
+public:
+    enum WriteResult
+    {
+        Buffered, ///< Kept until the buffer of the transfer is full
+        Queued, ///< The buffer was handed to the I/O thread
+        QueueFull ///< Queued, but too much is waiting, the transfer should be paused until drained() is emitted
+    };
+
+    FileWriter();
+
+    void start();
+    void stop(); ///< Blocks until everything queued has been written and the thread has exited
+
+    // All of these are thread safe
+    /// Preallocates filesize bytes. Takes the journal, which records what was written and is saved for resuming, it must not be null
+    void open(int friendId, int fileNum, const QString& path, long long filesize, TransferJournal* journal);
+    WriteResult write(int friendId, int fileNum, long long position, const uint8_t* data, int length);
+    void finish(const ToxFile& file); ///< finished() is emitted once everything is on disk and the file is closed
+    void cancel(int friendId, int fileNum); ///< Drops whatever wasn't written yet and the journal
+
+signals:
+    void finished(ToxFile file);
+    void drained(int friendId, int fileNum); ///< A transfer that got QueueFull can be resumed
+    void failed(int friendId, int fileNum); ///< The file couldn't be opened or written to, or a resume didn't match
+
+private slots:
+    void run();
+
+private:
+    struct Job
+    {
+        enum Type {Open, Write, Finish, Cancel};
+
+        Type type;
+        quint64 key;
+        long long position; ///< Write: where data goes. Open: the file size
+        QByteArray data;
+        QString path;
+        ToxFile file;
+        TransferJournal* journal; ///< Open only
+    };
+
+    /// What the network thread is filling for a transfer
+    struct Pending
+    {
+        QByteArray buffer;
+        long long position;
+    };
+
+    static quint64 makeKey(int friendId, int fileNum);
+    QByteArray takeBuffer(); ///< mutex must be held
+    WriteResult flush(quint64 key, Pending& pending); ///< mutex must be held
+    void enqueue(const Job& job); ///< mutex must be held
+    void process(Job& job); ///< I/O thread only, without the mutex
+    void close(quint64 key, bool keepJournal); ///< I/O thread only
+
+private:
+    QThread* thread;
+    QMutex mutex;
+    QWaitCondition wakeup;
+    bool stopping;
+    QQueue<Job> jobs;
+    long long queuedBytes;
+    QHash<quint64, Pending> pending;
+    QList<QByteArray> pool;
+    QSet<quint64> throttled;
+    QHash<quint64, QFile*> files; ///< I/O thread only
+    QHash<quint64, TransferJournal*> journals; ///< I/O thread only
+    QHash<quint64, Pending> held; ///< I/O thread only, the start of a resume, kept until the journal verified it
+    long long maxQueuedBytes; ///< Logged on stop
+};
+
+#endif // FILEWRITER_H
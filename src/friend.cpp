@@ -23,7 +23,7 @@ Friend::Friend(int FriendId, QString UserId)
     : friendId(FriendId), userId(UserId)
 {
     widget = new FriendWidget(friendId, userId);
-    chatForm = new ChatForm(this);
+    chatForm = nullptr;
     hasNewEvents = 0;
     friendStatus = Status::Offline;
 }
@@ -37,13 +37,15 @@ Friend::~Friend()
 void Friend::setName(QString name)
 {
     widget->setName(name);
-    chatForm->setName(name);
+    if (chatForm)
+        chatForm->setName(name);
 }
 
 void Friend::setStatusMessage(QString message)
 {
     widget->setStatusMsg(message);
-    chatForm->setStatusMessage(message);
+    if (chatForm)
+        chatForm->setStatusMessage(message);
 }
 
 QString Friend::getName() const
@@ -55,3 +57,19 @@ ToxID Friend::getToxID() const
 {
     return ToxID::fromString(userId);
 }
+
+ChatForm* Friend::getChatForm()
+{
+    if (!chatForm)
+    {
+        // The name and status message are kept by the widget meanwhile
+        chatForm = new ChatForm(this);
+        chatForm->setStatusMessage(widget->getStatusMsg());
+    }
+    return chatForm;
+}
+
+bool Friend::hasChatForm() const
+{
+    return chatForm != nullptr;
+}
@@ -32,14 +32,18 @@ public:
     void setStatusMessage(QString message);
     QString getName() const;
     ToxID getToxID() const;
+    ChatForm* getChatForm(); ///< Built the first time the chat is opened or an event needs it
+    bool hasChatForm() const;
 
 public:
     FriendWidget* widget;
     int friendId;
     QString userId;
-    ChatForm* chatForm;
     int hasNewEvents;
     Status friendStatus;
+
+private:
+    ChatForm* chatForm;
 };
 
 #endif // FRIEND_H
@@ -20,33 +20,44 @@
 #include <QDebug>
 
 QList<Friend*> FriendList::friendList;
+QHash<int, Friend*> FriendList::friendIndex;
+QHash<QString, Friend*> FriendList::userIdIndex;
 
 Friend* FriendList::addFriend(int friendId, const QString& userId)
 {
-    for (Friend* f : friendList)
-        if (f->friendId == friendId)
-            qWarning() << "FriendList::addFriend: friendId already taken";
+    if (friendIndex.contains(friendId))
+        qWarning() << "FriendList::addFriend: friendId already taken";
     Friend* newfriend = new Friend(friendId, userId);
     friendList.append(newfriend);
+    friendIndex[friendId] = newfriend;
+    userIdIndex[userId] = newfriend;
     return newfriend;
 }
 
 Friend* FriendList::findFriend(int friendId)
 {
-    for (Friend* f : friendList)
-        if (f->friendId == friendId)
-            return f;
-    return nullptr;
+    return friendIndex.value(friendId);
+}
+
+Friend* FriendList::findFriend(const QString& userId)
+{
+    return userIdIndex.value(userId);
 }
 
 void FriendList::removeFriend(int friendId)
 {
-    for (int i=0; i<friendList.size(); i++)
-    {
-        if (friendList[i]->friendId == friendId)
-        {
-            friendList.removeAt(i);
-            return;
-        }
-    }
+    Friend* f = friendIndex.take(friendId);
+    if (!f)
+        return;
+
+    if (userIdIndex.value(f->userId) == f)
+        userIdIndex.remove(f->userId);
+    friendList.removeOne(f);
+}
+
+void FriendList::clear()
+{
+    friendList.clear();
+    friendIndex.clear();
+    userIdIndex.clear();
 }
@@ -17,9 +17,11 @@
 #ifndef FRIENDLIST_H
 #define FRIENDLIST_H
 
-template <class T> class QList;
+#include <QList>
+#include <QHash>
+#include <QString>
+
 struct Friend;
-class QString;
 
 class FriendList
 {
@@ -27,10 +29,16 @@ public:
     FriendList();
     static Friend* addFriend(int friendId, const QString& userId);
     static Friend* findFriend(int friendId);
+    static Friend* findFriend(const QString& userId);
     static void removeFriend(int friendId);
+    static void clear(); ///< Doesn't delete the friends
 
 public:
-    static QList<Friend*> friendList;
+    static QList<Friend*> friendList; ///< Read only, kept in sync with the indexes below by add/removeFriend
+
+private:
+    static QHash<int, Friend*> friendIndex;
+    static QHash<QString, Friend*> userIdIndex;
 };
 
 #endif // FRIENDLIST_H
@@ -38,6 +38,7 @@ public:
 
 public:
     int groupId;
+    QString historyKey; ///< The group's key from the invite, the same every session. Empty if we don't know it
     QMap<int,QString> peers;
     int nPeers;
     GroupWidget* widget;
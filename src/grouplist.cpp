@@ -18,30 +18,42 @@
 #include "group.h"
 
 QList<Group*> GroupList::groupList;
+QHash<int, Group*> GroupList::groupIndex;
 
 Group* GroupList::addGroup(int groupId, const QString& name)
 {
     Group* newGroup = new Group(groupId, name);
     groupList.append(newGroup);
+    groupIndex[groupId] = newGroup;
     return newGroup;
 }
 
 Group* GroupList::findGroup(int groupId)
 {
+    return groupIndex.value(groupId);
+}
+
+Group* GroupList::findGroupByHistoryKey(const QString& key)
+{
+    if (key.isEmpty())
+        return nullptr;
+
     for (Group* g : groupList)
-        if (g->groupId == groupId)
+        if (g->historyKey == key)
             return g;
+
     return nullptr;
 }
 
 void GroupList::removeGroup(int groupId)
 {
-    for (int i=0; i<groupList.size(); i++)
-    {
-        if (groupList[i]->groupId == groupId)
-        {
-            groupList.removeAt(i);
-            return;
-        }
-    }
+    Group* g = groupIndex.take(groupId);
+    if (g)
+        groupList.removeOne(g);
+}
+
+void GroupList::clear()
+{
+    groupList.clear();
+    groupIndex.clear();
 }
@@ -17,8 +17,9 @@
 #ifndef GROUPLIST_H
 #define GROUPLIST_H
 
-template <typename T>
-class QList;
+#include <QList>
+#include <QHash>
+
 class Group;
 class QString;
 
@@ -28,10 +29,15 @@ public:
     GroupList();
     static Group* addGroup(int groupId, const QString& name);
     static Group* findGroup(int groupId);
+    static Group* findGroupByHistoryKey(const QString& key); ///< A group joined this session, logged under key
     static void removeGroup(int groupId);
+    static void clear(); ///< Doesn't delete the groups
 
 public:
-    static QList<Group*> groupList;
+    static QList<Group*> groupList; ///< Read only, kept in sync with the index below by add/removeGroup
+
+private:
+    static QHash<int, Group*> groupIndex;
 };
 
 #endif // GROUPLIST_H
@@ -0,0 +1,161 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+#include "historycache.h"
+
+#include <QMutexLocker>
+
+HistoryCache::HistoryCache(qint64 maxBytes)
+    : maxBytes(maxBytes)
+    , bytes(0)
+    , useCounter(0)
+    , hits(0)
+    , misses(0)
+{
+}
+
+bool HistoryCache::get(HistoryKeeper::ChatType ct, const QString &chat, int limit, QList<HistoryKeeper::HistMessage> &out)
+{
+    QMutexLocker locker(&mutex);
+
+    auto it = conversations.find(key(ct, chat));
+    if (it == conversations.end() || (it->msgs.size() < limit && !it->whole))
+    {
+        misses++;
+        return false;
+    }
+
+    hits++;
+    it->lastUse = ++useCounter;
+    out = it->msgs.mid(qMax(0, it->msgs.size() - limit));
+    return true;
+}
+
+void HistoryCache::put(HistoryKeeper::ChatType ct, const QString &chat, const QList<HistoryKeeper::HistMessage> &msgs, bool whole)
+{
+    QMutexLocker locker(&mutex);
+    store(key(ct, chat), msgs, whole);
+}
+
+void HistoryCache::preload(HistoryKeeper::ChatType ct, const QString &chat, const QList<HistoryKeeper::HistMessage> &msgs, bool whole)
+{
+    QMutexLocker locker(&mutex);
+
+    // whatever is cached already is at least as recent
+    QString k = key(ct, chat);
+    if (!conversations.contains(k))
+        store(k, msgs, whole);
+}
+
+void HistoryCache::append(HistoryKeeper::ChatType ct, const QString &chat, const HistoryKeeper::HistMessage &msg)
+{
+    QMutexLocker locker(&mutex);
+
+    // an uncached chat stays so, a lone message isn't a page to show
+    auto it = conversations.find(key(ct, chat));
+    if (it == conversations.end())
+        return;
+
+    it->msgs.append(msg);
+    it->bytes += messageBytes(msg);
+    bytes += messageBytes(msg);
+    it->lastUse = ++useCounter;
+
+    trim(*it);
+    evict();
+}
+
+void HistoryCache::clear()
+{
+    QMutexLocker locker(&mutex);
+
+    conversations.clear();
+    bytes = 0;
+}
+
+quint64 HistoryCache::getHits()
+{
+    QMutexLocker locker(&mutex);
+    return hits;
+}
+
+quint64 HistoryCache::getMisses()
+{
+    QMutexLocker locker(&mutex);
+    return misses;
+}
+
+qint64 HistoryCache::getBytes()
+{
+    QMutexLocker locker(&mutex);
+    return bytes;
+}
+
+QString HistoryCache::key(HistoryKeeper::ChatType ct, const QString &chat)
+{
+    return QString::number(ct) + ":" + chat;
+}
+
+qint64 HistoryCache::messageBytes(const HistoryKeeper::HistMessage &msg)
+{
+    return sizeof(HistoryKeeper::HistMessage) + (msg.sender.size() + msg.message.size()) * sizeof(QChar);
+}
+
+void HistoryCache::store(const QString &k, const QList<HistoryKeeper::HistMessage> &msgs, bool whole)
+{
+    auto it = conversations.find(k);
+    if (it != conversations.end())
+        bytes -= it->bytes;
+    else
+        it = conversations.insert(k, Conversation{QList<HistoryKeeper::HistMessage>(), false, 0, 0});
+
+    it->msgs = msgs;
+    it->whole = whole;
+    it->lastUse = ++useCounter;
+    it->bytes = 0;
+    for (const HistoryKeeper::HistMessage &msg : msgs)
+        it->bytes += messageBytes(msg);
+    bytes += it->bytes;
+
+    trim(*it);
+    evict();
+}
+
+void HistoryCache::trim(HistoryCache::Conversation &conv)
+{
+    while (conv.msgs.size() > HISTORY_CACHE_MESSAGES)
+    {
+        qint64 size = messageBytes(conv.msgs.takeFirst());
+        conv.bytes -= size;
+        bytes -= size;
+        conv.whole = false;
+    }
+}
+
+void HistoryCache::evict()
+{
+    // few conversations are ever cached, a scan for the least recently used one is cheap enough
+    while (bytes > maxBytes && !conversations.isEmpty())
+    {
+        auto lru = conversations.begin();
+        for (auto it = conversations.begin(); it != conversations.end(); ++it)
+            if (it->lastUse < lru->lastUse)
+                lru = it;
+
+        bytes -= lru->bytes;
+        conversations.erase(lru);
+    }
+}
@@ -0,0 +1,70 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+#ifndef HISTORYCACHE_H
+#define HISTORYCACHE_H
+
+#include <QHash>
+#include <QMutex>
+
+#include "historykeeper.h"
+
+#define HISTORY_CACHE_MESSAGES 100 // newest messages kept per conversation, a page of GenericChatForm
+#define HISTORY_CACHE_PRELOAD 10 // most recently active conversations loaded at startup
+
+/// LRU of the newest messages of the recently active conversations, thread safe
+class HistoryCache
+{
+public:
+    explicit HistoryCache(qint64 maxBytes);
+
+    /// On a hit, out holds up to limit of the newest messages, oldest first
+    bool get(HistoryKeeper::ChatType ct, const QString& chat, int limit, QList<HistoryKeeper::HistMessage>& out);
+    /// msgs are the newest messages of the chat, oldest first, fewer than asked means the chat has no more
+    void put(HistoryKeeper::ChatType ct, const QString& chat, const QList<HistoryKeeper::HistMessage>& msgs, bool whole);
+    /// Same as put(), unless the chat is already cached
+    void preload(HistoryKeeper::ChatType ct, const QString& chat, const QList<HistoryKeeper::HistMessage>& msgs, bool whole);
+    void append(HistoryKeeper::ChatType ct, const QString& chat, const HistoryKeeper::HistMessage& msg);
+    void clear();
+
+    quint64 getHits();
+    quint64 getMisses();
+    qint64 getBytes();
+
+private:
+    struct Conversation
+    {
+        QList<HistoryKeeper::HistMessage> msgs;
+        bool whole; ///< msgs are all the messages of the chat
+        quint64 lastUse;
+        qint64 bytes;
+    };
+
+    static QString key(HistoryKeeper::ChatType ct, const QString& chat);
+    static qint64 messageBytes(const HistoryKeeper::HistMessage& msg);
+    void store(const QString& k, const QList<HistoryKeeper::HistMessage>& msgs, bool whole);
+    void trim(Conversation& conv);
+    void evict();
+
+private:
+    QMutex mutex;
+    QHash<QString, Conversation> conversations;
+    qint64 maxBytes, bytes;
+    quint64 useCounter;
+    quint64 hits, misses;
+};
+
+#endif // HISTORYCACHE_H
@@ -0,0 +1,178 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+#include "historyexporter.h"
+
+#include <QThread>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QDebug>
+
+HistoryExporter::HistoryExporter(HistoryKeeper::ChatType ct, const QString &chat, const QString &path,
+                                 HistoryExporter::Format format, const QHash<QString, QString> &names)
+    : ct(ct)
+    , chat(chat)
+    , path(path)
+    , format(format)
+    , names(names)
+    , history(nullptr)
+    , thread(nullptr)
+    , cancelled(0)
+{
+}
+
+void HistoryExporter::start()
+{
+    history = HistoryKeeper::getInstance();
+    history->registerExporter(this);
+
+    thread = new QThread();
+    thread->setObjectName("qTox History Exporter");
+    moveToThread(thread);
+
+    connect(thread, &QThread::started, this, &HistoryExporter::run);
+    connect(this, &HistoryExporter::finished, thread, &QThread::quit);
+    connect(thread, &QThread::finished, this, &HistoryExporter::deleteLater);
+    connect(thread, &QThread::finished, thread, &QThread::deleteLater);
+
+    thread->start();
+}
+
+void HistoryExporter::cancel()
+{
+    cancelled.store(1);
+}
+
+HistoryExporter::Format HistoryExporter::formatForFile(const QString &path)
+{
+    QString suffix = QFileInfo(path).suffix().toLower();
+    if (suffix == "jsonl" || suffix == "json")
+        return JsonLines;
+    else if (suffix == "html" || suffix == "htm")
+        return Html;
+    else
+        return PlainText;
+}
+
+void HistoryExporter::run()
+{
+    exportLog();
+    history->unregisterExporter(this);
+}
+
+void HistoryExporter::exportLog()
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        emit finished(false, file.errorString());
+        return;
+    }
+
+    QTextStream out(&file);
+    out.setCodec("UTF-8");
+
+    int total = history->getChatMessageCount(ct, chat);
+    int exported = 0;
+    emit progress(exported, total);
+
+    writeHeader(out);
+
+    // Only one batch is ever held, whatever the size of the log
+    HistoryKeeper::HistCursor cursor{QDateTime::fromMSecsSinceEpoch(0), -1};
+    QList<HistoryKeeper::HistMessage> batch;
+    do
+    {
+        if (cancelled.load())
+        {
+            file.remove();
+            emit finished(false, tr("Cancelled"));
+            return;
+        }
+
+        batch = history->getChatHistoryAfter(ct, chat, cursor, HISTORY_EXPORT_BATCH);
+        for (const HistoryKeeper::HistMessage& msg : batch)
+            writeMessage(out, msg);
+
+        out.flush();
+        if (file.error() != QFile::NoError)
+        {
+            QString error = file.errorString();
+            file.remove();
+            emit finished(false, error);
+            return;
+        }
+
+        if (!batch.isEmpty())
+            cursor = {batch.last().timestamp, batch.last().id};
+
+        exported += batch.size();
+        emit progress(exported, qMax(exported, total)); // messages can arrive during the export
+    } while (batch.size() == HISTORY_EXPORT_BATCH);
+
+    writeFooter(out);
+    out.flush();
+    file.close();
+
+    qDebug() << "HistoryExporter: exported" << exported << "messages to" << path;
+    emit finished(true, QString());
+}
+
+void HistoryExporter::writeHeader(QTextStream &out)
+{
+    if (format == Html)
+    {
+        out << "<!DOCTYPE html>\n<html>\n<head>\n<meta charset=\"utf-8\">\n<title>"
+            << names.value(chat, chat).toHtmlEscaped() << "</title>\n</head>\n<body>\n<table>\n";
+    }
+}
+
+void HistoryExporter::writeMessage(QTextStream &out, const HistoryKeeper::HistMessage &msg)
+{
+    QString sender = names.value(msg.sender, msg.sender);
+    if (ct == HistoryKeeper::ctGroup)
+        sender = HistoryKeeper::getGroupSenderName(msg.sender);
+    QDateTime time = msg.timestamp.toLocalTime();
+
+    switch (format)
+    {
+    case PlainText:
+        out << "[" << time.toString("yyyy-MM-dd hh:mm:ss") << "] " << sender << ": " << msg.message << "\n";
+        break;
+    case JsonLines:
+    {
+        QJsonObject line;
+        line["timestamp"] = msg.timestamp.toUTC().toString(Qt::ISODate);
+        line["sender"] = sender;
+        line["message"] = msg.message;
+        out << QString::fromUtf8(QJsonDocument(line).toJson(QJsonDocument::Compact)) << "\n";
+        break;
+    }
+    case Html:
+        out << "<tr><td>" << time.toString("yyyy-MM-dd hh:mm:ss") << "</td><td>" << sender.toHtmlEscaped()
+            << "</td><td>" << msg.message.toHtmlEscaped().replace('\n', "<br/>") << "</td></tr>\n";
+        break;
+    }
+}
+
+void HistoryExporter::writeFooter(QTextStream &out)
+{
+    if (format == Html)
+        out << "</table>\n</body>\n</html>\n";
+}
@@ -0,0 +1,70 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+#ifndef HISTORYEXPORTER_H
+#define HISTORYEXPORTER_H
+
+#include <QObject>
+#include <QHash>
+#include <QAtomicInt>
+
+#include "historykeeper.h"
+
+#define HISTORY_EXPORT_BATCH 500 // messages read and written at once, bounds the memory used by an export
+
+class QThread;
+class QTextStream;
+
+/// Streams a chat log from the history database to a file, on its own thread
+class HistoryExporter : public QObject
+{
+    Q_OBJECT
+public:
+    enum Format {PlainText = 0, JsonLines, Html};
+
+    /// names maps the senders as logged (public keys) to the names written, unknown senders are written as logged
+    HistoryExporter(HistoryKeeper::ChatType ct, const QString& chat, const QString& path, Format format,
+                    const QHash<QString, QString>& names);
+
+    void start(); ///< Reads from the current history, which waits for it to end. The exporter deletes itself once finished
+    void cancel(); ///< Thread safe, the partial file is removed
+
+    static Format formatForFile(const QString& path); ///< Guessed from the extension
+
+signals:
+    void progress(int exported, int total);
+    void finished(bool success, const QString& error);
+
+private slots:
+    void run();
+
+private:
+    void exportLog();
+    void writeHeader(QTextStream& out);
+    void writeMessage(QTextStream& out, const HistoryKeeper::HistMessage& msg);
+    void writeFooter(QTextStream& out);
+
+private:
+    HistoryKeeper::ChatType ct;
+    QString chat, path;
+    Format format;
+    QHash<QString, QString> names;
+    HistoryKeeper* history; ///< Taken at start, it doesn't close before the export has ended
+    QThread* thread;
+    QAtomicInt cancelled;
+};
+
+#endif // HISTORYEXPORTER_H
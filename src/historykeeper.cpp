@@ -15,19 +15,20 @@
 */
 
 #include "historykeeper.h"
+#include "historywriter.h"
+#include "historycache.h"
+#include "historyexporter.h"
 #include "misc/settings.h"
 #include "core.h"
 
-#include <QSqlError>
 #include <QFile>
 #include <QDir>
-#include <QSqlQuery>
-#include <QVariant>
+#include <QThread>
 #include <QDebug>
-#include <QTemporaryFile>
+#include <limits>
 
-#include "misc/db/plaindb.h"
 #include "misc/db/encrypteddb.h"
+#include "misc/db/encryptedvfs.h"
 
 static HistoryKeeper *historyInstance = nullptr;
 
@@ -35,33 +36,19 @@ HistoryKeeper *HistoryKeeper::getInstance()
 {
     if (historyInstance == nullptr)
     {
-        QList<QString> initLst;
-        initLst.push_back(QString("CREATE TABLE IF NOT EXISTS history (id INTEGER PRIMARY KEY AUTOINCREMENT, timestamp INTEGER NOT NULL, ") +
-                          QString("chat_id INTEGER NOT NULL, sender INTEGER NOT NULL, message TEXT NOT NULL);"));
-        initLst.push_back(QString("CREATE TABLE IF NOT EXISTS aliases (id INTEGER PRIMARY KEY AUTOINCREMENT, user_id TEXT UNIQUE NOT NULL);"));
-        initLst.push_back(QString("CREATE TABLE IF NOT EXISTS chats (id INTEGER PRIMARY KEY AUTOINCREMENT, name TEXT UNIQUE NOT NULL, ctype INTEGER NOT NULL);"));
-
         QString path(":memory:");
-        GenericDdInterface *dbIntf;
+        bool encrypted = false;
 
         if (Settings::getInstance().getEnableLogging())
         {
-            bool encrypted = Settings::getInstance().getEncryptLogs();
-
-            if (encrypted)
-            {
-                path = getHistoryPath();
-                dbIntf = new EncryptedDb(path, initLst);
-
-                historyInstance = new HistoryKeeper(dbIntf);
-                return historyInstance;
-            } else {
-                path = getHistoryPath();
-            }
+            encrypted = Settings::getInstance().getEncryptLogs();
+            path = getHistoryPath();
         }
 
-        dbIntf = new PlainDb(path, initLst);
-        historyInstance = new HistoryKeeper(dbIntf);
+        if (encrypted)
+            setupEncryption();
+
+        historyInstance = new HistoryKeeper(path, encrypted);
     }
 
     return historyInstance;
@@ -74,6 +61,7 @@ bool HistoryKeeper::checkPassword()
         if (Settings::getInstance().getEncryptLogs())
         {
             QString dbpath = getHistoryPath();
+            setupEncryption();
             return EncryptedDb::check(dbpath);
         } else {
             return true;
@@ -83,147 +71,158 @@ bool HistoryKeeper::checkPassword()
     }
 }
 
-HistoryKeeper::HistoryKeeper(GenericDdInterface *db_) :
-    db(db_)
+void HistoryKeeper::setupEncryption()
 {
-    /*
-     DB format
-     chats:
-      * name -> id map
-       id      -- auto-incrementing number
-       name    -- chat's name (for user to user conversation it is opposite user public key)
-       ctype   -- chat type, reserved for group chats
-
-     alisases:
-      * user_id -> id map
-       id      -- auto-incrementing number
-       name    -- user's public key
-
-     history:
-       id           -- auto-incrementing number
-       timestamp
-       chat_id      -- current chat ID (resolves from chats table)
-       sender       -- sender's ID (resolves from aliases table)
-       message
-    */
-
-    updateChatsID();
-    updateAliases();
+    EncryptedVfs::setDecryptThreads(Settings::getInstance().getHistoryDecryptThreads());
+    // the VFS decrypts from the writer thread and a thread pool, so it gets its own copy of the key
+    EncryptedDb::setCipher(encryptHistory, decryptHistory, Core::getInstance()->getPasswordKey(Core::ptHistory));
 }
 
-HistoryKeeper::~HistoryKeeper()
+QByteArray HistoryKeeper::encryptHistory(const QByteArray &data, const QByteArray &key)
 {
-    delete db;
+    return Core::encryptData(data, key);
 }
 
-void HistoryKeeper::addChatEntry(const QString& chat, const QString& message, const QString& sender, const QDateTime &dt)
+QByteArray HistoryKeeper::decryptHistory(const QByteArray &data, const QByteArray &key)
 {
-    int chat_id = getChatID(chat, ctSingle).first;
-    int sender_id = getAliasID(sender);
-
-    db->exec(QString("INSERT INTO history (timestamp, chat_id, sender, message)") +
-             QString("VALUES (%1, %2, %3, '%4');")
-             .arg(dt.toMSecsSinceEpoch()).arg(chat_id).arg(sender_id).arg(wrapMessage(message)));
+    return Core::decryptData(data, key);
 }
 
-QList<HistoryKeeper::HistMessage> HistoryKeeper::getChatHistory(HistoryKeeper::ChatType ct, const QString &chat,
-                                                                const QDateTime &time_from, const QDateTime &time_to)
+HistoryKeeper::HistoryKeeper(const QString &path, bool encrypted)
 {
-    QList<HistMessage> res;
+    // The database lives on the writer's thread, so that disk I/O never stalls the caller
+    cache = new HistoryCache(static_cast<qint64>(Settings::getInstance().getHistoryCacheSize()) * 1024 * 1024);
 
-    qint64 time64_from = time_from.toMSecsSinceEpoch();
-    qint64 time64_to = time_to.toMSecsSinceEpoch();
+    writerThread = new QThread();
+    writer = new HistoryWriter(path, encrypted, cache);
+    writer->setCompressMessages(Settings::getInstance().getCompressLogs());
+    writer->setRetention({Settings::getInstance().getHistoryMaxAge(), Settings::getInstance().getHistoryMaxMessages()});
+    writer->moveToThread(writerThread);
+    writerThread->start();
 
-    int chat_id = getChatID(chat, ct).first;
+    writer->open();
+}
 
-    QSqlQuery dbAnswer;
-    if (ct == ctSingle)
+HistoryKeeper::~HistoryKeeper()
+{
+    // a profile switch mustn't pull the writer from under an export
     {
-        dbAnswer = db->exec(QString("SELECT timestamp, user_id, message FROM history INNER JOIN aliases ON history.sender = aliases.id ") +
-                            QString("AND timestamp BETWEEN %1 AND %2 AND chat_id = %3;")
-                            .arg(time64_from).arg(time64_to).arg(chat_id));
-    } else {
-        // no groupchats yet
+        QMutexLocker locker(&exportMutex);
+        for (HistoryExporter* exporter : exporters)
+            exporter->cancel();
+        while (!exporters.isEmpty())
+            exportsDone.wait(&exportMutex);
     }
 
-    while (dbAnswer.next())
-    {
-        QString sender = dbAnswer.value(1).toString();
-        QString message = unWrapMessage(dbAnswer.value(2).toString());
-        qint64 timeInt = dbAnswer.value(0).toLongLong();
-        QDateTime time = QDateTime::fromMSecsSinceEpoch(timeInt);
+    writer->close(); // commits whatever is still queued
+    writerThread->quit();
+    writerThread->wait();
 
-        res.push_back({sender,message,time});
-    }
+    delete writer;
+    delete writerThread;
 
-    return res;
+    qDebug() << "HistoryKeeper: cache hits" << cache->getHits() << ", misses" << cache->getMisses();
+    delete cache;
 }
 
-QString HistoryKeeper::wrapMessage(const QString &str)
+void HistoryKeeper::registerExporter(HistoryExporter *exporter)
 {
-    QString wrappedMessage(str);
-    wrappedMessage.replace("'", "''");
-    return wrappedMessage;
+    QMutexLocker locker(&exportMutex);
+    exporters.append(exporter);
 }
 
-QString HistoryKeeper::unWrapMessage(const QString &str)
+void HistoryKeeper::unregisterExporter(HistoryExporter *exporter)
 {
-    QString unWrappedMessage(str);
-    unWrappedMessage.replace("''", "'");
-    return unWrappedMessage;
+    QMutexLocker locker(&exportMutex);
+    exporters.removeOne(exporter);
+    exportsDone.wakeAll();
 }
 
-void HistoryKeeper::updateChatsID()
+void HistoryKeeper::addChatEntry(const QString& chat, const QString& message, const QString& sender, const QDateTime &dt)
 {
-    auto dbAnswer = db->exec(QString("SELECT * FROM chats;"));
+    writer->enqueue({ctSingle, chat, message, sender, dt});
+}
 
-    chats.clear();
-    while (dbAnswer.next())
-    {
-        QString name = dbAnswer.value(1).toString();
-        int id = dbAnswer.value(0).toInt();
-        ChatType ctype = convertToChatType(dbAnswer.value(2).toInt());
+QList<HistoryKeeper::HistMessage> HistoryKeeper::getChatHistory(HistoryKeeper::ChatType ct, const QString &chat,
+                                                                const QDateTime &time_from, const QDateTime &time_to)
+{
+    return writer->getChatHistory(ct, chat, time_from, time_to);
+}
 
-        chats[name] = {id, ctype};
-    }
+QList<HistoryKeeper::HistMessage> HistoryKeeper::getChatHistoryBefore(HistoryKeeper::ChatType ct, const QString &chat,
+                                                                      const HistCursor &cursor, int limit)
+{
+    return writer->getChatHistoryPage(ct, chat, cursor.timestamp, cursor.id, limit, true);
 }
 
-void HistoryKeeper::updateAliases()
+QList<HistoryKeeper::HistMessage> HistoryKeeper::getRecentChatHistory(HistoryKeeper::ChatType ct, const QString &chat, int limit)
 {
-    auto dbAnswer = db->exec(QString("SELECT * FROM aliases;"));
+    QList<HistMessage> msgs;
 
-    aliases.clear();
-    while (dbAnswer.next())
-    {
-        QString user_id = dbAnswer.value(1).toString();
-        int id = dbAnswer.value(0).toInt();
+    // queued messages reach the cache once committed, until then the database has them first
+    if (writer->getPendingCount() == 0 && cache->get(ct, chat, limit, msgs))
+        return msgs;
 
-        aliases[user_id] = id;
-    }
+    msgs = getChatHistoryBefore(ct, chat, {QDateTime::currentDateTime(), std::numeric_limits<qint64>::max()}, limit);
+    cache->put(ct, chat, msgs, msgs.size() < limit);
+
+    return msgs;
 }
 
-QPair<int, HistoryKeeper::ChatType> HistoryKeeper::getChatID(const QString &id_str, ChatType ct)
+QList<HistoryKeeper::HistMessage> HistoryKeeper::getChatHistoryAfter(HistoryKeeper::ChatType ct, const QString &chat,
+                                                                     const HistCursor &cursor, int limit)
 {
-    auto it = chats.find(id_str);
-    if (it != chats.end())
-        return it.value();
+    return writer->getChatHistoryPage(ct, chat, cursor.timestamp, cursor.id, limit, false);
+}
+
+QList<HistoryKeeper::SearchResult> HistoryKeeper::search(const QString &text, int limit)
+{
+    return writer->search(text, limit);
+}
+
+int HistoryKeeper::getChatMessageCount(HistoryKeeper::ChatType ct, const QString &chat)
+{
+    return writer->getChatMessageCount(ct, chat);
+}
+
+void HistoryKeeper::flush()
+{
+    writer->flush();
+}
+
+void HistoryKeeper::setCompressMessages(bool compress)
+{
+    writer->setCompressMessages(compress);
+}
+
+void HistoryKeeper::setRetention(const RetentionRule &rule)
+{
+    writer->setRetention(rule);
+}
 
-    db->exec(QString("INSERT INTO chats (name, ctype) VALUES ('%1', '%2');").arg(id_str).arg(ct));
-    updateChatsID();
+void HistoryKeeper::setChatRetention(HistoryKeeper::ChatType ct, const QString &chat, bool hasRule, const RetentionRule &rule)
+{
+    writer->setChatRetention(ct, chat, hasRule, rule);
+}
 
-    return getChatID(id_str, ct);
+bool HistoryKeeper::getChatRetention(HistoryKeeper::ChatType ct, const QString &chat, RetentionRule &rule)
+{
+    return writer->getChatRetention(ct, chat, rule);
 }
 
-int HistoryKeeper::getAliasID(const QString &id_str)
+bool HistoryKeeper::canShrinkFile()
 {
-    auto it = aliases.find(id_str);
-    if (it != aliases.end())
-        return it.value();
+    return writer->canShrinkFile();
+}
 
-    db->exec(QString("INSERT INTO aliases (user_id) VALUES ('%1');").arg(id_str));
-    updateAliases();
+int HistoryKeeper::getQueueDepth()
+{
+    return writer->getQueueDepth();
+}
 
-    return getAliasID(id_str);
+qint64 HistoryKeeper::getLastCommitLatency()
+{
+    return writer->getLastCommitLatency();
 }
 
 void HistoryKeeper::resetInstance()
@@ -235,21 +234,15 @@ void HistoryKeeper::resetInstance()
     historyInstance = nullptr;
 }
 
-void HistoryKeeper::addGroupChatEntry(const QString &chat, const QString &message, const QString &sender, const QDateTime &dt)
+void HistoryKeeper::addGroupChatEntry(const QString &chat, const QString &message, const QString &senderKey,
+                                      const QString &senderName, const QDateTime &dt)
 {
-    Q_UNUSED(chat)
-    Q_UNUSED(message)
-    Q_UNUSED(sender)
-    Q_UNUSED(dt)
-    // no groupchats yet
+    writer->enqueue({ctGroup, chat, message, senderKey + " " + senderName, dt});
 }
 
-HistoryKeeper::ChatType HistoryKeeper::convertToChatType(int ct)
+QString HistoryKeeper::getGroupSenderName(const QString &sender)
 {
-    if (ct < 0 || ct > 1)
-        return ctSingle;
-
-    return static_cast<ChatType>(ct);
+    return sender.section(' ', 1);
 }
 
 QString HistoryKeeper::getHistoryPath()
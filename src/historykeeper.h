@@ -20,8 +20,13 @@
 #include <QMap>
 #include <QList>
 #include <QDateTime>
+#include <QMutex>
+#include <QWaitCondition>
 
-class GenericDdInterface;
+class HistoryWriter;
+class HistoryCache;
+class HistoryExporter;
+class QThread;
 
 class HistoryKeeper
 {
@@ -30,11 +35,33 @@ public:
 
     struct HistMessage
     {
+        qint64 id;
         QString sender;
         QString message;
         QDateTime timestamp;
     };
 
+    struct SearchResult
+    {
+        ChatType ct;
+        QString chat;
+        HistMessage msg;
+    };
+
+    /// A position in a chat, pages are keyed on (timestamp, id) so that messages sharing a timestamp are never skipped
+    struct HistCursor
+    {
+        QDateTime timestamp;
+        qint64 id;
+    };
+
+    /// What is kept of a chat, 0 means no limit. A chat without a rule of its own follows the global one
+    struct RetentionRule
+    {
+        int maxAgeDays;
+        int maxMessages;
+    };
+
     virtual ~HistoryKeeper();
 
     static HistoryKeeper* getInstance();
@@ -45,27 +72,51 @@ public:
     static void renameHistory(QString from, QString to);
 
     void addChatEntry(const QString& chat, const QString& message, const QString& sender, const QDateTime &dt);
-    void addGroupChatEntry(const QString& chat, const QString& message, const QString& sender, const QDateTime &dt);
+    /// Group peers aren't friends, they're logged by public key along with the name they had
+    void addGroupChatEntry(const QString& chat, const QString& message, const QString& senderKey, const QString& senderName,
+                           const QDateTime &dt);
+    static QString getGroupSenderName(const QString& sender); ///< The name a group peer was logged with
     QList<HistMessage> getChatHistory(ChatType ct, const QString &chat, const QDateTime &time_from, const QDateTime &time_to);
+    /// Up to limit messages right before the cursor, oldest first
+    QList<HistMessage> getChatHistoryBefore(ChatType ct, const QString &chat, const HistCursor &cursor, int limit);
+    /// Up to limit of the newest messages, oldest first, from memory for recently active chats
+    QList<HistMessage> getRecentChatHistory(ChatType ct, const QString &chat, int limit);
+    /// Up to limit messages right after the cursor, oldest first
+    QList<HistMessage> getChatHistoryAfter(ChatType ct, const QString &chat, const HistCursor &cursor, int limit);
+    /// Newest first, every word of text has to match; the index of old logs is built in the background
+    QList<SearchResult> search(const QString &text, int limit);
+    int getChatMessageCount(ChatType ct, const QString &chat);
+    void flush(); ///< Blocks until every queued entry is committed to the disk
+    void setCompressMessages(bool compress); ///< For the messages written from now on
+    void setRetention(const RetentionRule &rule); ///< The global rule, applied in the background
+    /// A rule for this chat only, hasRule false goes back to the global one
+    void setChatRetention(ChatType ct, const QString &chat, bool hasRule, const RetentionRule &rule);
+    bool getChatRetention(ChatType ct, const QString &chat, RetentionRule &rule); ///< False if the chat follows the global rule
+    /// False for a file made before incremental vacuum: space freed by retention is only reused, see tools/historyrecompress
+    bool canShrinkFile();
+
+    int getQueueDepth();
+    qint64 getLastCommitLatency();
+
+    /// Exports read from their own thread, they're cancelled and waited for before the history is closed
+    void registerExporter(HistoryExporter* exporter);
+    void unregisterExporter(HistoryExporter* exporter); ///< Thread safe, once the export doesn't use the history anymore
 
 private:
-    HistoryKeeper(GenericDdInterface *db_);
+    HistoryKeeper(const QString &path, bool encrypted);
     HistoryKeeper(HistoryKeeper &hk) = delete;
     HistoryKeeper& operator=(const HistoryKeeper&) = delete;
 
-    void updateChatsID();
-    void updateAliases();
-    QPair<int, ChatType> getChatID(const QString &id_str, ChatType ct);
-    int getAliasID(const QString &id_str);
-    QString wrapMessage(const QString &str);
-    QString unWrapMessage(const QString &str);
-
-    ChatType convertToChatType(int);
+    static void setupEncryption(); ///< The history is encrypted with the profile's history key
+    static QByteArray encryptHistory(const QByteArray &data, const QByteArray &key);
+    static QByteArray decryptHistory(const QByteArray &data, const QByteArray &key);
 
-    GenericDdInterface *db;
-    QMap<QString, int> aliases;
-    QMap<QString, QPair<int, ChatType>> chats;
-    bool isEncrypted;
+    QThread *writerThread;
+    HistoryWriter *writer;
+    HistoryCache *cache;
+    QMutex exportMutex;
+    QWaitCondition exportsDone;
+    QList<HistoryExporter*> exporters;
 };
 
 #endif // HISTORYKEEPER_H
@@ -0,0 +1,1082 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+#include "historywriter.h"
+#include "misc/db/plaindb.h"
+#include "misc/db/encrypteddb.h"
+#include "historycache.h"
+#include "misc/db/messagecodec.h"
+
+#include <QSqlQuery>
+#include <QSqlRecord>
+#include <QSqlError>
+#include <QStringList>
+#include <QRegExp>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QVector>
+#include <QFileInfo>
+#include <QDebug>
+#include <algorithm>
+#include <limits>
+
+// The hot queries, they must be served by the history_chat_timestamp index, see checkQueryPlans()
+static const char* const historyRangeQuery =
+        "SELECT history.id, timestamp, user_id, message, flags FROM history INNER JOIN aliases ON history.sender = aliases.id "
+        "AND timestamp BETWEEN ? AND ? AND chat_id = ? ORDER BY timestamp, history.id;";
+static const char* const historyOlderQuery =
+        "SELECT history.id, timestamp, user_id, message, flags FROM history INNER JOIN aliases ON history.sender = aliases.id "
+        "WHERE chat_id = ? AND (timestamp < ? OR (timestamp = ? AND history.id < ?)) "
+        "ORDER BY timestamp DESC, history.id DESC LIMIT ?;";
+static const char* const historyNewerQuery =
+        "SELECT history.id, timestamp, user_id, message, flags FROM history INNER JOIN aliases ON history.sender = aliases.id "
+        "WHERE chat_id = ? AND (timestamp > ? OR (timestamp = ? AND history.id > ?)) "
+        "ORDER BY timestamp ASC, history.id ASC LIMIT ?;";
+
+static const char* const historyFtsInsert = "INSERT INTO history_fts (docid, message) VALUES (?, ?);";
+
+HistoryWriter::HistoryWriter(const QString &path, bool encrypted, HistoryCache *cache)
+    : path(path)
+    , encrypted(encrypted)
+    , db(nullptr)
+    , cache(cache)
+    , commitTimer(nullptr)
+    , backfillTimer(nullptr)
+    , retentionTimer(nullptr)
+    , recompressTimer(nullptr)
+    , retentionPhase(rpIdle)
+    , retentionDeleted(0)
+    , retentionSizeBefore(0)
+    , retentionWork(0)
+    , recompressTo(false)
+    , recompressCompacting(false)
+    , recompressLastId(0)
+    , recompressDone(0)
+    , recompressTotal(0)
+    , recompressChanged(0)
+    , compressMessages(0)
+    , incrementalVacuum(0)
+    , committing(0)
+    , maxQueueDepth(0)
+    , lastCommitLatency(0)
+    , maxCommitLatency(0)
+    , commitCount(0)
+    , committedEntries(0)
+    , retention{0, 0}
+    , lastReclaimedBytes(0)
+    , lastRetentionTime(0)
+{
+    qRegisterMetaType<QList<HistoryKeeper::HistMessage>>("QList<HistoryKeeper::HistMessage>");
+    qRegisterMetaType<QList<HistoryKeeper::SearchResult>>("QList<HistoryKeeper::SearchResult>");
+    qRegisterMetaType<HistoryKeeper::RetentionRule>("HistoryKeeper::RetentionRule");
+}
+
+QList<QString> HistoryWriter::schema()
+{
+    QList<QString> initLst;
+    // Before the first table, so that a new file can give pages back a few at a time; an existing one only
+    // switches on its next VACUUM, which tools/historyrecompress runs
+    initLst.push_back(QString("PRAGMA auto_vacuum = INCREMENTAL;"));
+    initLst.push_back(QString("CREATE TABLE IF NOT EXISTS history (id INTEGER PRIMARY KEY AUTOINCREMENT, timestamp INTEGER NOT NULL, ") +
+                      QString("chat_id INTEGER NOT NULL, sender INTEGER NOT NULL, message TEXT NOT NULL);"));
+    initLst.push_back(QString("CREATE TABLE IF NOT EXISTS aliases (id INTEGER PRIMARY KEY AUTOINCREMENT, user_id TEXT UNIQUE NOT NULL);"));
+    initLst.push_back(QString("CREATE TABLE IF NOT EXISTS chats (id INTEGER PRIMARY KEY AUTOINCREMENT, name TEXT UNIQUE NOT NULL, ctype INTEGER NOT NULL);"));
+    initLst.push_back(QString("CREATE TABLE IF NOT EXISTS schema_version (version INTEGER NOT NULL);"));
+
+    return initLst;
+}
+
+QList<QList<QString>> HistoryWriter::schemaMigrations()
+{
+    // Schema changes go here, never edit a step that already shipped, append a new one
+    QList<QList<QString>> migrations;
+    migrations.push_back({QString("CREATE INDEX IF NOT EXISTS history_chat_timestamp ON history (chat_id, timestamp);")});
+    migrations.push_back({QString("CREATE VIRTUAL TABLE IF NOT EXISTS history_fts USING fts4(content=\"\", message);"),
+                          QString("CREATE TABLE IF NOT EXISTS history_fts_backfill (next_id INTEGER NOT NULL, end_id INTEGER NOT NULL);"),
+                          QString("INSERT INTO history_fts_backfill SELECT 0, IFNULL(MAX(id), 0) FROM history;")});
+    migrations.push_back({QString("ALTER TABLE history ADD COLUMN flags INTEGER NOT NULL DEFAULT 0;")});
+    migrations.push_back({QString("CREATE TABLE IF NOT EXISTS retention (chat_id INTEGER PRIMARY KEY, max_age INTEGER NOT NULL, "
+                                  "max_messages INTEGER NOT NULL);")});
+    migrations.push_back({QString("DROP TABLE IF EXISTS history_fts;"),
+                          QString("CREATE VIRTUAL TABLE history_fts USING fts4(content=\"history\", message);"),
+                          QString("DELETE FROM history_fts_backfill;"),
+                          QString("INSERT INTO history_fts_backfill SELECT 0, IFNULL(MAX(id), 0) FROM history;"),
+                          QString("CREATE TRIGGER IF NOT EXISTS history_fts_delete BEFORE DELETE ON history "
+                                  "WHEN NOT EXISTS (SELECT 1 FROM history_fts_backfill WHERE old.id > next_id AND old.id <= end_id) "
+                                  "BEGIN DELETE FROM history_fts WHERE docid = old.id; END;")});
+
+    return migrations;
+}
+
+void HistoryWriter::enqueue(const Entry &entry)
+{
+    QMutexLocker locker(&mutex);
+
+    queue.enqueue(entry);
+    maxQueueDepth = qMax(maxQueueDepth, queue.size());
+
+    // Only the first entry of a batch and full batches need to wake up the writer
+    if (queue.size() == 1 || queue.size() >= HISTORY_COMMIT_BATCH)
+        QMetaObject::invokeMethod(this, "onEntryQueued");
+}
+
+void HistoryWriter::open()
+{
+    QMetaObject::invokeMethod(this, "_open", Qt::BlockingQueuedConnection);
+}
+
+void HistoryWriter::close()
+{
+    QMetaObject::invokeMethod(this, "_close", Qt::BlockingQueuedConnection);
+}
+
+void HistoryWriter::flush()
+{
+    QMetaObject::invokeMethod(this, "_flush", Qt::BlockingQueuedConnection);
+}
+
+QList<HistoryKeeper::HistMessage> HistoryWriter::getChatHistory(HistoryKeeper::ChatType ct, const QString &chat,
+                                                                const QDateTime &from, const QDateTime &to)
+{
+    QList<HistoryKeeper::HistMessage> ret;
+    QMetaObject::invokeMethod(this, "_getChatHistory", Qt::BlockingQueuedConnection,
+                              Q_RETURN_ARG(QList<HistoryKeeper::HistMessage>, ret),
+                              Q_ARG(int, ct), Q_ARG(QString, chat), Q_ARG(QDateTime, from), Q_ARG(QDateTime, to));
+
+    return ret;
+}
+
+QList<HistoryKeeper::HistMessage> HistoryWriter::getChatHistoryPage(HistoryKeeper::ChatType ct, const QString &chat,
+                                                                    const QDateTime &timestamp, qint64 id, int limit, bool older)
+{
+    QList<HistoryKeeper::HistMessage> ret;
+    QMetaObject::invokeMethod(this, "_getChatHistoryPage", Qt::BlockingQueuedConnection,
+                              Q_RETURN_ARG(QList<HistoryKeeper::HistMessage>, ret),
+                              Q_ARG(int, ct), Q_ARG(QString, chat), Q_ARG(QDateTime, timestamp),
+                              Q_ARG(qint64, id), Q_ARG(int, limit), Q_ARG(bool, older));
+
+    return ret;
+}
+
+QList<HistoryKeeper::SearchResult> HistoryWriter::search(const QString &text, int limit)
+{
+    QList<HistoryKeeper::SearchResult> ret;
+    QMetaObject::invokeMethod(this, "_search", Qt::BlockingQueuedConnection,
+                              Q_RETURN_ARG(QList<HistoryKeeper::SearchResult>, ret),
+                              Q_ARG(QString, text), Q_ARG(int, limit));
+
+    return ret;
+}
+
+int HistoryWriter::getChatMessageCount(HistoryKeeper::ChatType ct, const QString &chat)
+{
+    int ret = 0;
+    QMetaObject::invokeMethod(this, "_getChatMessageCount", Qt::BlockingQueuedConnection,
+                              Q_RETURN_ARG(int, ret), Q_ARG(int, ct), Q_ARG(QString, chat));
+
+    return ret;
+}
+
+int HistoryWriter::getQueueDepth()
+{
+    QMutexLocker locker(&mutex);
+    return queue.size();
+}
+
+void HistoryWriter::startRecompress(bool compress)
+{
+    QMetaObject::invokeMethod(this, "_startRecompress", Qt::QueuedConnection, Q_ARG(bool, compress));
+}
+
+void HistoryWriter::vacuum()
+{
+    QMetaObject::invokeMethod(this, "_vacuum", Qt::BlockingQueuedConnection);
+}
+
+void HistoryWriter::setCompressMessages(bool compress)
+{
+    compressMessages.store(compress);
+}
+
+void HistoryWriter::setRetention(const HistoryKeeper::RetentionRule &rule)
+{
+    QMutexLocker locker(&mutex);
+    retention = rule;
+}
+
+void HistoryWriter::setChatRetention(HistoryKeeper::ChatType ct, const QString &chat, bool hasRule,
+                                     const HistoryKeeper::RetentionRule &rule)
+{
+    QMetaObject::invokeMethod(this, "_setChatRetention", Qt::BlockingQueuedConnection,
+                              Q_ARG(int, ct), Q_ARG(QString, chat), Q_ARG(bool, hasRule),
+                              Q_ARG(HistoryKeeper::RetentionRule, rule));
+}
+
+bool HistoryWriter::getChatRetention(HistoryKeeper::ChatType ct, const QString &chat, HistoryKeeper::RetentionRule &rule)
+{
+    HistoryKeeper::RetentionRule ret{-1, -1};
+    QMetaObject::invokeMethod(this, "_getChatRetention", Qt::BlockingQueuedConnection,
+                              Q_RETURN_ARG(HistoryKeeper::RetentionRule, ret), Q_ARG(int, ct), Q_ARG(QString, chat));
+    if (ret.maxAgeDays < 0)
+        return false;
+
+    rule = ret;
+    return true;
+}
+
+int HistoryWriter::getPendingCount()
+{
+    QMutexLocker locker(&mutex);
+    return queue.size() + committing;
+}
+
+int HistoryWriter::getMaxQueueDepth()
+{
+    QMutexLocker locker(&mutex);
+    return maxQueueDepth;
+}
+
+qint64 HistoryWriter::getLastCommitLatency()
+{
+    QMutexLocker locker(&mutex);
+    return lastCommitLatency;
+}
+
+qint64 HistoryWriter::getMaxCommitLatency()
+{
+    QMutexLocker locker(&mutex);
+    return maxCommitLatency;
+}
+
+qint64 HistoryWriter::getLastReclaimedBytes()
+{
+    QMutexLocker locker(&mutex);
+    return lastReclaimedBytes;
+}
+
+qint64 HistoryWriter::getLastRetentionTime()
+{
+    QMutexLocker locker(&mutex);
+    return lastRetentionTime;
+}
+
+bool HistoryWriter::canShrinkFile()
+{
+    return incrementalVacuum.load();
+}
+
+void HistoryWriter::_open()
+{
+    /*
+     DB format
+     chats:
+      * name -> id map
+       id      -- auto-incrementing number
+       name    -- chat's name (for user to user conversation it is opposite user public key, for group chats the group's key)
+       ctype   -- chat type, see HistoryKeeper::ChatType
+
+     alisases:
+      * user_id -> id map
+       id      -- auto-incrementing number
+       name    -- user's public key, in group chats followed by a space and the peer's name
+
+     history:
+       id           -- auto-incrementing number
+       timestamp
+       chat_id      -- current chat ID (resolves from chats table)
+       sender       -- sender's ID (resolves from aliases table)
+       message      -- text, or a blob when compressed
+       flags        -- how the message is stored, see MessageCodec::Flags
+
+     history_fts:
+      * full text index of history.message, docid is history.id; rows are added with the decoded text, the content
+        table is only read by the history_fts_delete trigger, so a compressed message is stored plain before it's deleted
+     history_fts_backfill:
+      * range of history ids still to be indexed, the row is gone once they all are
+
+     retention:
+      * chat_id -> what is kept of that chat, overrides the global rule
+       max_age      -- in days, 0 for no limit
+       max_messages -- 0 for no limit
+    */
+
+    if (encrypted)
+        db = new EncryptedDb(path, schema());
+    else
+        db = new PlainDb(path, schema());
+
+    commitTimer = new QTimer(this);
+    commitTimer->setSingleShot(true);
+    connect(commitTimer, &QTimer::timeout, this, &HistoryWriter::commitPending);
+
+    db->migrate(schemaMigrations());
+    checkQueryPlans();
+    updateVacuumMode();
+
+    backfillTimer = new QTimer(this);
+    backfillTimer->setInterval(HISTORY_FTS_INTERVAL);
+    connect(backfillTimer, &QTimer::timeout, this, &HistoryWriter::backfillSearchIndex);
+    backfillTimer->start();
+
+    retentionTimer = new QTimer(this);
+    retentionTimer->setSingleShot(true);
+    connect(retentionTimer, &QTimer::timeout, this, &HistoryWriter::retentionStep);
+    retentionTimer->start(HISTORY_RETENTION_DELAY);
+
+    recompressTimer = new QTimer(this);
+    recompressTimer->setSingleShot(true);
+    connect(recompressTimer, &QTimer::timeout, this, &HistoryWriter::recompressStep);
+
+    updateChatsID();
+    updateAliases();
+
+    // after _open() returns, so that the caller isn't kept waiting
+    if (cache)
+        QMetaObject::invokeMethod(this, "preloadCache", Qt::QueuedConnection);
+}
+
+void HistoryWriter::checkQueryPlans()
+{
+    // A query that scans history or sorts in a temp b-tree gets slower with every message ever logged
+    for (const char* query : {historyRangeQuery, historyOlderQuery, historyNewerQuery})
+    {
+        int args = QString(query).count('?');
+        QVariantList dummyArgs;
+        for (int i = 0; i < args; i++)
+            dummyArgs << 0;
+
+        QSqlQuery plan = db->exec(QString("EXPLAIN QUERY PLAN ") + query, dummyArgs);
+
+        bool usesIndex = false, sorts = false;
+        QStringList details;
+        while (plan.next())
+        {
+            QString detail = plan.value(plan.record().count() - 1).toString();
+            usesIndex |= detail.contains("history_chat_timestamp");
+            sorts |= detail.contains("TEMP B-TREE");
+            details << detail;
+        }
+
+        if (!usesIndex || sorts)
+            qWarning() << "HistoryWriter: history query doesn't use its index:" << details;
+    }
+}
+
+void HistoryWriter::_close()
+{
+    commitPending();
+
+    delete commitTimer;
+    commitTimer = nullptr;
+    delete backfillTimer;
+    backfillTimer = nullptr;
+    delete retentionTimer;
+    retentionTimer = nullptr;
+    if (recompressTimer && recompressTimer->isActive())
+    {
+        qWarning() << "HistoryWriter: closed before the end of the recompression";
+        emit recompressFinished(recompressChanged);
+    }
+    delete recompressTimer;
+    recompressTimer = nullptr;
+    delete db;
+    db = nullptr;
+
+    QMutexLocker locker(&mutex);
+    qDebug() << "HistoryWriter: closed after" << commitCount << "commits of" << committedEntries
+             << "entries, max queue depth" << maxQueueDepth << ", max commit latency" << maxCommitLatency << "ms";
+}
+
+void HistoryWriter::_flush()
+{
+    commitPending();
+}
+
+void HistoryWriter::onEntryQueued()
+{
+    if (!commitTimer)
+        return;
+
+    if (getQueueDepth() >= HISTORY_COMMIT_BATCH)
+        commitPending();
+    else if (!commitTimer->isActive())
+        commitTimer->start(HISTORY_COMMIT_INTERVAL);
+}
+
+void HistoryWriter::commitPending()
+{
+    if (commitTimer)
+        commitTimer->stop();
+
+    QQueue<Entry> batch;
+    {
+        QMutexLocker locker(&mutex);
+        batch.swap(queue);
+        committing = batch.size();
+    }
+
+    if (batch.isEmpty() || !db)
+    {
+        QMutexLocker locker(&mutex);
+        committing = 0;
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QVector<qint64> ids(batch.size(), -1);
+    db->transaction();
+    for (int i = 0; i < batch.size();)
+    {
+        // full statements for the bulk of a busy batch, single rows for the rest, so that only two are ever prepared
+        int rows = (batch.size() - i >= HISTORY_INSERT_ROWS) ? HISTORY_INSERT_ROWS : 1;
+        qint64 firstId = insertEntries(batch.mid(i, rows));
+        for (int j = 0; j < rows && firstId >= 0; j++)
+            ids[i + j] = firstId + j;
+        i += rows;
+    }
+    bool committed = db->commit();
+
+    // with their ids, so that the cached pages can be scrolled up from
+    if (cache && committed)
+    {
+        for (int i = 0; i < batch.size(); i++)
+        {
+            const Entry& entry = batch[i];
+            if (ids[i] >= 0)
+                cache->append(entry.ct, entry.chat, {ids[i], entry.sender, entry.message, entry.timestamp});
+        }
+    }
+
+    qint64 latency = timer.elapsed();
+    if (latency >= HISTORY_SLOW_COMMIT)
+        qWarning() << "HistoryWriter: committing" << batch.size() << "entries took" << latency << "ms";
+
+    QMutexLocker locker(&mutex);
+    committing = 0;
+    lastCommitLatency = latency;
+    maxCommitLatency = qMax(maxCommitLatency, latency);
+    commitCount++;
+    committedEntries += batch.size();
+}
+
+qint64 HistoryWriter::insertEntries(const QList<Entry> &entries)
+{
+    bool compress = compressMessages.load();
+
+    QVariantList args;
+    for (const Entry& entry : entries)
+    {
+        int chat_id = getChatID(entry.chat, entry.ct).first;
+        int sender_id = getAliasID(entry.sender);
+
+        int flags;
+        QVariant body = MessageCodec::encode(entry.message, compress, flags);
+        args << entry.timestamp.toMSecsSinceEpoch() << chat_id << sender_id << body << flags;
+    }
+
+    QSqlQuery dbAnswer = db->exec(multiRowQuery("INSERT INTO history (timestamp, chat_id, sender, message, flags) VALUES ",
+                                                "(?, ?, ?, ?, ?)", entries.size()), args);
+    QVariant lastId = dbAnswer.lastInsertId();
+    if (!lastId.isValid())
+        return -1;
+
+    // AUTOINCREMENT hands out consecutive ids to the rows of one statement, the last one gives them all
+    qint64 firstId = lastId.toLongLong() - entries.size() + 1;
+    QVariantList ftsArgs;
+    for (int i = 0; i < entries.size(); i++)
+        ftsArgs << firstId + i << entries[i].message;
+
+    db->exec(multiRowQuery("INSERT INTO history_fts (docid, message) VALUES ", "(?, ?)", entries.size()), ftsArgs);
+
+    return firstId;
+}
+
+QString HistoryWriter::multiRowQuery(const QString &head, const QString &row, int rows)
+{
+    QStringList values;
+    for (int i = 0; i < rows; i++)
+        values << row;
+
+    return head + values.join(", ") + ";";
+}
+
+QList<HistoryKeeper::HistMessage> HistoryWriter::_getChatHistory(int ct, const QString &chat,
+                                                                 const QDateTime &from, const QDateTime &to)
+{
+    QList<HistoryKeeper::HistMessage> res;
+    if (!db)
+        return res;
+
+    commitPending(); // the queued entries must be visible to the query
+
+    HistoryKeeper::ChatType chatType = convertToChatType(ct);
+    int chat_id = getChatID(chat, chatType).first;
+
+    QSqlQuery dbAnswer = db->exec(historyRangeQuery, {from.toMSecsSinceEpoch(), to.toMSecsSinceEpoch(), chat_id});
+    res = readMessages(dbAnswer);
+
+    return res;
+}
+
+QList<HistoryKeeper::HistMessage> HistoryWriter::_getChatHistoryPage(int ct, const QString &chat, const QDateTime &timestamp,
+                                                                     qint64 id, int limit, bool older)
+{
+    QList<HistoryKeeper::HistMessage> res;
+    if (!db)
+        return res;
+
+    commitPending();
+
+    HistoryKeeper::ChatType chatType = convertToChatType(ct);
+    int chat_id = getChatID(chat, chatType).first;
+    qint64 time64 = timestamp.toMSecsSinceEpoch();
+
+    QSqlQuery dbAnswer;
+    if (older)
+    {
+        // walk backwards from the cursor, so that only the page itself is read
+        dbAnswer = db->exec(historyOlderQuery, {chat_id, time64, time64, id, limit});
+        res = readMessages(dbAnswer);
+        std::reverse(res.begin(), res.end());
+    } else {
+        dbAnswer = db->exec(historyNewerQuery, {chat_id, time64, time64, id, limit});
+        res = readMessages(dbAnswer);
+    }
+
+    return res;
+}
+
+QList<HistoryKeeper::SearchResult> HistoryWriter::_search(const QString &text, int limit)
+{
+    QList<HistoryKeeper::SearchResult> res;
+    if (!db)
+        return res;
+
+    commitPending();
+
+    // every word is a quoted phrase, so that nothing the user types is taken for FTS syntax
+    QStringList terms;
+    for (QString term : text.split(QRegExp("\\s+"), QString::SkipEmptyParts))
+    {
+        term.remove('"');
+        if (!term.isEmpty())
+            terms << "\"" + term + "\"";
+    }
+    if (terms.isEmpty())
+        return res;
+
+    QSqlQuery dbAnswer = db->exec("SELECT history.id, timestamp, user_id, message, chats.name, chats.ctype, flags FROM history_fts "
+                                  "INNER JOIN history ON history.id = history_fts.docid "
+                                  "INNER JOIN aliases ON history.sender = aliases.id "
+                                  "INNER JOIN chats ON history.chat_id = chats.id "
+                                  "WHERE history_fts MATCH ? ORDER BY history_fts.docid DESC LIMIT ?;",
+                                  {terms.join(' '), limit});
+
+    while (dbAnswer.next())
+    {
+        HistoryKeeper::HistMessage msg{dbAnswer.value(0).toLongLong(), dbAnswer.value(2).toString(),
+                                       MessageCodec::decode(dbAnswer.value(3), dbAnswer.value(6).toInt()),
+                                       QDateTime::fromMSecsSinceEpoch(dbAnswer.value(1).toLongLong())};
+        res.push_back({convertToChatType(dbAnswer.value(5).toInt()), dbAnswer.value(4).toString(), msg});
+    }
+
+    return res;
+}
+
+int HistoryWriter::_getChatMessageCount(int ct, const QString &chat)
+{
+    if (!db)
+        return 0;
+
+    commitPending();
+
+    int chat_id = getChatID(chat, convertToChatType(ct)).first;
+    QSqlQuery dbAnswer = db->exec("SELECT COUNT(*) FROM history WHERE chat_id = ?;", {chat_id});
+    if (!dbAnswer.next())
+        return 0;
+
+    return dbAnswer.value(0).toInt();
+}
+
+void HistoryWriter::_startRecompress(bool compress)
+{
+    if (!db)
+    {
+        emit recompressFinished(0);
+        return;
+    }
+    if (recompressTimer->isActive())
+    {
+        qWarning() << "HistoryWriter: a recompression is already running";
+        return;
+    }
+
+    commitPending();
+
+    QSqlQuery count = db->exec(QString("SELECT COUNT(*) FROM history;"));
+    recompressTotal = count.next() ? count.value(0).toInt() : 0;
+    count.finish();
+
+    recompressTo = compress;
+    recompressCompacting = false;
+    recompressLastId = 0;
+    recompressDone = 0;
+    recompressChanged = 0;
+    recompressTimer->start(0);
+}
+
+void HistoryWriter::recompressStep()
+{
+    if (!db)
+        return;
+
+    // A batch per step like the retention task, reads and commits are served in between
+    if (!recompressCompacting)
+    {
+        commitPending();
+
+        QSqlQuery rows = db->exec("SELECT id, message, flags FROM history WHERE id > ? ORDER BY id LIMIT ?;",
+                                  {recompressLastId, HISTORY_RECOMPRESS_BATCH});
+
+        QList<QPair<qint64, QString>> pending;
+        int count = 0;
+        while (rows.next())
+        {
+            recompressLastId = rows.value(0).toLongLong();
+            int flags = rows.value(2).toInt();
+            if (recompressTo != static_cast<bool>(flags & MessageCodec::fDeflate))
+                pending.append({recompressLastId, MessageCodec::decode(rows.value(1), flags)});
+            count++;
+        }
+        rows.finish();
+
+        db->transaction();
+        for (const QPair<qint64, QString>& row : pending)
+        {
+            int flags;
+            QVariant body = MessageCodec::encode(row.second, recompressTo, flags);
+            db->exec("UPDATE history SET message = ?, flags = ? WHERE id = ?;", {body, flags, row.first});
+        }
+        db->commit();
+
+        recompressChanged += pending.size();
+        recompressDone = qMin(recompressDone + count, recompressTotal);
+        emit recompressProgress(recompressDone, recompressTotal);
+
+        if (count == HISTORY_RECOMPRESS_BATCH)
+        {
+            recompressTimer->start(HISTORY_RECOMPRESS_STEP);
+            return;
+        }
+
+        recompressCompacting = true;
+    }
+
+    // gives the freed pages back to the file system, a few at a time
+    if (compactStep())
+    {
+        recompressTimer->start(HISTORY_RECOMPRESS_STEP);
+        return;
+    }
+    db->exec(QString("PRAGMA wal_checkpoint(TRUNCATE);"));
+
+    qDebug() << "HistoryWriter: recompressed" << recompressChanged << "messages";
+    emit recompressFinished(recompressChanged);
+}
+
+void HistoryWriter::_vacuum()
+{
+    if (!db)
+        return;
+
+    commitPending();
+    db->finishQueries();
+    db->exec(QString("VACUUM;"));
+    updateVacuumMode();
+}
+
+void HistoryWriter::_setChatRetention(int ct, const QString &chat, bool hasRule, const HistoryKeeper::RetentionRule &rule)
+{
+    if (!db)
+        return;
+
+    int chat_id = getChatID(chat, convertToChatType(ct)).first;
+    if (hasRule)
+        db->exec("INSERT OR REPLACE INTO retention (chat_id, max_age, max_messages) VALUES (?, ?, ?);",
+                 {chat_id, rule.maxAgeDays, rule.maxMessages});
+    else
+        db->exec("DELETE FROM retention WHERE chat_id = ?;", {chat_id});
+}
+
+HistoryKeeper::RetentionRule HistoryWriter::_getChatRetention(int ct, const QString &chat)
+{
+    HistoryKeeper::RetentionRule rule{-1, -1};
+    if (!db)
+        return rule;
+
+    int chat_id = getChatID(chat, convertToChatType(ct)).first;
+    QSqlQuery dbAnswer = db->exec("SELECT max_age, max_messages FROM retention WHERE chat_id = ?;", {chat_id});
+    if (dbAnswer.next())
+        rule = {dbAnswer.value(0).toInt(), dbAnswer.value(1).toInt()};
+    dbAnswer.finish();
+
+    return rule;
+}
+
+void HistoryWriter::retentionStep()
+{
+    if (!db)
+        return;
+
+    // Runs in short steps between the other work of the thread, so that a big cleanup never keeps a caller waiting long
+    QElapsedTimer timer;
+    timer.start();
+
+    if (retentionPhase == rpIdle)
+    {
+        if (!hasRetentionRules())
+        {
+            retentionTimer->start(HISTORY_RETENTION_INTERVAL);
+            return;
+        }
+        retentionPhase = rpDelete;
+        retentionDeleted = 0;
+        retentionWork = 0;
+        retentionSizeBefore = getFileSize();
+    }
+
+    bool done = false;
+    if (retentionPhase == rpDelete)
+    {
+        commitPending();
+
+        db->transaction();
+        int deleted = deleteExpired(HISTORY_RETENTION_BATCH);
+        db->commit();
+        retentionDeleted += deleted;
+
+        if (deleted < HISTORY_RETENTION_BATCH)
+        {
+            // nothing to give back if nothing was deleted
+            if (retentionDeleted > 0)
+            {
+                if (cache)
+                    cache->clear();
+                retentionPhase = rpCompact;
+            }
+            else
+            {
+                done = true;
+            }
+        }
+    } else if (!compactStep()) {
+        db->exec(QString("PRAGMA wal_checkpoint(TRUNCATE);")); // the encrypted journal only shrinks there
+        done = true;
+    }
+
+    retentionWork += timer.elapsed();
+    if (!done)
+    {
+        retentionTimer->start(HISTORY_RETENTION_STEP);
+        return;
+    }
+
+    qint64 reclaimed = retentionSizeBefore - getFileSize();
+    qDebug() << "HistoryWriter: retention deleted" << retentionDeleted << "messages, reclaimed" << reclaimed
+             << "bytes in" << retentionWork << "ms";
+
+    retentionPhase = rpIdle;
+    retentionTimer->start(HISTORY_RETENTION_INTERVAL);
+
+    QMutexLocker locker(&mutex);
+    lastReclaimedBytes = reclaimed;
+    lastRetentionTime = retentionWork;
+}
+
+bool HistoryWriter::hasRetentionRules()
+{
+    {
+        QMutexLocker locker(&mutex);
+        if (retention.maxAgeDays > 0 || retention.maxMessages > 0)
+            return true;
+    }
+
+    QSqlQuery dbAnswer = db->exec(QString("SELECT 1 FROM retention WHERE max_age > 0 OR max_messages > 0 LIMIT 1;"));
+    bool found = dbAnswer.next();
+    dbAnswer.finish();
+
+    return found;
+}
+
+int HistoryWriter::deleteExpired(int limit)
+{
+    HistoryKeeper::RetentionRule global;
+    {
+        QMutexLocker locker(&mutex);
+        global = retention;
+    }
+
+    QMap<int, HistoryKeeper::RetentionRule> rules;
+    QSqlQuery ruleRows = db->exec(QString("SELECT chat_id, max_age, max_messages FROM retention;"));
+    while (ruleRows.next())
+        rules[ruleRows.value(0).toInt()] = {ruleRows.value(1).toInt(), ruleRows.value(2).toInt()};
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    int deleted = 0;
+    for (auto it = chats.begin(); it != chats.end() && deleted < limit; ++it)
+    {
+        int chat_id = it.value().first;
+        HistoryKeeper::RetentionRule rule = rules.value(chat_id, global);
+
+        if (rule.maxAgeDays > 0)
+        {
+            qint64 cutoff = now - static_cast<qint64>(rule.maxAgeDays) * 24 * 60 * 60 * 1000;
+            deleted += deleteMessages("chat_id = ? AND timestamp < ?", {chat_id, cutoff}, limit - deleted);
+        }
+
+        if (rule.maxMessages > 0 && deleted < limit)
+        {
+            // the oldest message that is kept, everything before it goes
+            QSqlQuery oldestKept = db->exec("SELECT timestamp, id FROM history WHERE chat_id = ? "
+                                            "ORDER BY timestamp DESC, id DESC LIMIT 1 OFFSET ?;",
+                                            {chat_id, rule.maxMessages - 1});
+            if (!oldestKept.next())
+                continue;
+
+            qint64 time64 = oldestKept.value(0).toLongLong();
+            qint64 id = oldestKept.value(1).toLongLong();
+            oldestKept.finish();
+
+            deleted += deleteMessages("chat_id = ? AND (timestamp < ? OR (timestamp = ? AND id < ?))",
+                                      {chat_id, time64, time64, id}, limit - deleted);
+        }
+    }
+
+    return deleted;
+}
+
+int HistoryWriter::deleteMessages(const QString &condition, QVariantList args, int limit)
+{
+    QSqlQuery rows = db->exec("SELECT id, message, flags FROM history WHERE " + condition + " LIMIT ?;", args << limit);
+
+    QList<qint64> ids;
+    QList<QPair<qint64, QString>> compressed;
+    while (rows.next())
+    {
+        qint64 id = rows.value(0).toLongLong();
+        int flags = rows.value(2).toInt();
+        ids.append(id);
+        if (flags & MessageCodec::fDeflate)
+            compressed.append({id, MessageCodec::decode(rows.value(1), flags)});
+    }
+    rows.finish();
+
+    // the delete trigger takes the words to drop from the search index out of the row itself
+    for (const QPair<qint64, QString>& row : compressed)
+    {
+        int flags;
+        QVariant body = MessageCodec::encode(row.second, false, flags);
+        db->exec("UPDATE history SET message = ?, flags = ? WHERE id = ?;", {body, flags, row.first});
+    }
+    for (qint64 id : ids)
+        db->exec("DELETE FROM history WHERE id = ?;", {id});
+
+    return ids.size();
+}
+
+void HistoryWriter::updateVacuumMode()
+{
+    QSqlQuery mode = db->exec(QString("PRAGMA auto_vacuum;"));
+    bool incremental = mode.next() && mode.value(0).toInt() == 2;
+    mode.finish();
+
+    if (!incremental)
+        qDebug() << "HistoryWriter: the history file predates incremental vacuum, it won't shrink after retention";
+    incrementalVacuum.store(incremental);
+}
+
+bool HistoryWriter::compactStep()
+{
+    // Only an incremental database can give pages back a few at a time, a full VACUUM would rewrite the whole file
+    // while the GUI waits on this thread; the freed pages of an older one are reused by the next messages instead
+    if (!incrementalVacuum.load())
+        return false;
+
+    QSqlQuery freePages = db->exec(QString("PRAGMA freelist_count;"));
+    if (!freePages.next() || freePages.value(0).toInt() == 0)
+        return false;
+
+    // every row of the answer is a page given back
+    QSqlQuery vacuum = db->exec(QString("PRAGMA incremental_vacuum(%1);").arg(HISTORY_VACUUM_PAGES));
+    while (vacuum.next())
+        ;
+
+    return true;
+}
+
+qint64 HistoryWriter::getFileSize()
+{
+    return QFileInfo(path).size() + QFileInfo(path + "-wal").size();
+}
+
+void HistoryWriter::backfillSearchIndex()
+{
+    QSqlQuery state = db->exec(QString("SELECT next_id, end_id FROM history_fts_backfill;"));
+    if (!state.next())
+    {
+        backfillTimer->stop();
+        return;
+    }
+
+    qint64 nextId = state.value(0).toLongLong();
+    qint64 endId = state.value(1).toLongLong();
+
+    db->transaction();
+    QSqlQuery rows = db->exec("SELECT id, message, flags FROM history WHERE id > ? AND id <= ? ORDER BY id LIMIT ?;",
+                              {nextId, endId, HISTORY_FTS_BATCH});
+    int count = 0;
+    while (rows.next())
+    {
+        nextId = rows.value(0).toLongLong();
+        db->exec(historyFtsInsert, {nextId, MessageCodec::decode(rows.value(1), rows.value(2).toInt())});
+        count++;
+    }
+
+    if (count < HISTORY_FTS_BATCH)
+    {
+        db->exec(QString("DELETE FROM history_fts_backfill;"));
+        backfillTimer->stop();
+        qDebug() << "HistoryWriter: search index is complete";
+    } else {
+        db->exec("UPDATE history_fts_backfill SET next_id = ?;", {nextId});
+    }
+    db->commit();
+}
+
+void HistoryWriter::preloadCache()
+{
+    if (!db)
+        return;
+
+    commitPending();
+
+    // the time of the newest message of each chat is one index lookup, there are few chats
+    QList<QPair<qint64, QString>> recent;
+    for (auto it = chats.begin(); it != chats.end(); ++it)
+    {
+        QSqlQuery dbAnswer = db->exec("SELECT MAX(timestamp) FROM history WHERE chat_id = ?;", {it.value().first});
+        if (dbAnswer.next() && !dbAnswer.value(0).isNull())
+            recent.append({dbAnswer.value(0).toLongLong(), it.key()});
+    }
+    std::sort(recent.begin(), recent.end(), [](const QPair<qint64, QString>& a, const QPair<qint64, QString>& b)
+    {
+        return a.first > b.first;
+    });
+
+    qint64 newest = std::numeric_limits<qint64>::max();
+    for (int i = 0; i < qMin(recent.size(), HISTORY_CACHE_PRELOAD); i++)
+    {
+        QPair<int, HistoryKeeper::ChatType> chat = chats.value(recent[i].second);
+        QSqlQuery dbAnswer = db->exec(historyOlderQuery, {chat.first, newest, newest, newest, HISTORY_CACHE_MESSAGES});
+        QList<HistoryKeeper::HistMessage> msgs = readMessages(dbAnswer);
+        std::reverse(msgs.begin(), msgs.end());
+
+        cache->preload(chat.second, recent[i].second, msgs, msgs.size() < HISTORY_CACHE_MESSAGES);
+    }
+}
+
+QList<HistoryKeeper::HistMessage> HistoryWriter::readMessages(QSqlQuery &dbAnswer)
+{
+    QList<HistoryKeeper::HistMessage> res;
+
+    while (dbAnswer.next())
+    {
+        qint64 id = dbAnswer.value(0).toLongLong();
+        qint64 timeInt = dbAnswer.value(1).toLongLong();
+        QString sender = dbAnswer.value(2).toString();
+        QString message = MessageCodec::decode(dbAnswer.value(3), dbAnswer.value(4).toInt()); // only the rows asked for
+        QDateTime time = QDateTime::fromMSecsSinceEpoch(timeInt);
+
+        res.push_back({id,sender,message,time});
+    }
+
+    return res;
+}
+
+void HistoryWriter::updateChatsID()
+{
+    auto dbAnswer = db->exec(QString("SELECT * FROM chats;"));
+
+    chats.clear();
+    while (dbAnswer.next())
+    {
+        QString name = dbAnswer.value(1).toString();
+        int id = dbAnswer.value(0).toInt();
+        HistoryKeeper::ChatType ctype = convertToChatType(dbAnswer.value(2).toInt());
+
+        chats[name] = {id, ctype};
+    }
+}
+
+void HistoryWriter::updateAliases()
+{
+    auto dbAnswer = db->exec(QString("SELECT * FROM aliases;"));
+
+    aliases.clear();
+    while (dbAnswer.next())
+    {
+        QString user_id = dbAnswer.value(1).toString();
+        int id = dbAnswer.value(0).toInt();
+
+        aliases[user_id] = id;
+    }
+}
+
+QPair<int, HistoryKeeper::ChatType> HistoryWriter::getChatID(const QString &id_str, HistoryKeeper::ChatType ct)
+{
+    auto it = chats.find(id_str);
+    if (it != chats.end())
+        return it.value();
+
+    QSqlQuery dbAnswer = db->exec("INSERT INTO chats (name, ctype) VALUES (?, ?);", {id_str, static_cast<int>(ct)});
+    QPair<int, HistoryKeeper::ChatType> chat{dbAnswer.lastInsertId().toInt(), ct};
+    chats[id_str] = chat;
+
+    return chat;
+}
+
+int HistoryWriter::getAliasID(const QString &id_str)
+{
+    auto it = aliases.find(id_str);
+    if (it != aliases.end())
+        return it.value();
+
+    QSqlQuery dbAnswer = db->exec("INSERT INTO aliases (user_id) VALUES (?);", {id_str});
+    int id = dbAnswer.lastInsertId().toInt();
+    aliases[id_str] = id;
+
+    return id;
+}
+
+HistoryKeeper::ChatType HistoryWriter::convertToChatType(int ct)
+{
+    if (ct < 0 || ct > 1)
+        return HistoryKeeper::ctSingle;
+
+    return static_cast<HistoryKeeper::ChatType>(ct);
+}
@@ -0,0 +1,175 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+#ifndef HISTORYWRITER_H
+#define HISTORYWRITER_H
+
+#include <QObject>
+#include <QMap>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QQueue>
+#include <QDateTime>
+#include <QVariant>
+
+#include "historykeeper.h"
+
+#define HISTORY_COMMIT_INTERVAL 500 // ms, the longest a queued entry waits for its batch
+#define HISTORY_COMMIT_BATCH 256 // entries, a full batch is committed right away
+#define HISTORY_SLOW_COMMIT 200 // ms, commits slower than this are logged
+#define HISTORY_INSERT_ROWS 64 // entries inserted by a single statement, 5 parameters each must stay under SQLite's 999
+#define HISTORY_FTS_BATCH 2000 // messages of the old logs added to the search index at once
+#define HISTORY_FTS_INTERVAL 50 // ms between two of those batches, leaves the thread free for the rest
+#define HISTORY_RECOMPRESS_BATCH 1000 // messages rewritten per step of startRecompress()
+#define HISTORY_RECOMPRESS_STEP 20 // ms between two of those steps, leaves the thread free for the rest
+#define HISTORY_RETENTION_DELAY 300000 // ms after opening before the retention rules are first applied
+#define HISTORY_RETENTION_INTERVAL 21600000 // ms between two runs of the retention task
+#define HISTORY_RETENTION_BATCH 500 // messages deleted per step of the retention task
+#define HISTORY_RETENTION_STEP 100 // ms between two steps, leaves the thread free for the rest
+#define HISTORY_VACUUM_PAGES 128 // free pages given back to the file system per step
+
+class GenericDdInterface;
+class HistoryCache;
+class QSqlQuery;
+class QTimer;
+
+/// Owns the history database on its own thread, entries are queued and committed in batches
+class HistoryWriter : public QObject
+{
+    Q_OBJECT
+public:
+    struct Entry
+    {
+        HistoryKeeper::ChatType ct;
+        QString chat;
+        QString message;
+        QString sender;
+        QDateTime timestamp;
+    };
+
+    /// Committed messages are added to cache, if any, it's preloaded with the most recently active chats once open
+    HistoryWriter(const QString& path, bool encrypted, HistoryCache* cache = nullptr);
+
+    static QList<QString> schema();
+    static QList<QList<QString>> schemaMigrations(); ///< Applied in order on top of schema(), see GenericDdInterface::migrate
+
+    void enqueue(const Entry& entry); ///< Thread safe, doesn't touch the database
+
+    void open(); // blocking call!
+    void close(); // blocking call!
+    void flush(); // blocking call!
+    QList<HistoryKeeper::HistMessage> getChatHistory(HistoryKeeper::ChatType ct, const QString& chat,
+                                                     const QDateTime& from, const QDateTime& to); // blocking call!
+    QList<HistoryKeeper::HistMessage> getChatHistoryPage(HistoryKeeper::ChatType ct, const QString& chat, const QDateTime& timestamp,
+                                                         qint64 id, int limit, bool older); // blocking call!
+    QList<HistoryKeeper::SearchResult> search(const QString& text, int limit); // blocking call!
+    int getChatMessageCount(HistoryKeeper::ChatType ct, const QString& chat); // blocking call!
+    /// Rewrites every stored message in the given mode in the background, then gives the freed pages back.
+    /// Thread safe, see recompressProgress and recompressFinished
+    void startRecompress(bool compress);
+    /// Rewrites the whole file, everything else on the thread waits meanwhile, so it's only meant for the tools
+    void vacuum(); // blocking call!
+
+    void setCompressMessages(bool compress); ///< For the messages written from now on, thread safe
+    void setRetention(const HistoryKeeper::RetentionRule& rule); ///< Thread safe, used from the next run on
+    void setChatRetention(HistoryKeeper::ChatType ct, const QString& chat, bool hasRule,
+                          const HistoryKeeper::RetentionRule& rule); // blocking call!
+    bool getChatRetention(HistoryKeeper::ChatType ct, const QString& chat, HistoryKeeper::RetentionRule& rule); // blocking call!
+
+    int getQueueDepth();
+    int getPendingCount(); ///< Queued entries and those being committed
+    int getMaxQueueDepth();
+    qint64 getLastCommitLatency();
+    qint64 getMaxCommitLatency();
+    qint64 getLastReclaimedBytes(); ///< Of the last completed retention run
+    qint64 getLastRetentionTime(); ///< ms of work of the last completed retention run, not counting the pauses
+    bool canShrinkFile(); ///< Thread safe, whether the open file uses incremental vacuum
+
+signals:
+    void recompressProgress(int done, int total);
+    void recompressFinished(int changed); ///< Also sent if the history is closed before the end
+
+private slots:
+    void _open();
+    void _close();
+    void _flush();
+    QList<HistoryKeeper::HistMessage> _getChatHistory(int ct, const QString& chat, const QDateTime& from, const QDateTime& to);
+    QList<HistoryKeeper::HistMessage> _getChatHistoryPage(int ct, const QString& chat, const QDateTime& timestamp,
+                                                          qint64 id, int limit, bool older);
+    QList<HistoryKeeper::SearchResult> _search(const QString& text, int limit);
+    int _getChatMessageCount(int ct, const QString& chat);
+    void _startRecompress(bool compress);
+    void _vacuum();
+    void _setChatRetention(int ct, const QString& chat, bool hasRule, const HistoryKeeper::RetentionRule& rule);
+    HistoryKeeper::RetentionRule _getChatRetention(int ct, const QString& chat);
+    void onEntryQueued();
+    void backfillSearchIndex();
+    void preloadCache();
+    void retentionStep();
+    void recompressStep();
+
+private:
+    enum RetentionPhase {rpIdle, rpDelete, rpCompact};
+
+    bool hasRetentionRules(); ///< False if nothing would ever be deleted
+    int deleteExpired(int limit); ///< Returns how many messages were deleted, at most limit
+    /// Deletes up to limit messages matching condition, and only those, from the search index too
+    int deleteMessages(const QString& condition, QVariantList args, int limit);
+    bool compactStep(); ///< Returns false once there is nothing left to give back
+    void updateVacuumMode();
+    qint64 getFileSize();
+    void commitPending();
+    qint64 insertEntries(const QList<Entry>& entries); ///< Returns the id of the first entry, -1 on failure
+    static QString multiRowQuery(const QString& head, const QString& row, int rows);
+    void checkQueryPlans();
+    QList<HistoryKeeper::HistMessage> readMessages(QSqlQuery& dbAnswer);
+    void updateChatsID();
+    void updateAliases();
+    QPair<int, HistoryKeeper::ChatType> getChatID(const QString& id_str, HistoryKeeper::ChatType ct);
+    int getAliasID(const QString& id_str);
+    HistoryKeeper::ChatType convertToChatType(int ct);
+
+private:
+    QString path;
+    bool encrypted;
+
+    GenericDdInterface* db;
+    HistoryCache* cache;
+    QTimer* commitTimer;
+    QTimer* backfillTimer;
+    QTimer* retentionTimer;
+    QTimer* recompressTimer;
+    RetentionPhase retentionPhase;
+    qint64 retentionDeleted, retentionSizeBefore, retentionWork;
+    bool recompressTo, recompressCompacting;
+    qint64 recompressLastId;
+    int recompressDone, recompressTotal, recompressChanged;
+    QMap<QString, int> aliases;
+    QMap<QString, QPair<int, HistoryKeeper::ChatType>> chats;
+    QAtomicInt compressMessages;
+    QAtomicInt incrementalVacuum;
+
+    QMutex mutex; // protects the queue, the stats and the retention rule below
+    QQueue<Entry> queue;
+    int committing;
+    int maxQueueDepth;
+    qint64 lastCommitLatency, maxCommitLatency;
+    quint64 commitCount, committedEntries;
+    HistoryKeeper::RetentionRule retention;
+    qint64 lastReclaimedBytes, lastRetentionTime;
+};
+
+#endif // HISTORYWRITER_H
@@ -0,0 +1,158 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+
+#include "avatarcache.h"
+#include "settings.h"
+#include "src/corestructs.h"
+#include "src/widget/maskablepixmapwidget.h"
+#include <QThreadPool>
+#include <QRunnable>
+#include <QCryptographicHash>
+#include <QFile>
+#include <QImage>
+
+class AvatarDecodeTask : public QRunnable
+{
+public:
+    AvatarDecodeTask(const QString& ownerId, uint generation, const QString& path)
+        : ownerId(ownerId), generation(generation), path(path)
+    {
+    }
+
+    void run()
+    {
+        QFile file(path);
+        if (!file.open(QIODevice::ReadOnly))
+            return;
+        QByteArray data = file.readAll();
+        file.close();
+
+        QImage image;
+        if (!image.loadFromData(data))
+            return;
+
+        image = image.scaled(AVATAR_SIZE, AVATAR_SIZE, Qt::KeepAspectRatioByExpanding, Qt::SmoothTransformation);
+        QColor background = MaskablePixmapWidget::pickBackground(image);
+        QByteArray hash = QCryptographicHash::hash(data, QCryptographicHash::Sha256);
+
+        QMetaObject::invokeMethod(&AvatarCache::getInstance(), "onDecoded", Qt::QueuedConnection,
+                                  Q_ARG(QString, ownerId), Q_ARG(uint, generation), Q_ARG(QByteArray, hash),
+                                  Q_ARG(QImage, image), Q_ARG(QColor, background));
+    }
+
+private:
+    QString ownerId;
+    uint generation;
+    QString path;
+};
+
+AvatarCache::AvatarCache()
+    : decoded(AVATAR_CACHE_SIZE)
+    , nextGeneration(1)
+{
+}
+
+AvatarCache& AvatarCache::getInstance()
+{
+    static AvatarCache avatarCache;
+    return avatarCache;
+}
+
+QString AvatarCache::key(const QString& ownerId)
+{
+    // Avatars are saved per public key, the nospam doesn't matter
+    return ownerId.left(TOX_ID_PUBLIC_KEY_LENGTH);
+}
+
+void AvatarCache::request(const QString& ownerId)
+{
+    QString k = key(ownerId);
+    uint generation = nextGeneration++;
+    pending[k] = generation;
+
+    auto it = owners.constFind(k);
+    if (it != owners.constEnd() && decoded.contains(*it))
+    {
+        QMetaObject::invokeMethod(this, "deliver", Qt::QueuedConnection, Q_ARG(QString, k), Q_ARG(uint, generation));
+        return;
+    }
+
+    QString path = Settings::getInstance().getAvatarPath(k);
+    QThreadPool::globalInstance()->start(new AvatarDecodeTask(k, generation, path));
+}
+
+bool AvatarCache::lookup(const QString& ownerId, QPixmap& pic, QColor& background)
+{
+    auto it = owners.constFind(key(ownerId));
+    if (it == owners.constEnd())
+        return false;
+
+    Entry* entry = decoded.object(*it);
+    if (!entry)
+        return false;
+
+    pic = entry->pic;
+    background = entry->background;
+    return true;
+}
+
+void AvatarCache::reload(const QString& ownerId)
+{
+    owners.remove(key(ownerId));
+    request(ownerId);
+}
+
+void AvatarCache::remove(const QString& ownerId)
+{
+    QString k = key(ownerId);
+    owners.remove(k);
+    pending.remove(k);
+}
+
+void AvatarCache::deliver(const QString& ownerId, uint generation)
+{
+    if (pending.value(ownerId) != generation)
+        return;
+    pending.remove(ownerId);
+
+    QPixmap pic;
+    QColor background;
+    if (!lookup(ownerId, pic, background)) // evicted in the meantime
+    {
+        request(ownerId);
+        return;
+    }
+
+    emit avatarReady(ownerId, pic, background);
+}
+
+void AvatarCache::onDecoded(const QString& ownerId, uint generation, const QByteArray& hash, const QImage& image, const QColor& background)
+{
+    if (pending.value(ownerId) != generation)
+        return;
+    pending.remove(ownerId);
+
+    Entry* entry = decoded.object(hash);
+    if (!entry)
+    {
+        entry = new Entry{QPixmap::fromImage(image), background};
+        decoded.insert(hash, entry);
+    }
+    owners[ownerId] = hash;
+
+    emit avatarReady(ownerId, entry->pic, entry->background);
+}
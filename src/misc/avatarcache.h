@@ -0,0 +1,72 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+
+#ifndef AVATARCACHE_H
+#define AVATARCACHE_H
+
+#include <QObject>
+#include <QHash>
+#include <QCache>
+#include <QPixmap>
+#include <QImage>
+#include <QColor>
+
+#define AVATAR_SIZE 40 // pixels, contact list, chat header and profile picture all show avatars at this size
+#define AVATAR_CACHE_SIZE 512 // decoded avatars kept in memory, a few MB at most
+
+/// Decodes saved avatars on the global thread pool, scaled once to AVATAR_SIZE with their background
+/// colour picked, and keeps them keyed by the hash of the file so that identical avatars are shared.
+/// Only to be used from the GUI thread, results are delivered with avatarReady()
+class AvatarCache : public QObject
+{
+    Q_OBJECT
+public:
+    static AvatarCache& getInstance();
+
+    void request(const QString& ownerId); ///< Always answers asynchronously, and not at all if there's no saved avatar
+    bool lookup(const QString& ownerId, QPixmap& pic, QColor& background); ///< Doesn't decode anything
+    void reload(const QString& ownerId); ///< The saved avatar changed
+    void remove(const QString& ownerId);
+
+signals:
+    void avatarReady(const QString& ownerId, const QPixmap& pic, const QColor& background);
+
+private slots:
+    void onDecoded(const QString& ownerId, uint generation, const QByteArray& hash, const QImage& image, const QColor& background);
+    void deliver(const QString& ownerId, uint generation);
+
+private:
+    AvatarCache();
+    AvatarCache(AvatarCache&) = delete;
+    AvatarCache& operator=(const AvatarCache&) = delete;
+
+    static QString key(const QString& ownerId);
+
+private:
+    struct Entry
+    {
+        QPixmap pic;
+        QColor background;
+    };
+
+    QCache<QByteArray, Entry> decoded; ///< By hash of the saved file
+    QHash<QString, QByteArray> owners; ///< Hash of the avatar of each owner, by public key
+    QHash<QString, uint> pending; ///< Latest request of each owner, older results are dropped
+    uint nextGeneration;
+};
+
+#endif // AVATARCACHE_H
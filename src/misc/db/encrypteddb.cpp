@@ -15,75 +15,118 @@
 */
 
 #include "encrypteddb.h"
-#include "src/misc/settings.h"
-#include "src/core.h"
 
 #include <tox/toxencryptsave.h>
 
 #include <QSqlQuery>
 #include <QDebug>
 #include <QSqlError>
+#include <QFile>
+#include <QUrl>
 
 qint64 EncryptedDb::plainChunkSize = 4096;
 qint64 EncryptedDb::encryptedChunkSize = EncryptedDb::plainChunkSize + tox_pass_encryption_extra_length();
+EncryptedVfs::CryptFunction EncryptedDb::encryptFunction = nullptr;
+EncryptedVfs::CryptFunction EncryptedDb::decryptFunction = nullptr;
+QByteArray EncryptedDb::cipherKey;
 
 EncryptedDb::EncryptedDb(const QString &fname, QList<QString> initList) :
-    PlainDb(":memory:", initList), encrFile(fname)
+    PlainDb(prepareFile(fname, initList), pageSetup(initList), "QSQLITE_OPEN_URI")
 {
-    QByteArray fileContent;
-    if (pullFileContent())
-    {
-        chunkPosition = encrFile.size() / encryptedChunkSize;
+    // temporary tables and indices would end up unencrypted on the disk otherwise
+    PlainDb::exec("PRAGMA temp_store = MEMORY;");
 
-        encrFile.seek(0);
-        fileContent = encrFile.readAll();
-    } else {
-        qWarning() << "corrupted history log file will be wiped!";
-        chunkPosition = 0;
+    // Commits only append to the journal, the VFS has no shared memory so WAL needs the exclusive mode
+    PlainDb::exec("PRAGMA locking_mode = EXCLUSIVE;");
+    PlainDb::exec("PRAGMA journal_mode = WAL;");
+    PlainDb::exec(QString("PRAGMA wal_autocheckpoint = %1;").arg(HISTORY_CHECKPOINT_PAGES));
+}
+
+EncryptedDb::~EncryptedDb()
+{
+    // nothing is left to replay on the next start
+    PlainDb::exec("PRAGMA wal_checkpoint(TRUNCATE);");
+}
+
+QList<QString> EncryptedDb::pageSetup(QList<QString> initList)
+{
+    // a page per frame, so that pages never have to be merged into a frame; no-op on existing files
+    initList.prepend(QString("PRAGMA page_size = %1;").arg(EncryptedVfs::frameDataSize));
+    return initList;
+}
+
+void EncryptedDb::setCipher(EncryptedVfs::CryptFunction encrypt, EncryptedVfs::CryptFunction decrypt, const QByteArray& key)
+{
+    encryptFunction = encrypt;
+    decryptFunction = decrypt;
+    cipherKey = key;
+}
+
+bool EncryptedDb::installVfs()
+{
+    if (!encryptFunction || !decryptFunction || cipherKey.isEmpty())
+    {
+        qWarning() << "EncryptedDb: no cipher set";
+        return false;
     }
 
-    encrFile.close();
-    encrFile.open(QIODevice::WriteOnly);
-    encrFile.write(fileContent);
-    encrFile.flush();
+    return EncryptedVfs::install(encryptFunction, decryptFunction, cipherKey, tox_pass_encryption_extra_length());
 }
 
-EncryptedDb::~EncryptedDb()
+QString EncryptedDb::fileUri(const QString &fname)
 {
-    encrFile.close(); // Q: what if program is killed without being able to clean up?
-                      // A: cleanup isn't necessary, everything handled int appendToEncrypted(..) function
+    return QUrl::fromLocalFile(fname).toString(QUrl::FullyEncoded) + "?vfs=" + EncryptedVfs::name();
+}
+
+QString EncryptedDb::prepareFile(const QString &fname, QList<QString> initList)
+{
+    if (!installVfs())
+    {
+        qWarning() << "EncryptedDb: encrypted storage unavailable, history will not be saved!";
+        return ":memory:";
+    }
+
+    if (isLegacyFile(fname))
+        importLegacyFile(fname, initList);
+
+    return fileUri(fname);
 }
 
-QSqlQuery EncryptedDb::exec(const QString &query)
+bool EncryptedDb::isLegacyFile(const QString &fname)
 {
-    QSqlQuery retQSqlQuery = PlainDb::exec(query);
-    if (query.startsWith("INSERT", Qt::CaseInsensitive))
-        appendToEncrypted(query);
+    // A chunk of the old SQL log is shorter than a frame, so a frame never decrypts as one
+    QFile file(fname);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
 
-    return retQSqlQuery;
+    QByteArray encrChunk = file.read(encryptedChunkSize);
+    return encrChunk.size() > 0 && decryptFunction(encrChunk, cipherKey).size() > 0;
 }
 
-bool EncryptedDb::pullFileContent()
+bool EncryptedDb::pullLegacyContent(const QString &fname, QList<QString> &sqlCmds)
 {
+    QFile encrFile(fname);
     encrFile.open(QIODevice::ReadOnly);
-    QByteArray fileContent;
 
+    QVector<QByteArray> encrChunks;
     while (!encrFile.atEnd())
+        encrChunks.append(encrFile.read(encryptedChunkSize));
+
+    // the chunks are independent, only the lines have to be put back together in order
+    QVector<QByteArray> chunks = EncryptedVfs::decryptAll(encrChunks, decryptFunction, cipherKey);
+    QByteArray fileContent;
+    for (const QByteArray &buffer : chunks)
     {
-        QByteArray encrChunk = encrFile.read(encryptedChunkSize);
-        buffer = Core::getInstance()->decryptData(encrChunk, Core::ptHistory);
         if (buffer.size() > 0)
         {
             fileContent += buffer;
         } else {
             qWarning() << "Encrypted history log is corrupted: can't decrypt";
-            buffer = QByteArray();
             return false;
         }
     }
 
     QList<QByteArray> splittedBA = fileContent.split('\n');
-    QList<QString> sqlCmds;
 
     for (auto ba_line : splittedBA)
     {
@@ -104,48 +147,59 @@ bool EncryptedDb::pullFileContent()
         if (!isGoodLine)
         {
             qWarning() << "Encrypted history log is corrupted: errors in content";
-            buffer = QByteArray();
             return false;
         }
     }
 
-    for (auto line : sqlCmds)
-    {
-        QSqlQuery r = PlainDb::exec(line);
-    }
-
     return true;
 }
 
-void EncryptedDb::appendToEncrypted(const QString &sql)
+bool EncryptedDb::importLegacyFile(const QString &fname, QList<QString> initList)
 {
-    QByteArray b64Str;
-    b64Str.append(sql);
-    b64Str = b64Str.toBase64();  // much easier to parse strings like this from file
+    qDebug() << "EncryptedDb: converting the history log to the encrypted page store";
 
-    buffer += b64Str + "\n";
+    QList<QString> sqlCmds;
+    if (!pullLegacyContent(fname, sqlCmds))
+    {
+        qWarning() << "corrupted history log file will be wiped!";
+        QFile::remove(fname);
+        return false;
+    }
 
-    while (buffer.size() > plainChunkSize)
+    QString importName = fname + ".import";
+    QFile::remove(importName);
+
+    bool ok;
     {
-        QByteArray filledChunk = buffer.left(plainChunkSize);
-        encrFile.seek(chunkPosition * encryptedChunkSize);
-        QByteArray encr = Core::getInstance()->encryptData(filledChunk, Core::ptHistory);
-        if (encr.size() > 0)
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", "qtox-history-import");
+        db.setConnectOptions("QSQLITE_OPEN_URI");
+        db.setDatabaseName(fileUri(importName));
+
+        ok = db.open();
+        if (ok)
         {
-            encrFile.write(encr);
+            db.exec("PRAGMA temp_store = MEMORY;");
+            for (const QString &cmd : pageSetup(initList))
+                db.exec(cmd);
+
+            db.transaction();
+            for (const QString &cmd : sqlCmds)
+                db.exec(cmd);
+            ok = db.commit();
+            db.close();
         }
-
-        buffer = buffer.right(buffer.size() - plainChunkSize);
-        chunkPosition++;
     }
-    encrFile.seek(chunkPosition * encryptedChunkSize);
+    QSqlDatabase::removeDatabase("qtox-history-import");
 
-    QByteArray encr = Core::getInstance()->encryptData(buffer, Core::ptHistory);
-    if (encr.size() > 0)
+    if (!ok)
     {
-        encrFile.write(encr);
+        qWarning() << "EncryptedDb: can't convert the history log, keeping it as is";
+        QFile::remove(importName);
+        return false;
     }
-    encrFile.flush();
+
+    QFile::remove(fname);
+    return QFile::rename(importName, fname);
 }
 
 bool EncryptedDb::check(const QString &fname)
@@ -156,12 +210,12 @@ bool EncryptedDb::check(const QString &fname)
 
     if (file.size() > 0)
     {
-        QByteArray encrChunk = file.read(encryptedChunkSize);
-        QByteArray buf = Core::getInstance()->decryptData(encrChunk, Core::ptHistory);
-        if (buf.size() == 0)
-        {
-            state = false;
-        }
+        if (!installVfs())
+            return false;
+
+        QByteArray encrFrame = file.read(EncryptedVfs::encryptedFrameSize());
+        if (decryptFunction(encrFrame, cipherKey).size() == 0)
+            state = isLegacyFile(fname);
     } else {
         file.close();
         file.open(QIODevice::WriteOnly);
@@ -18,9 +18,11 @@
 #define ENCRYPTEDDB_H
 
 #include "plaindb.h"
+#include "encryptedvfs.h"
 
 #include <QList>
-#include <QFile>
+
+#define HISTORY_CHECKPOINT_PAGES 256 // journal size that triggers a checkpoint into the database
 
 class EncryptedDb : public PlainDb
 {
@@ -28,20 +30,25 @@ public:
     EncryptedDb(const QString& fname, QList<QString> initList);
     virtual ~EncryptedDb();
 
-    virtual QSqlQuery exec(const QString &query);
     static bool check(const QString &fname);
+    /// Must be set before any encrypted database is opened or checked
+    static void setCipher(EncryptedVfs::CryptFunction encrypt, EncryptedVfs::CryptFunction decrypt, const QByteArray& key);
 
 private:
-    bool pullFileContent();
-    void appendToEncrypted(const QString &sql);
-
-    QFile encrFile;
-
-    static qint64 plainChunkSize;
+    static bool installVfs();
+    static QString prepareFile(const QString &fname, QList<QString> initList);
+    static QList<QString> pageSetup(QList<QString> initList);
+    static QString fileUri(const QString &fname);
+    static bool isLegacyFile(const QString &fname);
+    static bool pullLegacyContent(const QString &fname, QList<QString> &sqlCmds);
+    static bool importLegacyFile(const QString &fname, QList<QString> initList);
+
+    static EncryptedVfs::CryptFunction encryptFunction;
+    static EncryptedVfs::CryptFunction decryptFunction;
+    static QByteArray cipherKey;
+
+    static qint64 plainChunkSize; ///< Of the SQL log used before the page store
     static qint64 encryptedChunkSize;
-
-    qint64 chunkPosition;
-    QByteArray buffer;
 };
 
 #endif // ENCRYPTEDDB_H
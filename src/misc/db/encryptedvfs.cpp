@@ -0,0 +1,652 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+#include "encryptedvfs.h"
+
+#include <sqlite3.h>
+#include <cstring>
+#include <algorithm>
+
+#include <QtEndian>
+#include <QMultiMap>
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QAtomicInt>
+#include <QDebug>
+
+/*
+ On-disk layout
+  The file is cut into frames of frameDataSize plain bytes, frame n is stored at n * encryptedFrameSize.
+  Each frame is encrypted on its own, with a 4 bytes little endian count of the valid bytes and the 8 bytes
+  little endian index of the frame in front of the data. A frame read back at another index is rejected,
+  so frames can't be swapped or duplicated within the file.
+  Every frame except the last one is full, so the logical size is known as soon as the last frame is read.
+
+ WAL files are only ever appended to, so they get an append-only journal layout instead:
+  each xWrite becomes one record, a recordHeaderSize little endian length followed by the encrypted
+  (8 bytes little endian logical offset + 8 bytes little endian position of the record in the file + data).
+  A record is authenticated on its own and only valid where it was written, nothing already
+  on the disk is rewritten, and a torn record at the end is dropped when the journal is opened.
+  A write at offset 0 starts a new WAL generation after a checkpoint, the journal is then compacted to nothing.
+*/
+
+struct JournalRecord
+{
+    sqlite3_int64 position; // of the length prefix in the real file
+    int length; // of the encrypted record
+    sqlite3_int64 offset; // logical offset of the data
+    int size; // of the data
+    quint64 seq; // later records win when they overlap
+};
+
+struct JournalIndex
+{
+    QMultiMap<sqlite3_int64, JournalRecord> records;
+    sqlite3_int64 end = 0;
+    quint64 nextSeq = 0;
+    int maxRecordSize = 0;
+};
+
+struct EncryptedFile
+{
+    sqlite3_file base; // must stay first, SQLite sees this struct as a sqlite3_file
+    sqlite3_file* real;
+    sqlite3_int64 size;
+    JournalIndex* journal; // only set for WAL files
+    QByteArray* key; // taken when the file is opened
+};
+
+const int EncryptedVfs::frameDataSize;
+const int EncryptedVfs::frameHeaderSize;
+const int EncryptedVfs::recordHeaderSize;
+const int EncryptedVfs::recordPrefixSize;
+
+static sqlite3_vfs encryptedVfs;
+static sqlite3_vfs* realVfs = nullptr;
+static EncryptedVfs::CryptFunction encryptFunction = nullptr;
+static EncryptedVfs::CryptFunction decryptFunction = nullptr;
+static QByteArray cipherKey;
+static const int plainFrameSize = EncryptedVfs::frameHeaderSize + EncryptedVfs::frameDataSize;
+static int encryptedSize = 0;
+static int decryptThreads = 0;
+
+class DecryptTask : public QRunnable
+{
+public:
+    DecryptTask(const QVector<QByteArray>& blocks, QByteArray* results, QAtomicInt& next,
+                EncryptedVfs::CryptFunction decrypt, const QByteArray& key)
+        : blocks(blocks), results(results), next(next), decrypt(decrypt), key(key)
+    {
+    }
+
+    void run()
+    {
+        int i;
+        while ((i = next.fetchAndAddRelaxed(1)) < blocks.size())
+            results[i] = decrypt(blocks[i], key);
+    }
+
+private:
+    const QVector<QByteArray>& blocks;
+    QByteArray* results;
+    QAtomicInt& next;
+    EncryptedVfs::CryptFunction decrypt;
+    const QByteArray key;
+};
+
+// Returns the number of valid bytes in the frame, -1 if it can't be decrypted
+static int readFrame(EncryptedFile* f, sqlite3_int64 frame, QByteArray& data)
+{
+    data.fill(0, EncryptedVfs::frameDataSize);
+
+    QByteArray encrypted(encryptedSize, 0);
+    int rc = f->real->pMethods->xRead(f->real, encrypted.data(), encryptedSize, frame * encryptedSize);
+    if (rc == SQLITE_IOERR_SHORT_READ)
+        return 0;
+    else if (rc != SQLITE_OK)
+        return -1;
+
+    QByteArray plain = decryptFunction(encrypted, *f->key);
+    if (plain.size() != plainFrameSize)
+        return -1;
+
+    const uchar* header = reinterpret_cast<const uchar*>(plain.constData());
+    quint32 valid = qFromLittleEndian<quint32>(header);
+    if (valid > EncryptedVfs::frameDataSize)
+        return -1;
+    if (qFromLittleEndian<qint64>(header + 4) != frame)
+    {
+        qWarning() << "EncryptedVfs: frame" << frame << "was moved or replaced";
+        return -1;
+    }
+
+    memcpy(data.data(), plain.constData() + EncryptedVfs::frameHeaderSize, EncryptedVfs::frameDataSize);
+    return valid;
+}
+
+static int writeFrame(EncryptedFile* f, sqlite3_int64 frame, const QByteArray& data, int valid)
+{
+    QByteArray plain(plainFrameSize, 0);
+    qToLittleEndian<quint32>(valid, reinterpret_cast<uchar*>(plain.data()));
+    qToLittleEndian<qint64>(frame, reinterpret_cast<uchar*>(plain.data()) + 4);
+    memcpy(plain.data() + EncryptedVfs::frameHeaderSize, data.constData(), EncryptedVfs::frameDataSize);
+
+    QByteArray encrypted = encryptFunction(plain, *f->key);
+    if (encrypted.size() != encryptedSize)
+        return SQLITE_IOERR_WRITE;
+
+    return f->real->pMethods->xWrite(f->real, encrypted.constData(), encryptedSize, frame * encryptedSize);
+}
+
+static void addRecord(JournalIndex* journal, const JournalRecord& record)
+{
+    // a rewrite of the same range replaces the old record instead of piling up
+    auto it = journal->records.find(record.offset);
+    while (it != journal->records.end() && it.key() == record.offset)
+    {
+        if (it->size == record.size)
+            it = journal->records.erase(it);
+        else
+            ++it;
+    }
+
+    journal->records.insert(record.offset, record);
+    journal->maxRecordSize = qMax(journal->maxRecordSize, record.size);
+}
+
+static bool readRecord(EncryptedFile* f, const JournalRecord& record, QByteArray& data)
+{
+    QByteArray encrypted(record.length, 0);
+    int rc = f->real->pMethods->xRead(f->real, encrypted.data(), record.length,
+                                      record.position + EncryptedVfs::recordHeaderSize);
+    if (rc != SQLITE_OK)
+        return false;
+
+    QByteArray plain = decryptFunction(encrypted, *f->key);
+    const uchar* prefix = reinterpret_cast<const uchar*>(plain.constData());
+    if (plain.size() != EncryptedVfs::recordPrefixSize + record.size
+        || qFromLittleEndian<qint64>(prefix) != record.offset
+        || qFromLittleEndian<qint64>(prefix + 8) != record.position)
+        return false;
+
+    data = plain.mid(EncryptedVfs::recordPrefixSize);
+    return true;
+}
+
+// Builds the index of the journal, drops a torn record at its end
+static void openJournal(EncryptedFile* f)
+{
+    JournalIndex* journal = f->journal;
+    sqlite3_int64 physicalSize = 0;
+    f->real->pMethods->xFileSize(f->real, &physicalSize);
+
+    // Read every record first, so that they can be decrypted in parallel
+    QVector<QByteArray> encryptedRecords;
+    QVector<sqlite3_int64> positions;
+    sqlite3_int64 pos = 0;
+    while (pos + EncryptedVfs::recordHeaderSize <= physicalSize)
+    {
+        uchar header[EncryptedVfs::recordHeaderSize];
+        if (f->real->pMethods->xRead(f->real, header, sizeof(header), pos) != SQLITE_OK)
+            break;
+
+        int length = qFromLittleEndian<quint32>(header);
+        if (length <= EncryptedVfs::recordPrefixSize || pos + EncryptedVfs::recordHeaderSize + length > physicalSize)
+            break;
+
+        QByteArray encrypted(length, 0);
+        if (f->real->pMethods->xRead(f->real, encrypted.data(), length, pos + EncryptedVfs::recordHeaderSize) != SQLITE_OK)
+            break;
+
+        encryptedRecords.append(encrypted);
+        positions.append(pos);
+        pos += EncryptedVfs::recordHeaderSize + length;
+    }
+
+    QVector<QByteArray> plainRecords = EncryptedVfs::decryptAll(encryptedRecords, decryptFunction, *f->key);
+
+    pos = 0;
+    for (int i = 0; i < plainRecords.size(); i++)
+    {
+        const QByteArray& plain = plainRecords[i];
+        const uchar* prefix = reinterpret_cast<const uchar*>(plain.constData());
+        // a record copied from elsewhere ends the journal like a torn one
+        if (plain.size() < EncryptedVfs::recordPrefixSize || qFromLittleEndian<qint64>(prefix + 8) != positions[i])
+            break;
+
+        JournalRecord record;
+        record.position = positions[i];
+        record.length = encryptedRecords[i].size();
+        record.offset = qFromLittleEndian<qint64>(prefix);
+        record.size = plain.size() - EncryptedVfs::recordPrefixSize;
+        record.seq = journal->nextSeq++;
+        addRecord(journal, record);
+
+        f->size = qMax(f->size, record.offset + record.size);
+        pos = record.position + EncryptedVfs::recordHeaderSize + record.length;
+    }
+
+    if (pos < physicalSize)
+    {
+        qWarning() << "EncryptedVfs: dropping" << physicalSize - pos << "bytes of torn journal";
+        f->real->pMethods->xTruncate(f->real, pos);
+    }
+
+    journal->end = pos;
+}
+
+static int resetJournal(EncryptedFile* f)
+{
+    f->journal->records.clear();
+    f->journal->end = 0;
+    f->journal->maxRecordSize = 0;
+    f->size = 0;
+
+    return f->real->pMethods->xTruncate(f->real, 0);
+}
+
+static int journalRead(EncryptedFile* f, char* out, int amount, sqlite3_int64 offset)
+{
+    memset(out, 0, amount);
+
+    JournalIndex* journal = f->journal;
+    sqlite3_int64 end = offset + amount;
+    QList<JournalRecord> hits;
+    for (auto it = journal->records.lowerBound(offset - journal->maxRecordSize);
+         it != journal->records.end() && it.key() < end; ++it)
+    {
+        if (it.key() + it->size > offset)
+            hits.append(it.value());
+    }
+
+    std::sort(hits.begin(), hits.end(), [](const JournalRecord& a, const JournalRecord& b) {return a.seq < b.seq;});
+
+    QByteArray data;
+    for (const JournalRecord& record : hits)
+    {
+        if (!readRecord(f, record, data))
+            return SQLITE_IOERR_READ;
+
+        sqlite3_int64 from = qMax(offset, record.offset);
+        sqlite3_int64 to = qMin(end, record.offset + record.size);
+        memcpy(out + (from - offset), data.constData() + (from - record.offset), to - from);
+    }
+
+    if (end > f->size)
+        return SQLITE_IOERR_SHORT_READ;
+
+    return SQLITE_OK;
+}
+
+static int journalWrite(EncryptedFile* f, const char* in, int amount, sqlite3_int64 offset)
+{
+    JournalIndex* journal = f->journal;
+
+    // SQLite only writes the header again once the whole WAL has been checkpointed
+    if (offset == 0 && f->size > 0)
+    {
+        int rc = resetJournal(f);
+        if (rc != SQLITE_OK)
+            return rc;
+    }
+
+    QByteArray plain(EncryptedVfs::recordPrefixSize, 0);
+    qToLittleEndian<qint64>(offset, reinterpret_cast<uchar*>(plain.data()));
+    qToLittleEndian<qint64>(journal->end, reinterpret_cast<uchar*>(plain.data()) + 8);
+    plain.append(in, amount);
+
+    QByteArray encrypted = encryptFunction(plain, *f->key);
+    if (encrypted.isEmpty())
+        return SQLITE_IOERR_WRITE;
+
+    QByteArray record(EncryptedVfs::recordHeaderSize, 0);
+    qToLittleEndian<quint32>(encrypted.size(), reinterpret_cast<uchar*>(record.data()));
+    record += encrypted;
+
+    int rc = f->real->pMethods->xWrite(f->real, record.constData(), record.size(), journal->end);
+    if (rc != SQLITE_OK)
+        return rc;
+
+    addRecord(journal, {journal->end, encrypted.size(), offset, amount, journal->nextSeq++});
+    journal->end += record.size();
+    f->size = qMax(f->size, offset + amount);
+
+    return SQLITE_OK;
+}
+
+static int journalTruncate(EncryptedFile* f, sqlite3_int64 size)
+{
+    if (size == 0)
+        return resetJournal(f);
+
+    if (size >= f->size)
+        return SQLITE_OK;
+
+    // Rare, the kept part is rewritten as a fresh journal so that nothing past size comes back on reopen
+    QByteArray content(size, 0);
+    int rc = journalRead(f, content.data(), size, 0);
+    if (rc != SQLITE_OK)
+        return rc;
+
+    rc = resetJournal(f);
+    for (sqlite3_int64 pos = 0; rc == SQLITE_OK && pos < size; pos += EncryptedVfs::frameDataSize)
+        rc = journalWrite(f, content.constData() + pos, qMin<sqlite3_int64>(EncryptedVfs::frameDataSize, size - pos), pos);
+
+    return rc;
+}
+
+static int encryptedClose(sqlite3_file* file)
+{
+    EncryptedFile* f = reinterpret_cast<EncryptedFile*>(file);
+    delete f->journal;
+    f->journal = nullptr;
+    delete f->key;
+    f->key = nullptr;
+
+    return f->real->pMethods->xClose(f->real);
+}
+
+static int encryptedRead(sqlite3_file* file, void* buf, int amount, sqlite3_int64 offset)
+{
+    EncryptedFile* f = reinterpret_cast<EncryptedFile*>(file);
+    char* out = static_cast<char*>(buf);
+    if (f->journal)
+        return journalRead(f, out, amount, offset);
+
+    memset(out, 0, amount);
+
+    sqlite3_int64 end = qMin(offset + amount, f->size);
+    QByteArray data;
+    for (sqlite3_int64 pos = offset; pos < end;)
+    {
+        sqlite3_int64 frame = pos / EncryptedVfs::frameDataSize;
+        int frameOffset = pos % EncryptedVfs::frameDataSize;
+        int len = qMin<sqlite3_int64>(EncryptedVfs::frameDataSize - frameOffset, end - pos);
+
+        if (readFrame(f, frame, data) < 0)
+            return SQLITE_IOERR_READ;
+
+        memcpy(out + (pos - offset), data.constData() + frameOffset, len);
+        pos += len;
+    }
+
+    if (offset + amount > f->size)
+        return SQLITE_IOERR_SHORT_READ;
+
+    return SQLITE_OK;
+}
+
+static int encryptedWrite(sqlite3_file* file, const void* buf, int amount, sqlite3_int64 offset)
+{
+    EncryptedFile* f = reinterpret_cast<EncryptedFile*>(file);
+    if (f->journal)
+        return journalWrite(f, static_cast<const char*>(buf), amount, offset);
+
+    if (offset > f->size)
+    {
+        // fill the gap first, so that every frame but the last one stays full
+        QByteArray zeros(offset - f->size, 0);
+        int rc = encryptedWrite(file, zeros.constData(), zeros.size(), f->size);
+        if (rc != SQLITE_OK)
+            return rc;
+    }
+
+    const char* in = static_cast<const char*>(buf);
+    sqlite3_int64 end = offset + amount;
+    QByteArray data;
+    for (sqlite3_int64 pos = offset; pos < end;)
+    {
+        sqlite3_int64 frame = pos / EncryptedVfs::frameDataSize;
+        int frameOffset = pos % EncryptedVfs::frameDataSize;
+        int len = qMin<sqlite3_int64>(EncryptedVfs::frameDataSize - frameOffset, end - pos);
+
+        int valid = 0;
+        if (len == EncryptedVfs::frameDataSize)
+        {
+            data.resize(EncryptedVfs::frameDataSize); // overwritten entirely, no need to decrypt it
+        }
+        else if (frame * EncryptedVfs::frameDataSize < f->size)
+        {
+            valid = readFrame(f, frame, data);
+            if (valid < 0)
+                return SQLITE_IOERR_WRITE;
+        }
+        else
+        {
+            data.fill(0, EncryptedVfs::frameDataSize);
+        }
+
+        memcpy(data.data() + frameOffset, in + (pos - offset), len);
+        int rc = writeFrame(f, frame, data, qMax(valid, frameOffset + len));
+        if (rc != SQLITE_OK)
+            return rc;
+
+        pos += len;
+    }
+
+    f->size = qMax(f->size, end);
+    return SQLITE_OK;
+}
+
+static int encryptedTruncate(sqlite3_file* file, sqlite3_int64 size)
+{
+    EncryptedFile* f = reinterpret_cast<EncryptedFile*>(file);
+    if (f->journal)
+        return journalTruncate(f, size);
+
+    if (size >= f->size)
+        return SQLITE_OK;
+
+    sqlite3_int64 frames = (size + EncryptedVfs::frameDataSize - 1) / EncryptedVfs::frameDataSize;
+    int tail = size % EncryptedVfs::frameDataSize;
+    if (tail)
+    {
+        QByteArray data;
+        if (readFrame(f, frames - 1, data) < 0)
+            return SQLITE_IOERR_TRUNCATE;
+
+        memset(data.data() + tail, 0, EncryptedVfs::frameDataSize - tail);
+        int rc = writeFrame(f, frames - 1, data, tail);
+        if (rc != SQLITE_OK)
+            return rc;
+    }
+
+    int rc = f->real->pMethods->xTruncate(f->real, frames * encryptedSize);
+    if (rc == SQLITE_OK)
+        f->size = size;
+
+    return rc;
+}
+
+static int encryptedSync(sqlite3_file* file, int flags)
+{
+    EncryptedFile* f = reinterpret_cast<EncryptedFile*>(file);
+    return f->real->pMethods->xSync(f->real, flags);
+}
+
+static int encryptedFileSize(sqlite3_file* file, sqlite3_int64* size)
+{
+    *size = reinterpret_cast<EncryptedFile*>(file)->size;
+    return SQLITE_OK;
+}
+
+static int encryptedLock(sqlite3_file* file, int lock)
+{
+    EncryptedFile* f = reinterpret_cast<EncryptedFile*>(file);
+    return f->real->pMethods->xLock(f->real, lock);
+}
+
+static int encryptedUnlock(sqlite3_file* file, int lock)
+{
+    EncryptedFile* f = reinterpret_cast<EncryptedFile*>(file);
+    return f->real->pMethods->xUnlock(f->real, lock);
+}
+
+static int encryptedCheckReservedLock(sqlite3_file* file, int* out)
+{
+    EncryptedFile* f = reinterpret_cast<EncryptedFile*>(file);
+    return f->real->pMethods->xCheckReservedLock(f->real, out);
+}
+
+static int encryptedFileControl(sqlite3_file*, int, void*)
+{
+    // size hints and chunked growth would put unencrypted holes in the file
+    return SQLITE_NOTFOUND;
+}
+
+static int encryptedSectorSize(sqlite3_file*)
+{
+    return EncryptedVfs::frameDataSize;
+}
+
+static int encryptedDeviceCharacteristics(sqlite3_file*)
+{
+    return 0; // a frame is rewritten as a whole, so nothing of the underlying device is guaranteed
+}
+
+static const sqlite3_io_methods encryptedIoMethods = {
+    1,
+    encryptedClose,
+    encryptedRead,
+    encryptedWrite,
+    encryptedTruncate,
+    encryptedSync,
+    encryptedFileSize,
+    encryptedLock,
+    encryptedUnlock,
+    encryptedCheckReservedLock,
+    encryptedFileControl,
+    encryptedSectorSize,
+    encryptedDeviceCharacteristics
+};
+
+static int encryptedOpen(sqlite3_vfs*, const char* name, sqlite3_file* file, int flags, int* outFlags)
+{
+    EncryptedFile* f = reinterpret_cast<EncryptedFile*>(file);
+    memset(f, 0, sizeof(EncryptedFile));
+    f->real = reinterpret_cast<sqlite3_file*>(f + 1);
+
+    int rc = realVfs->xOpen(realVfs, name, f->real, flags, outFlags);
+    if (rc != SQLITE_OK)
+    {
+        if (f->real->pMethods)
+            f->real->pMethods->xClose(f->real);
+        return rc;
+    }
+    file->pMethods = &encryptedIoMethods;
+    f->key = new QByteArray(cipherKey);
+
+    if (flags & SQLITE_OPEN_WAL)
+    {
+        f->journal = new JournalIndex;
+        openJournal(f);
+        return SQLITE_OK;
+    }
+
+    sqlite3_int64 physicalSize = 0;
+    f->real->pMethods->xFileSize(f->real, &physicalSize);
+    sqlite3_int64 frames = physicalSize / encryptedSize;
+    if (frames > 0)
+    {
+        QByteArray data;
+        int valid = readFrame(f, frames - 1, data);
+        if (valid < 0)
+        {
+            // a torn write of the last frame, the rollback journal takes care of the content
+            qWarning() << "EncryptedVfs: last frame of" << name << "can't be decrypted, dropping it";
+            valid = EncryptedVfs::frameDataSize;
+            frames--;
+        }
+        f->size = frames > 0 ? (frames - 1) * EncryptedVfs::frameDataSize + valid : 0;
+    }
+
+    return SQLITE_OK;
+}
+
+bool EncryptedVfs::install(CryptFunction encrypt, CryptFunction decrypt, const QByteArray& key, int encryptionOverhead)
+{
+    encryptFunction = encrypt;
+    decryptFunction = decrypt;
+    cipherKey = key;
+    encryptedSize = plainFrameSize + encryptionOverhead;
+
+    if (realVfs)
+        return true;
+
+    realVfs = sqlite3_vfs_find(nullptr);
+    if (!realVfs)
+    {
+        qWarning() << "EncryptedVfs: no default SQLite VFS to build on";
+        return false;
+    }
+
+    // Everything but opening files is forwarded as is, pAppData included
+    encryptedVfs = *realVfs;
+    encryptedVfs.iVersion = qMin(realVfs->iVersion, 2);
+    encryptedVfs.szOsFile = sizeof(EncryptedFile) + realVfs->szOsFile;
+    encryptedVfs.pNext = nullptr;
+    encryptedVfs.zName = name();
+    encryptedVfs.xOpen = encryptedOpen;
+
+    if (sqlite3_vfs_register(&encryptedVfs, 0) != SQLITE_OK)
+    {
+        qWarning() << "EncryptedVfs: can't register the VFS";
+        realVfs = nullptr;
+        return false;
+    }
+
+    return true;
+}
+
+const char* EncryptedVfs::name()
+{
+    return "qtox-encrypted";
+}
+
+int EncryptedVfs::encryptedFrameSize()
+{
+    return encryptedSize;
+}
+
+void EncryptedVfs::setDecryptThreads(int threads)
+{
+    decryptThreads = threads;
+}
+
+QVector<QByteArray> EncryptedVfs::decryptAll(const QVector<QByteArray>& blocks, CryptFunction decrypt, const QByteArray& key)
+{
+    QVector<QByteArray> results(blocks.size());
+
+    int threads = decryptThreads > 0 ? decryptThreads : QThread::idealThreadCount();
+    threads = qMin(threads, blocks.size());
+    if (threads <= 1)
+    {
+        for (int i = 0; i < blocks.size(); i++)
+            results[i] = decrypt(blocks[i], key);
+        return results;
+    }
+
+    // Each task takes the next block until none are left, every block is written to its own slot
+    QThreadPool pool;
+    pool.setMaxThreadCount(threads);
+    QAtomicInt next(0);
+    for (int i = 0; i < threads; i++)
+        pool.start(new DecryptTask(blocks, results.data(), next, decrypt, key));
+    pool.waitForDone();
+
+    return results;
+}
@@ -0,0 +1,52 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+#ifndef ENCRYPTEDVFS_H
+#define ENCRYPTEDVFS_H
+
+#include <QByteArray>
+#include <QVector>
+
+/**
+ * SQLite VFS that stores every file as a sequence of independently encrypted frames.
+ * Each frame holds frameDataSize bytes of the file plus the number of them that are valid and its own index,
+ * so only the touched pages are ever decrypted and the database never has to be loaded in full.
+ * WAL files are kept as an append-only journal of encrypted records instead, see encryptedvfs.cpp.
+ */
+class EncryptedVfs
+{
+public:
+    /// Must only depend on its arguments, it is called from several threads at once
+    typedef QByteArray (*CryptFunction)(const QByteArray& data, const QByteArray& key);
+
+    /// Registers the VFS once, the functions must return an empty array on failure.
+    /// Files opened afterwards use the given key
+    static bool install(CryptFunction encrypt, CryptFunction decrypt, const QByteArray& key, int encryptionOverhead);
+    static const char* name();
+
+    static int encryptedFrameSize();
+
+    static void setDecryptThreads(int threads); ///< 0 means one per core
+    /// Decrypts independent blocks on a thread pool, the results keep the order of the input
+    static QVector<QByteArray> decryptAll(const QVector<QByteArray>& blocks, CryptFunction decrypt, const QByteArray& key);
+
+    static const int frameDataSize = 4096; ///< Same as the default SQLite page size
+    static const int frameHeaderSize = 12; ///< Valid byte count, then the frame's index
+    static const int recordPrefixSize = 16; ///< Encrypted in front of the data of a journal record
+    static const int recordHeaderSize = 4; ///< Length prefix of a journal record
+};
+
+#endif // ENCRYPTEDVFS_H
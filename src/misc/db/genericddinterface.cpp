@@ -16,6 +16,49 @@
 
 #include "genericddinterface.h"
 
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QString>
+#include <QDebug>
+
 GenericDdInterface::~GenericDdInterface()
 {
 }
+
+bool GenericDdInterface::migrate(const QList<QList<QString>> &migrations)
+{
+    int version = 0;
+    QSqlQuery dbAnswer = exec(QString("SELECT version FROM schema_version;"));
+    if (dbAnswer.next())
+        version = dbAnswer.value(0).toInt();
+    else
+        exec(QString("INSERT INTO schema_version (version) VALUES (0);"));
+
+    if (version > migrations.size())
+    {
+        qWarning() << "GenericDdInterface: schema version" << version << "is newer than this version of qTox knows";
+        return false;
+    }
+
+    // each step is applied entirely or not at all
+    for (int i = version; i < migrations.size(); i++)
+    {
+        transaction();
+        for (const QString &cmd : migrations[i])
+        {
+            QSqlQuery r = exec(cmd);
+            if (r.lastError().isValid())
+            {
+                qWarning() << "GenericDdInterface: migration to version" << i + 1 << "failed on" << cmd << ":" << r.lastError().text();
+                rollback();
+                return false;
+            }
+        }
+        exec(QString("UPDATE schema_version SET version = %1;").arg(i + 1));
+        commit();
+
+        qDebug() << "GenericDdInterface: schema migrated to version" << i + 1;
+    }
+
+    return true;
+}
@@ -17,6 +17,9 @@
 #ifndef GENERICDDINTERFACE_H
 #define GENERICDDINTERFACE_H
 
+#include <QVariant>
+#include <QList>
+
 class QSqlQuery;
 class QString;
 
@@ -26,6 +29,14 @@ public:
     virtual ~GenericDdInterface();
 
     virtual QSqlQuery exec(const QString &query) = 0;
+    virtual QSqlQuery exec(const QString &query, const QVariantList &args) = 0; ///< Runs a cached prepared statement with positional args
+    virtual bool transaction() = 0;
+    virtual bool commit() = 0;
+    virtual bool rollback() = 0;
+    virtual void finishQueries() = 0; ///< Resets the cached statements, VACUUM fails while one is halfway read
+
+    /// Brings the schema up to date, migrations[n] goes from version n to n + 1. Needs a schema_version table
+    bool migrate(const QList<QList<QString>> &migrations);
 };
 
 #endif // GENERICDDINTERFACE_H
@@ -0,0 +1,121 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+#include "messagecodec.h"
+
+#include <zlib.h>
+#include <QDebug>
+
+// Chat lines are too short for deflate to find repeats within them, so the matches come from
+// a preset dictionary of common chat text instead. The most frequent strings go last, where
+// the matches are the cheapest to encode.
+static const char* const fDeflateDictionary =
+    "http://https://www.youtube.com/watch?v=.com/.org/.png.jpg.gifgithub.com/"
+    "unfortunatelyapparentlyinterestingsomethinganythingeverythingsomebodyeveryone"
+    "tomorrowyesterdaytonightweekendmorningeveningbirthdaypicturemessagepassword"
+    "actuallyprobablydefinitelybecausethoughthroughwithoutbetweenagainstalready"
+    "understandrememberforgotthinkingworkingsleepinggoingcominglookingwatching"
+    "computerinternetdownloadupdateserverclientversionproblemworksbrokenerror"
+    "congratulationsthank you so muchthanks a lotno problemsee you laterhave a nice day"
+    "good morninggood nightgood luckhappy birthdayhow are you?what are you doing?"
+    "I don't knowI don't thinkI thinkI'm notI'm going toI want toI have toI need to"
+    "do you want towould you likecan youcould youdid youare youis itit's notthat's"
+    "what's upwhereverwhenwherewhichwhatwhowhyhowyeahyesnookayokhahahahalollmao:):D:(;)"
+    "<3 the and to of a in is it you that he was for on are with as I his they be at one "
+    "have this from or had by not but what some we can out other were all there when up use "
+    "your how said an each she which do their time if will way about many then them would ";
+
+QVariant MessageCodec::encode(const QString &message, bool compress, int &flags)
+{
+    flags = 0;
+    if (!compress)
+        return message;
+
+    QByteArray plain = message.toUtf8();
+
+    z_stream strm;
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    if (deflateInit2(&strm, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return message;
+
+    const QByteArray &dict = dictionary();
+    deflateSetDictionary(&strm, reinterpret_cast<const Bytef*>(dict.constData()), dict.size());
+
+    QByteArray compressed(deflateBound(&strm, plain.size()), 0);
+    strm.next_in = reinterpret_cast<Bytef*>(plain.data());
+    strm.avail_in = plain.size();
+    strm.next_out = reinterpret_cast<Bytef*>(compressed.data());
+    strm.avail_out = compressed.size();
+
+    int ret = deflate(&strm, Z_FINISH);
+    compressed.resize(strm.total_out);
+    deflateEnd(&strm);
+
+    // a body that doesn't shrink is stored as text, so that it stays readable as is
+    if (ret != Z_STREAM_END || compressed.size() >= plain.size())
+        return message;
+
+    flags = fDeflate;
+    return compressed;
+}
+
+QString MessageCodec::decode(const QVariant &body, int flags)
+{
+    if (!(flags & fDeflate))
+        return body.toString();
+
+    QByteArray compressed = body.toByteArray();
+
+    z_stream strm;
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    strm.next_in = reinterpret_cast<Bytef*>(compressed.data());
+    strm.avail_in = compressed.size();
+    if (inflateInit2(&strm, -MAX_WBITS) != Z_OK)
+        return QString();
+
+    const QByteArray &dict = dictionary();
+    inflateSetDictionary(&strm, reinterpret_cast<const Bytef*>(dict.constData()), dict.size());
+
+    QByteArray plain;
+    char buffer[4096];
+    int ret;
+    do
+    {
+        strm.next_out = reinterpret_cast<Bytef*>(buffer);
+        strm.avail_out = sizeof(buffer);
+        ret = inflate(&strm, Z_NO_FLUSH);
+        plain.append(buffer, sizeof(buffer) - strm.avail_out);
+    } while (ret == Z_OK);
+    inflateEnd(&strm);
+
+    if (ret != Z_STREAM_END)
+    {
+        qWarning() << "MessageCodec: corrupted message body";
+        return QString();
+    }
+
+    return QString::fromUtf8(plain);
+}
+
+const QByteArray &MessageCodec::dictionary()
+{
+    static const QByteArray dict(fDeflateDictionary);
+    return dict;
+}
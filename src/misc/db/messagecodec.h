@@ -0,0 +1,40 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+#ifndef MESSAGECODEC_H
+#define MESSAGECODEC_H
+
+#include <QString>
+#include <QVariant>
+
+/// Compression of the message bodies of the history, the flags of a row say how its body is stored
+class MessageCodec
+{
+public:
+    enum Flags
+    {
+        fDeflate = 1, ///< Raw deflate with the preset dictionary of this file, never change it, add a flag for a new one
+    };
+
+    /// The body to store, compressed when that is smaller; flags gets the flags of the row
+    static QVariant encode(const QString& message, bool compress, int& flags);
+    static QString decode(const QVariant& body, int flags);
+
+private:
+    static const QByteArray& dictionary();
+};
+
+#endif // MESSAGECODEC_H
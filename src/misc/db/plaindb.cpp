@@ -17,12 +17,14 @@
 #include "plaindb.h"
 #include <QDebug>
 #include <QSqlQuery>
+#include <QSqlError>
 #include <QString>
 
-PlainDb::PlainDb(const QString &db_name, QList<QString> initList)
+PlainDb::PlainDb(const QString &db_name, QList<QString> initList, const QString &connectOptions)
 {
     db = new QSqlDatabase();
     *db = QSqlDatabase::addDatabase("QSQLITE");
+    db->setConnectOptions(connectOptions);
     db->setDatabaseName(db_name);
 
     if (!db->open())
@@ -38,6 +40,7 @@ PlainDb::PlainDb(const QString &db_name, QList<QString> initList)
 
 PlainDb::~PlainDb()
 {
+    preparedQueries.clear(); // the statements must be finalized before the connection goes away
     db->close();
     QString dbConName = db->connectionName();
     delete db;
@@ -49,3 +52,49 @@ QSqlQuery PlainDb::exec(const QString &query)
 {
     return db->exec(query);
 }
+
+QSqlQuery PlainDb::exec(const QString &query, const QVariantList &args)
+{
+    auto it = preparedQueries.find(query);
+    if (it == preparedQueries.end())
+    {
+        QSqlQuery prepared(*db);
+        if (!prepared.prepare(query))
+        {
+            qWarning() << "PlainDb: can't prepare" << query << ":" << prepared.lastError().text();
+            return prepared;
+        }
+
+        it = preparedQueries.insert(query, prepared);
+    }
+
+    QSqlQuery &prepared = it.value();
+    for (int i = 0; i < args.size(); i++)
+        prepared.bindValue(i, args[i]);
+
+    if (!prepared.exec())
+        qWarning() << "PlainDb: query failed" << query << ":" << prepared.lastError().text();
+
+    return prepared;
+}
+
+bool PlainDb::transaction()
+{
+    return db->transaction();
+}
+
+bool PlainDb::commit()
+{
+    return db->commit();
+}
+
+bool PlainDb::rollback()
+{
+    return db->rollback();
+}
+
+void PlainDb::finishQueries()
+{
+    for (QSqlQuery &query : preparedQueries)
+        query.finish();
+}
@@ -20,17 +20,25 @@
 #include "genericddinterface.h"
 
 #include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QHash>
 
 class PlainDb : public GenericDdInterface
 {
 public:
-    PlainDb(const QString &db_name, QList<QString> initList);
+    PlainDb(const QString &db_name, QList<QString> initList, const QString &connectOptions = QString());
     virtual ~PlainDb();
 
     virtual QSqlQuery exec(const QString &query);
+    virtual QSqlQuery exec(const QString &query, const QVariantList &args);
+    virtual bool transaction();
+    virtual bool commit();
+    virtual bool rollback();
+    virtual void finishQueries();
 
 private:
     QSqlDatabase *db;
+    QHash<QString, QSqlQuery> preparedQueries;
 };
 
 #endif // PLAINDB_H
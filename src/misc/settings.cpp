@@ -95,9 +95,30 @@ void Settings::load()
     friendAddresses.clear();
     s.beginGroup("Friends");
         int size = s.beginReadArray("fullAddresses");
-        for (int i = 0; i < size; i ++) {
+        for (int i = 0; i < size; i ++)
+        {
+            s.setArrayIndex(i);
+            QString addr = s.value("addr").toString();
+            friendAddresses[addr.left(TOX_ID_PUBLIC_KEY_LENGTH).toUpper()] = addr;
+        }
+        s.endArray();
+    s.endGroup();
+
+    partialDownloads.clear();
+    pendingUploads.clear();
+    s.beginGroup("Transfers");
+        size = s.beginReadArray("partialDownloads");
+        for (int i = 0; i < size; i ++)
+        {
+            s.setArrayIndex(i);
+            partialDownloads[s.value("key").toString()] = s.value("path").toString();
+        }
+        s.endArray();
+        size = s.beginReadArray("pendingUploads");
+        for (int i = 0; i < size; i ++)
+        {
             s.setArrayIndex(i);
-            friendAddresses.append(s.value("addr").toString());
+            pendingUploads[s.value("id").toString()].append(s.value("path").toString());
         }
         s.endArray();
     s.endGroup();
@@ -114,6 +135,8 @@ void Settings::load()
         proxyPort = s.value("proxyPort", 0).toInt();
         currentProfile = s.value("currentProfile", "").toString();
     	autoAwayTime = s.value("autoAwayTime", 10).toInt();
+        fileUploadLimit = s.value("fileUploadLimit", 0).toInt();
+        resumeTransfers = s.value("resumeTransfers", false).toBool();
         autoSaveEnabled = s.value("autoSaveEnabled", false).toBool();
         autoSaveDir = s.value("autoSaveDir", QStandardPaths::locate(QStandardPaths::HomeLocation, QString(), QStandardPaths::LocateDirectory)).toString();
     s.endGroup();
@@ -152,7 +175,12 @@ void Settings::load()
         typingNotification = s.value("typingNotification", false).toBool();
         enableLogging = s.value("enableLogging", false).toBool();
         encryptLogs = s.value("encryptLogs", false).toBool();
+        compressLogs = s.value("compressLogs", false).toBool();
         encryptTox = s.value("encryptTox", false).toBool();
+        historyDecryptThreads = s.value("historyDecryptThreads", 0).toInt();
+        historyCacheSize = s.value("historyCacheSize", 8).toInt();
+        historyMaxAge = s.value("historyMaxAge", 0).toInt();
+        historyMaxMessages = s.value("historyMaxMessages", 0).toInt();
     s.endGroup();
 
     s.beginGroup("AutoAccept");
@@ -222,9 +250,35 @@ void Settings::save(QString path)
 
     s.beginGroup("Friends");
         s.beginWriteArray("fullAddresses", friendAddresses.size());
-        for (int i = 0; i < friendAddresses.size(); i ++) {
-            s.setArrayIndex(i);
-            s.setValue("addr", friendAddresses[i]);
+        int index = 0;
+        for (const QString& addr : friendAddresses)
+        {
+            s.setArrayIndex(index++);
+            s.setValue("addr", addr);
+        }
+        s.endArray();
+    s.endGroup();
+
+    s.beginGroup("Transfers");
+        s.beginWriteArray("partialDownloads", partialDownloads.size());
+        index = 0;
+        for (auto it = partialDownloads.constBegin(); it != partialDownloads.constEnd(); ++it)
+        {
+            s.setArrayIndex(index++);
+            s.setValue("key", it.key());
+            s.setValue("path", it.value());
+        }
+        s.endArray();
+        s.beginWriteArray("pendingUploads");
+        index = 0;
+        for (auto it = pendingUploads.constBegin(); it != pendingUploads.constEnd(); ++it)
+        {
+            for (const QString& path : it.value())
+            {
+                s.setArrayIndex(index++);
+                s.setValue("id", it.key());
+                s.setValue("path", path);
+            }
         }
         s.endArray();
     s.endGroup();
@@ -241,6 +295,8 @@ void Settings::save(QString path)
         s.setValue("proxyPort", proxyPort);
         s.setValue("currentProfile", currentProfile);
         s.setValue("autoAwayTime", autoAwayTime);
+        s.setValue("fileUploadLimit", fileUploadLimit);
+        s.setValue("resumeTransfers", resumeTransfers);
         s.setValue("autoSaveEnabled", autoSaveEnabled);
         s.setValue("autoSaveDir", autoSaveDir);
     s.endGroup();
@@ -279,7 +335,12 @@ void Settings::save(QString path)
         s.setValue("typingNotification", typingNotification);
         s.setValue("enableLogging", enableLogging);
         s.setValue("encryptLogs", encryptLogs);
+        s.setValue("compressLogs", compressLogs);
         s.setValue("encryptTox", encryptTox);
+        s.setValue("historyDecryptThreads", historyDecryptThreads);
+        s.setValue("historyCacheSize", historyCacheSize);
+        s.setValue("historyMaxAge", historyMaxAge);
+        s.setValue("historyMaxMessages", historyMaxMessages);
     s.endGroup();
 
     s.beginGroup("AutoAccept");
@@ -328,6 +389,15 @@ QPixmap Settings::getSavedAvatar(const QString &ownerId)
     return pic;
 }
 
+QString Settings::getAvatarPath(const QString& ownerId)
+{
+    QDir dir(getSettingsDirPath());
+    QString filePath = dir.filePath("avatars/"+ownerId.left(64)+".png");
+    if (!QFileInfo(filePath).exists())
+        getSavedAvatar(ownerId); // moves an avatar saved by an older version
+    return filePath;
+}
+
 void Settings::saveAvatar(QPixmap& pic, const QString& ownerId)
 {
     QDir dir(getSettingsDirPath());
@@ -555,6 +625,56 @@ void Settings::setEncryptLogs(bool newValue)
     encryptLogs = newValue;
 }
 
+bool Settings::getCompressLogs() const
+{
+    return compressLogs;
+}
+
+void Settings::setCompressLogs(bool newValue)
+{
+    compressLogs = newValue;
+}
+
+int Settings::getHistoryDecryptThreads() const
+{
+    return historyDecryptThreads;
+}
+
+void Settings::setHistoryDecryptThreads(int newValue)
+{
+    historyDecryptThreads = newValue;
+}
+
+int Settings::getHistoryCacheSize() const
+{
+    return historyCacheSize;
+}
+
+void Settings::setHistoryCacheSize(int newValue)
+{
+    historyCacheSize = newValue;
+}
+
+int Settings::getHistoryMaxAge() const
+{
+    return historyMaxAge;
+}
+
+void Settings::setHistoryMaxAge(int newValue)
+{
+    historyMaxAge = newValue;
+}
+
+int Settings::getHistoryMaxMessages() const
+{
+    return historyMaxMessages;
+}
+
+void Settings::setHistoryMaxMessages(int newValue)
+{
+    historyMaxMessages = newValue;
+}
+
 bool Settings::getEncryptTox() const
 {
     return encryptTox;
@@ -577,11 +697,43 @@ void Settings::setAutoAwayTime(int newValue)
     autoAwayTime = newValue;
 }
 
+int Settings::getFileUploadLimit() const
+{
+    return fileUploadLimit;
+}
+
+void Settings::setFileUploadLimit(int newValue)
+{
+    if (newValue < 0)
+        newValue = 0;
+    fileUploadLimit = newValue;
+}
+
+bool Settings::getResumeTransfers() const
+{
+    return resumeTransfers;
+}
+
+void Settings::setResumeTransfers(bool newValue)
+{
+    resumeTransfers = newValue;
+}
+
 QString Settings::getAutoAcceptDir(const QString& id) const
 {
     return autoAccept.value(id.left(TOX_ID_PUBLIC_KEY_LENGTH));
 }
 
+QString Settings::getFriendAddress(const QString& id) const
+{
+    return friendAddresses.value(id.left(TOX_ID_PUBLIC_KEY_LENGTH).toUpper());
+}
+
+void Settings::updateFriendAddress(const QString& newAddr)
+{
+    friendAddresses[newAddr.left(TOX_ID_PUBLIC_KEY_LENGTH).toUpper()] = newAddr;
+}
+
 void Settings::setAutoAcceptDir(const QString& id, const QString& dir)
 {
     if (dir.isEmpty())
@@ -600,6 +752,47 @@ void Settings::setGlobalAutoAcceptDir(const QString& newValue)
     globalAutoAcceptDir = newValue;
 }
 
+static QString partialDownloadKey(const QString& id, const QString& fileName, long long size)
+{
+    return QString("%1/%2/%3").arg(id.left(TOX_ID_PUBLIC_KEY_LENGTH).toUpper()).arg(size).arg(fileName);
+}
+
+QString Settings::getPartialDownload(const QString& id, const QString& fileName, long long size) const
+{
+    return partialDownloads.value(partialDownloadKey(id, fileName, size));
+}
+
+void Settings::setPartialDownload(const QString& id, const QString& fileName, long long size, const QString& path)
+{
+    if (path.isEmpty())
+        partialDownloads.remove(partialDownloadKey(id, fileName, size));
+    else
+        partialDownloads[partialDownloadKey(id, fileName, size)] = path;
+}
+
+QStringList Settings::getPendingUploads(const QString& id) const
+{
+    return pendingUploads.value(id.left(TOX_ID_PUBLIC_KEY_LENGTH).toUpper());
+}
+
+void Settings::addPendingUpload(const QString& id, const QString& path)
+{
+    QStringList& paths = pendingUploads[id.left(TOX_ID_PUBLIC_KEY_LENGTH).toUpper()];
+    if (!paths.contains(path))
+        paths.append(path);
+}
+
+void Settings::removePendingUpload(const QString& id, const QString& path)
+{
+    QString key = id.left(TOX_ID_PUBLIC_KEY_LENGTH).toUpper();
+    auto it = pendingUploads.find(key);
+    if (it == pendingUploads.end())
+        return;
+    it->removeAll(path);
+    if (it->isEmpty())
+        pendingUploads.erase(it);
+}
+
 void Settings::setWidgetData(const QString& uniqueName, const QByteArray& data)
 {
     widgetSettings[uniqueName] = data;
@@ -20,6 +20,7 @@
 #include <QHash>
 #include <QObject>
 #include <QPixmap>
+#include <QStringList>
 
 class Settings : public QObject
 {
@@ -94,13 +95,35 @@ public:
     bool getEncryptLogs() const;
     void setEncryptLogs(bool newValue);
 
+    bool getCompressLogs() const;
+    void setCompressLogs(bool newValue);
+
+    int getHistoryDecryptThreads() const; ///< 0 means one per core
+    void setHistoryDecryptThreads(int newValue);
+
+    int getHistoryCacheSize() const; ///< In MiB, recent messages of the active chats kept in memory
+    void setHistoryCacheSize(int newValue);
+
+    int getHistoryMaxAge() const; ///< In days, older messages are deleted, 0 keeps them all
+    void setHistoryMaxAge(int newValue);
+
+    int getHistoryMaxMessages() const; ///< Per chat, the oldest beyond it are deleted, 0 keeps them all
+    void setHistoryMaxMessages(int newValue);
+
     bool getEncryptTox() const;
     void setEncryptTox(bool newValue);
 
     int getAutoAwayTime() const;
     void setAutoAwayTime(int newValue);
 
+    int getFileUploadLimit() const; ///< In KiB/s over all file transfers, 0 for no limit
+    void setFileUploadLimit(int newValue);
+
+    bool getResumeTransfers() const; ///< Resume interrupted transfers with friends running qTox, across restarts too
+    void setResumeTransfers(bool newValue);
+
     QPixmap getSavedAvatar(const QString& ownerId);
+    QString getAvatarPath(const QString& ownerId); ///< Where the avatar is saved, it may not exist
     void saveAvatar(QPixmap& pic, const QString& ownerId);
 
     QByteArray getAvatarHash(const QString& ownerId);
@@ -155,6 +178,13 @@ public:
     QString getGlobalAutoAcceptDir() const;
     void setGlobalAutoAcceptDir(const QString& dir);
 
+    QString getPartialDownload(const QString& id, const QString& fileName, long long size) const; ///< Where an unfinished download of that file went
+    void setPartialDownload(const QString& id, const QString& fileName, long long size, const QString& path); ///< An empty path forgets it
+
+    QStringList getPendingUploads(const QString& id) const; ///< Files offered to a friend that didn't get all of them yet
+    void addPendingUpload(const QString& id, const QString& path);
+    void removePendingUpload(const QString& id, const QString& path);
+
     // ChatView
     int getFirstColumnHandlePos() const;
     void setFirstColumnHandlePos(const int pos);
@@ -188,8 +218,10 @@ public:
     QByteArray getSplitterState() const;
     void setSplitterState(const QByteArray &value);
 
+    QString getFriendAddress(const QString& id) const; ///< The full address of a friend if known, or an empty string
+    void updateFriendAddress(const QString& newAddr);
+
 public:
-    QList<QString> friendAddresses;
     void save();
     void save(QString path);
     void load();
@@ -228,12 +260,22 @@ private:
 
     bool enableLogging;
     bool encryptLogs;
+    bool compressLogs;
     bool encryptTox;
+    int historyDecryptThreads;
+    int historyCacheSize;
+    int historyMaxAge;
+    int historyMaxMessages;
 
     int autoAwayTime;
+    int fileUploadLimit;
+    bool resumeTransfers;
 
     QHash<QString, QByteArray> widgetSettings;
     QHash<QString, QString> autoAccept;
+    QHash<QString, QString> friendAddresses; ///< Full addresses by upper case public key
+    QHash<QString, QString> partialDownloads; ///< Paths by "public key/size/file name"
+    QHash<QString, QStringList> pendingUploads; ///< Paths by upper case public key
     QString globalAutoAcceptDir;
 
     // GUI
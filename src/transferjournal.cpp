@@ -0,0 +1,242 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+
+#include "transferjournal.h"
+
+#include <QFile>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QDebug>
+
+static const quint32 JOURNAL_MAGIC = 0x71545850; // "qTXP"
+static const quint16 JOURNAL_VERSION = 1;
+
+TransferJournal::TransferJournal(const QString& filePath, long long filesize)
+    : filePath(filePath)
+    , filesize(filesize)
+    , hasher(QCryptographicHash::Md5)
+    , hashingBlock(-1)
+    , hashedBytes(0)
+    , verifyEnd(0)
+    , dirty(false)
+{
+    received.resize(blockCount());
+    checksums.resize(blockCount());
+    lastSave.start();
+}
+
+int TransferJournal::blockCount() const
+{
+    return (filesize + TRANSFER_JOURNAL_BLOCK_SIZE - 1) / TRANSFER_JOURNAL_BLOCK_SIZE;
+}
+
+int TransferJournal::blockLength(int block) const
+{
+    return blockLength(filesize, block);
+}
+
+int TransferJournal::blockLength(long long filesize, int block)
+{
+    return qMin<long long>(TRANSFER_JOURNAL_BLOCK_SIZE, filesize - (long long)block * TRANSFER_JOURNAL_BLOCK_SIZE);
+}
+
+QString TransferJournal::journalPath() const
+{
+    return filePath + TRANSFER_JOURNAL_SUFFIX;
+}
+
+bool TransferJournal::exists(const QString& filePath)
+{
+    return QFile::exists(filePath + TRANSFER_JOURNAL_SUFFIX) && QFile::exists(filePath);
+}
+
+bool TransferJournal::load()
+{
+    QFile file(journalPath());
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream stream(&file);
+    quint32 magic;
+    quint16 version;
+    qint64 savedSize;
+    qint32 blockSize;
+    QBitArray savedReceived;
+    QVector<QByteArray> savedChecksums;
+    stream >> magic >> version >> savedSize >> blockSize >> savedReceived >> savedChecksums;
+
+    if (stream.status() != QDataStream::Ok || magic != JOURNAL_MAGIC || version != JOURNAL_VERSION
+            || savedSize != filesize || blockSize != TRANSFER_JOURNAL_BLOCK_SIZE
+            || savedReceived.size() != blockCount() || savedChecksums.size() != blockCount())
+    {
+        qWarning() << "TransferJournal: Ignoring the journal of" << filePath << ", it doesn't match";
+        return false;
+    }
+
+    received = savedReceived;
+    checksums = savedChecksums;
+    dirty = false;
+    return true;
+}
+
+bool TransferJournal::save()
+{
+    QSaveFile file(journalPath());
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        qWarning() << "TransferJournal: Unable to save the journal of" << filePath << file.errorString();
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream << JOURNAL_MAGIC << JOURNAL_VERSION << (qint64)filesize << (qint32)TRANSFER_JOURNAL_BLOCK_SIZE
+           << received << checksums;
+    if (!file.commit())
+    {
+        qWarning() << "TransferJournal: Unable to save the journal of" << filePath << file.errorString();
+        return false;
+    }
+
+    dirty = false;
+    lastSave.restart();
+    return true;
+}
+
+void TransferJournal::remove()
+{
+    QFile::remove(journalPath());
+}
+
+long long TransferJournal::resumeOffset()
+{
+    int firstMissing = 0;
+    while (firstMissing < received.size() && received.testBit(firstMissing))
+        ++firstMissing;
+
+    // Only the tail can be torn by a crash, what came before was saved long after it was written
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly))
+        firstMissing = 0;
+    for (int block = qMax(0, firstMissing - TRANSFER_JOURNAL_VERIFY_BLOCKS); block < firstMissing; ++block)
+    {
+        QByteArray data;
+        if (file.seek((long long)block * TRANSFER_JOURNAL_BLOCK_SIZE))
+            data = file.read(blockLength(block));
+        if (data.size() == blockLength(block)
+                && QCryptographicHash::hash(data, QCryptographicHash::Md5) == checksums[block])
+            continue;
+
+        qWarning() << "TransferJournal: Block" << block << "of" << filePath << "is damaged, fetching it again";
+        for (int i = block; i < firstMissing; ++i)
+            received.clearBit(i);
+        firstMissing = block;
+        dirty = true;
+        break;
+    }
+
+    if (firstMissing == 0)
+    {
+        verifyEnd = 0;
+        return 0;
+    }
+    long long offset = (long long)(firstMissing - 1) * TRANSFER_JOURNAL_BLOCK_SIZE;
+    verifyEnd = offset + blockLength(firstMissing - 1);
+    return offset;
+}
+
+long long TransferJournal::getVerifyEnd() const
+{
+    return verifyEnd;
+}
+
+QByteArray TransferJournal::resumeDigest(long long offset) const
+{
+    QCryptographicHash digest(QCryptographicHash::Md5);
+    for (int block = 0; block <= offset / TRANSFER_JOURNAL_BLOCK_SIZE && block < blockCount(); ++block)
+        digest.addData(checksums[block]);
+    return digest.result();
+}
+
+QByteArray TransferJournal::resumeDigest(const QString& filePath, long long filesize, long long offset)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly) || file.size() != filesize)
+        return QByteArray();
+
+    QCryptographicHash digest(QCryptographicHash::Md5);
+    int blocks = (filesize + TRANSFER_JOURNAL_BLOCK_SIZE - 1) / TRANSFER_JOURNAL_BLOCK_SIZE;
+    for (int block = 0; block <= offset / TRANSFER_JOURNAL_BLOCK_SIZE && block < blocks; ++block)
+    {
+        QByteArray data = file.read(blockLength(filesize, block));
+        if (data.size() != blockLength(filesize, block))
+            return QByteArray();
+        digest.addData(QCryptographicHash::hash(data, QCryptographicHash::Md5));
+    }
+    return digest.result();
+}
+
+bool TransferJournal::addData(long long position, const QByteArray& data)
+{
+    int offset = 0;
+    while (offset < data.size())
+    {
+        long long pos = position + offset;
+        int block = pos / TRANSFER_JOURNAL_BLOCK_SIZE;
+        long long blockStart = (long long)block * TRANSFER_JOURNAL_BLOCK_SIZE;
+
+        if (block != hashingBlock || pos != blockStart + hashedBytes)
+        {
+            if (pos != blockStart)
+            {
+                // Joined in the middle of a block, it can't be checksummed and will be fetched again on resume
+                hashingBlock = -1;
+                offset += qMin<long long>(data.size() - offset, blockStart + blockLength(block) - pos);
+                continue;
+            }
+            hasher.reset();
+            hashingBlock = block;
+            hashedBytes = 0;
+        }
+
+        int length = qMin(data.size() - offset, blockLength(block) - hashedBytes);
+        hasher.addData(data.constData() + offset, length);
+        hashedBytes += length;
+        offset += length;
+
+        if (hashedBytes < blockLength(block))
+            continue;
+
+        QByteArray checksum = hasher.result();
+        hashingBlock = -1;
+        if (received.testBit(block) && checksums[block] != checksum)
+        {
+            qWarning() << "TransferJournal: Block" << block << "of" << filePath << "doesn't match what we had";
+            return false;
+        }
+        received.setBit(block);
+        checksums[block] = checksum;
+        dirty = true;
+        if (blockStart + blockLength(block) >= verifyEnd)
+            verifyEnd = 0;
+    }
+    return true;
+}
+
+bool TransferJournal::needsSave() const
+{
+    return dirty && lastSave.elapsed() >= TRANSFER_JOURNAL_SAVE_INTERVAL;
+}
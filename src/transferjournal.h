@@ -0,0 +1,80 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+
+#ifndef TRANSFERJOURNAL_H
+#define TRANSFERJOURNAL_H
+
+#include <QString>
+#include <QBitArray>
+#include <QVector>
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QElapsedTimer>
+
+#define TRANSFER_JOURNAL_BLOCK_SIZE 1048576 // bytes covered by each bit and checksum of the journal
+#define TRANSFER_JOURNAL_VERIFY_BLOCKS 2 // blocks read back from disk and checked before a download resumes
+#define TRANSFER_JOURNAL_SAVE_INTERVAL 5000 // ms, at most this much received data is lost on a crash
+#define TRANSFER_JOURNAL_SUFFIX ".qtoxpart"
+#define TRANSFER_JOURNAL_DIGEST_SIZE 16 // bytes, the MD5 a resume offer proves the start of the file with
+
+/// What has been received of a download, kept next to the file so it can be resumed after a restart.
+/// The file is split in blocks, each with a received bit and a checksum of its content.
+/// Owned by the file writer while the download runs, not thread safe
+class TransferJournal
+{
+public:
+    TransferJournal(const QString& filePath, long long filesize); ///< Starts out empty
+
+    bool load(); ///< False if there is no journal for this file or it doesn't match
+    bool save(); ///< Atomically replaces the saved journal
+    void remove(); ///< Deletes the saved journal
+    static bool exists(const QString& filePath);
+
+    /// Checks the last few blocks we have against the file on disk, and returns where the download should go on.
+    /// That is the start of the last block we have, which is fetched again and must match its checksum
+    long long resumeOffset();
+    long long getVerifyEnd() const; ///< Data before this must match what we had before it's written, 0 once it did
+
+    /// Digest of the checksums of the blocks up to and including the one at offset, what the sender has to match
+    QByteArray resumeDigest(long long offset) const;
+    /// The same digest, computed from a whole file by the sender. Empty if it can't be read
+    static QByteArray resumeDigest(const QString& filePath, long long filesize, long long offset);
+
+    /// Data that was written at position, in order. False if it contradicts a block we had already
+    bool addData(long long position, const QByteArray& data);
+    bool needsSave() const; ///< Something changed and the last save is old enough
+
+private:
+    int blockCount() const;
+    int blockLength(int block) const;
+    static int blockLength(long long filesize, int block);
+    QString journalPath() const;
+
+private:
+    QString filePath;
+    long long filesize;
+    QBitArray received;
+    QVector<QByteArray> checksums;
+    QCryptographicHash hasher;
+    int hashingBlock; ///< Being hashed as it arrives, -1 when between blocks
+    int hashedBytes;
+    long long verifyEnd;
+    bool dirty;
+    QElapsedTimer lastSave;
+};
+
+#endif // TRANSFERJOURNAL_H
@@ -195,3 +195,18 @@ void ChatAreaWidget::insertMessagesTop(QList<ChatActionPtr> &list)
         insertMessage(it, QTextCursor::Start);
     }
 }
+
+void ChatAreaWidget::insertMessagesBottom(QList<ChatActionPtr> &list)
+{
+    QScrollBar* scroll = verticalScrollBar();
+    int savedSliderPos = scroll->value();
+
+    for (ChatActionPtr it : list)
+    {
+        insertMessage(it);
+    }
+
+    // the caller loads more once the bottom is reached again
+    lockSliderToBottom = false;
+    scroll->setValue(savedSliderPos);
+}
@@ -31,6 +31,7 @@ public:
     virtual ~ChatAreaWidget();
     void insertMessage(ChatActionPtr msgAction, QTextCursor::MoveOperation pos = QTextCursor::End);
     void insertMessagesTop(QList<ChatActionPtr> &list);
+    void insertMessagesBottom(QList<ChatActionPtr> &list); ///< Keeps the view where it is
 
     int nameColWidth() {return nameWidth;}
     void setNameColWidth(int w);
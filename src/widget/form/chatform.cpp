@@ -26,6 +26,7 @@
 #include "chatform.h"
 #include "src/historykeeper.h"
 #include "src/widget/form/loadhistorydialog.h"
+#include "src/widget/form/historysearchdialog.h"
 #include "src/friend.h"
 #include "src/widget/friendwidget.h"
 #include "src/filetransferinstance.h"
@@ -34,11 +35,13 @@
 #include "src/widget/chatareawidget.h"
 #include "src/widget/tool/chattextedit.h"
 #include "src/core.h"
+#include "src/coredispatcher.h"
 #include "src/widget/widget.h"
 #include "src/widget/maskablepixmapwidget.h"
 #include "src/widget/croppinglabel.h"
 #include "src/misc/style.h"
 #include "src/misc/settings.h"
+#include "src/misc/avatarcache.h"
 
 ChatForm::ChatForm(Friend* chatFriend)
     : f(chatFriend)
@@ -48,14 +51,24 @@ ChatForm::ChatForm(Friend* chatFriend)
 {
     nameLabel->setText(f->getName());
 
-    avatar->setPixmap(QPixmap(":/img/contact_dark.png"), Qt::transparent);
+    QPixmap savedAvatar;
+    QColor avatarBackground;
+    if (AvatarCache::getInstance().lookup(f->userId, savedAvatar, avatarBackground))
+    {
+        avatar->setPixmap(savedAvatar, avatarBackground);
+    }
+    else
+    {
+        avatar->setPixmap(QPixmap(":/img/contact_dark.png"), Qt::transparent);
+        AvatarCache::getInstance().request(f->userId);
+    }
 
     statusMessageLabel = new CroppingLabel();
     statusMessageLabel->setObjectName("statusLabel");
     statusMessageLabel->setFont(Style::getFont(Style::Medium));
     statusMessageLabel->setMinimumHeight(Style::getFont(Style::Medium).pixelSize());
 
-    netcam = new NetCamView();
+    netcam = nullptr; // only built for video calls
     timer = nullptr;
 
     headTextLayout->addWidget(statusMessageLabel);
@@ -65,8 +78,11 @@ ChatForm::ChatForm(Friend* chatFriend)
     callDuration->hide();    
 
     menu.addAction(tr("Load History..."), this, SLOT(onLoadHistory()));
+    menu.addAction(tr("Search History..."), this, SLOT(onSearchHistory()));
+
+    historyType = HistoryKeeper::ctSingle;
+    historyChat = f->userId;
 
-    connect(Core::getInstance(), &Core::fileSendStarted, this, &ChatForm::startFileSend);
     connect(sendButton, &QPushButton::clicked, this, &ChatForm::onSendTriggered);
     connect(fileButton, &QPushButton::clicked, this, &ChatForm::onAttachClicked);
     connect(callButton, &QPushButton::clicked, this, &ChatForm::onCallTriggered);
@@ -75,7 +91,18 @@ ChatForm::ChatForm(Friend* chatFriend)
     connect(micButton, SIGNAL(clicked()), this, SLOT(onMicMuteToggle()));
     connect(volButton, SIGNAL(clicked()), this, SLOT(onVolMuteToggle()));
     connect(chatWidget, &ChatAreaWidget::onFileTranfertInterract, this, &ChatForm::onFileTansBtnClicked);
-    connect(Core::getInstance(), &Core::fileSendFailed, this, &ChatForm::onFileSendFailed);
+
+    Core* core = Core::getInstance();
+    connect(this, SIGNAL(sendMessage(int,QString)), core, SLOT(sendMessage(int,QString)));
+    connect(this, &GenericChatForm::sendAction, core, &Core::sendAction);
+    connect(this, SIGNAL(sendFile(int32_t, QString, QString, long long)), core, SLOT(sendFile(int32_t, QString, QString, long long)));
+    connect(this, SIGNAL(answerCall(int)), core, SLOT(answerCall(int)));
+    connect(this, SIGNAL(hangupCall(int)), core, SLOT(hangupCall(int)));
+    connect(this, SIGNAL(startCall(int)), core, SLOT(startCall(int)));
+    connect(this, SIGNAL(startVideoCall(int,bool)), core, SLOT(startCall(int,bool)));
+    connect(this, SIGNAL(cancelCall(int,int)), core, SLOT(cancelCall(int,int)));
+    connect(this, SIGNAL(micMuteToggle(int)), core, SLOT(micMuteToggle(int)));
+    connect(this, SIGNAL(volMuteToggle(int)), core, SLOT(volMuteToggle(int)));
 
     setAcceptDrops(true);
 }
@@ -146,13 +173,7 @@ void ChatForm::startFileSend(ToxFile file)
     FileTransferInstance* fileTrans = new FileTransferInstance(file);
     ftransWidgets.insert(fileTrans->getId(), fileTrans);
 
-    connect(Core::getInstance(), &Core::fileTransferInfo, fileTrans, &FileTransferInstance::onFileTransferInfo);
-    connect(Core::getInstance(), &Core::fileTransferCancelled, fileTrans, &FileTransferInstance::onFileTransferCancelled);
-    connect(Core::getInstance(), &Core::fileTransferFinished, fileTrans, &FileTransferInstance::onFileTransferFinished);
-    connect(Core::getInstance(), SIGNAL(fileTransferAccepted(ToxFile)), fileTrans, SLOT(onFileTransferAccepted(ToxFile)));
-    connect(Core::getInstance(), SIGNAL(fileTransferPaused(int,int,ToxFile::FileDirection)), fileTrans, SLOT(onFileTransferPaused(int,int,ToxFile::FileDirection)));
-    connect(Core::getInstance(), SIGNAL(fileTransferRemotePausedUnpaused(ToxFile,bool)), fileTrans, SLOT(onFileTransferRemotePausedUnpaused(ToxFile,bool)));
-    connect(Core::getInstance(), SIGNAL(fileTransferBrokenUnbroken(ToxFile, bool)), fileTrans, SLOT(onFileTransferBrokenUnbroken(ToxFile, bool)));
+    Widget::getInstance()->getCoreDispatcher()->subscribeTransfer(file.friendId, file.fileNum, file.direction, fileTrans);
 
     QString name;
     if (!previousId.isMine())
@@ -174,13 +195,7 @@ void ChatForm::onFileRecvRequest(ToxFile file)
     FileTransferInstance* fileTrans = new FileTransferInstance(file);
     ftransWidgets.insert(fileTrans->getId(), fileTrans);
 
-    connect(Core::getInstance(), &Core::fileTransferInfo, fileTrans, &FileTransferInstance::onFileTransferInfo);
-    connect(Core::getInstance(), &Core::fileTransferCancelled, fileTrans, &FileTransferInstance::onFileTransferCancelled);
-    connect(Core::getInstance(), &Core::fileTransferFinished, fileTrans, &FileTransferInstance::onFileTransferFinished);
-    connect(Core::getInstance(), SIGNAL(fileTransferAccepted(ToxFile)), fileTrans, SLOT(onFileTransferAccepted(ToxFile)));
-    connect(Core::getInstance(), SIGNAL(fileTransferPaused(int,int,ToxFile::FileDirection)), fileTrans, SLOT(onFileTransferPaused(int,int,ToxFile::FileDirection)));
-    connect(Core::getInstance(), SIGNAL(fileTransferRemotePausedUnpaused(ToxFile,bool)), fileTrans, SLOT(onFileTransferRemotePausedUnpaused(ToxFile,bool)));
-    connect(Core::getInstance(), SIGNAL(fileTransferBrokenUnbroken(ToxFile, bool)), fileTrans, SLOT(onFileTransferBrokenUnbroken(ToxFile, bool)));
+    Widget::getInstance()->getCoreDispatcher()->subscribeTransfer(file.friendId, file.fileNum, file.direction, fileTrans);
 
     Widget* w = Widget::getInstance();
     if (!w->isFriendWidgetCurActiveWidget(f)|| w->isMinimized() || !w->isActiveWindow())
@@ -201,6 +216,7 @@ void ChatForm::onFileRecvRequest(ToxFile file)
     chatWidget->insertMessage(ChatActionPtr(new FileTransferAction(fileTrans, getElidedName(name),
                                                                    QTime::currentTime().toString("hh:mm"), false)));
 
+    // A file we have part of is only resumed once accepted, like any other
     if (!Settings::getInstance().getAutoAcceptDir(Core::getInstance()->getFriendAddress(f->friendId)).isEmpty()
      || !Settings::getInstance().getGlobalAutoAcceptDir().isEmpty())
         fileTrans->pressFromHtml("btnB");
@@ -263,7 +279,7 @@ void ChatForm::onAvStart(int FriendId, int CallId, bool video)
         videoButton->style()->polish(videoButton);
         connect(videoButton, SIGNAL(clicked()), this, SLOT(onHangupCallTriggered()));
 
-        netcam->show(Core::getInstance()->getVideoSourceFromCall(CallId), f->getName());
+        showNetcam(CallId);
     }
     else
     {
@@ -299,7 +315,7 @@ void ChatForm::onAvCancel(int FriendId, int)
     connect(callButton, SIGNAL(clicked()), this, SLOT(onCallTriggered()));
     connect(videoButton, SIGNAL(clicked()), this, SLOT(onVideoCallTriggered()));
 
-    netcam->hide();
+    hideNetcam();
     
     addSystemInfoMessage(tr("%1 stopped calling").arg(f->getName()), "white", QDateTime::currentDateTime());        
 }
@@ -326,7 +342,7 @@ void ChatForm::onAvEnd(int FriendId, int)
     connect(callButton, SIGNAL(clicked()), this, SLOT(onCallTriggered()));
     connect(videoButton, SIGNAL(clicked()), this, SLOT(onVideoCallTriggered()));
 
-    netcam->hide();
+    hideNetcam();
     
     stopCounter();
 }
@@ -377,7 +393,7 @@ void ChatForm::onAvStarting(int FriendId, int CallId, bool video)
         videoButton->style()->polish(videoButton);
         connect(videoButton, SIGNAL(clicked()), this, SLOT(onHangupCallTriggered()));
 
-        netcam->show(Core::getInstance()->getVideoSourceFromCall(CallId), f->getName());
+        showNetcam(CallId);
     }
     else
     {
@@ -415,7 +431,7 @@ void ChatForm::onAvEnding(int FriendId, int)
     connect(callButton, SIGNAL(clicked()), this, SLOT(onCallTriggered()));
     connect(videoButton, SIGNAL(clicked()), this, SLOT(onVideoCallTriggered()));
     
-    netcam->hide();
+    hideNetcam();
         
     stopCounter();
 }
@@ -444,7 +460,7 @@ void ChatForm::onAvRequestTimeout(int FriendId, int)
     connect(callButton, SIGNAL(clicked()), this, SLOT(onCallTriggered()));
     connect(videoButton, SIGNAL(clicked()), this, SLOT(onVideoCallTriggered()));
 
-    netcam->hide();
+    hideNetcam();
 }
 
 void ChatForm::onAvPeerTimeout(int FriendId, int)
@@ -471,7 +487,7 @@ void ChatForm::onAvPeerTimeout(int FriendId, int)
     connect(callButton, SIGNAL(clicked()), this, SLOT(onCallTriggered()));
     connect(videoButton, SIGNAL(clicked()), this, SLOT(onVideoCallTriggered()));
 
-    netcam->hide();
+    hideNetcam();
 }
 
 void ChatForm::onAvRejected(int FriendId, int)
@@ -500,7 +516,7 @@ void ChatForm::onAvRejected(int FriendId, int)
     
     addSystemInfoMessage(tr("Call rejected"), "white", QDateTime::currentDateTime());
 
-    netcam->hide();
+    hideNetcam();
 }
 
 void ChatForm::onAvMediaChange(int FriendId, int CallId, bool video)
@@ -512,11 +528,11 @@ void ChatForm::onAvMediaChange(int FriendId, int CallId, bool video)
 
     if (video)
     {
-        netcam->show(Core::getInstance()->getVideoSourceFromCall(CallId), f->getName());
+        showNetcam(CallId);
     }
     else
     {
-        netcam->hide();
+        hideNetcam();
     }
 }
 
@@ -600,7 +616,7 @@ void ChatForm::onCancelCallTriggered()
     connect(callButton, SIGNAL(clicked()), this, SLOT(onCallTriggered()));
     connect(videoButton, SIGNAL(clicked()), this, SLOT(onVideoCallTriggered()));
 
-    netcam->hide();
+    hideNetcam();
     emit cancelCall(callId, f->friendId);    
 }
 
@@ -652,12 +668,23 @@ void ChatForm::onFileSendFailed(int FriendId, const QString &fname)
     addSystemInfoMessage("File: \"" + fname + "\" failed to send.", "red", QDateTime::currentDateTime());
 }
 
-void ChatForm::onAvatarChange(int FriendId, const QPixmap &pic)
+void ChatForm::showNetcam(int CallId)
 {
-    if (FriendId != f->friendId)
-        return;
+    if (!netcam)
+        netcam = new NetCamView();
+
+    netcam->show(Core::getInstance()->getVideoSourceFromCall(CallId), f->getName());
+}
 
-    avatar->setPixmap(pic);
+void ChatForm::hideNetcam()
+{
+    if (netcam)
+        netcam->hide();
+}
+
+void ChatForm::setAvatar(const QPixmap& pic, const QColor& background)
+{
+    avatar->setPixmap(pic, background);
 }
 
 void ChatForm::dragEnterEvent(QDragEnterEvent *ev)
@@ -695,45 +722,28 @@ void ChatForm::onLoadHistory()
     if (dlg.exec())
     {
         QDateTime fromTime = dlg.getFromDate();
-        QDateTime toTime = QDateTime::currentDateTime();
-
-        if (fromTime > toTime)
+        if (fromTime > QDateTime::currentDateTime())
             return;
 
-        if (earliestMessage)
-        {
-            if (*earliestMessage < fromTime)
-                return;
-            if (*earliestMessage < toTime)
-            {
-                toTime = *earliestMessage;
-                toTime = toTime.addMSecs(-1);
-            }
-        }
-
-        auto msgs = HistoryKeeper::getInstance()->getChatHistory(HistoryKeeper::ctSingle, f->userId, fromTime, toTime);
-
-        ToxID storedPrevId;
-        std::swap(storedPrevId, previousId);
-        QList<ChatActionPtr> historyMessages;
-
-        for (const auto &it : msgs)
-        {
-            ChatActionPtr ca = genMessageActionAction(ToxID::fromString(it.sender), it.message, false, it.timestamp.toLocalTime());
-            historyMessages.append(ca);
-        }
-        std::swap(storedPrevId, previousId);
+        seekHistory({fromTime, -1});
+    }
+}
 
-        int savedSliderPos = chatWidget->verticalScrollBar()->maximum() - chatWidget->verticalScrollBar()->value();
+void ChatForm::onSearchHistory()
+{
+    HistorySearchDialog dlg;
 
-        if (earliestMessage != nullptr)
-            *earliestMessage = fromTime;
+    if (dlg.exec())
+        Widget::getInstance()->showHistoryMessage(dlg.getSelectedResult());
+}
 
-        chatWidget->insertMessagesTop(historyMessages);
+QHash<QString, QString> ChatForm::getHistoryNames()
+{
+    QHash<QString, QString> names;
+    names[f->userId] = f->getName();
+    names[Core::getInstance()->getSelfId().publicKey] = Core::getInstance()->getUsername();
 
-        savedSliderPos = chatWidget->verticalScrollBar()->maximum() - savedSliderPos;
-        chatWidget->verticalScrollBar()->setValue(savedSliderPos);
-    }
+    return names;
 }
 
 void ChatForm::startCounter()
@@ -35,6 +35,7 @@ public:
     ChatForm(Friend* chatFriend);
     ~ChatForm();
     void setStatusMessage(QString newMessage);
+    void setAvatar(const QPixmap& pic, const QColor& background);
 
 signals:
     void sendFile(int32_t friendId, QString, QString, long long);
@@ -63,8 +64,8 @@ public slots:
     void onAvRejected(int FriendId, int CallId);
     void onMicMuteToggle();
     void onVolMuteToggle();
-    void onAvatarChange(int FriendId, const QPixmap& pic);
     void onAvatarRemoved(int FriendId);
+    void onFileSendFailed(int FriendId, const QString &fname);
 
 private slots:
     void onSendTriggered();
@@ -75,11 +76,13 @@ private slots:
     void onHangupCallTriggered();
     void onCancelCallTriggered();
     void onFileTansBtnClicked(QString widgetName, QString buttonName);
-    void onFileSendFailed(int FriendId, const QString &fname);
     void onLoadHistory();
+    void onSearchHistory();
     void updateTime();    
 
 protected:
+    virtual QHash<QString, QString> getHistoryNames();
+
     // drag & drop
     void dragEnterEvent(QDragEnterEvent* ev);
     void dropEvent(QDropEvent* ev);
@@ -98,6 +101,8 @@ private:
     QHash<uint, FileTransferInstance*> ftransWidgets;
     void startCounter();
     void stopCounter();
+    void showNetcam(int CallId);
+    void hideNetcam();
     QString secondsToDHMS(quint32 duration);
 };
 
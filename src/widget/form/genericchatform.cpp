@@ -31,10 +31,22 @@
 #include "src/widget/tool/chattextedit.h"
 #include "src/widget/maskablepixmapwidget.h"
 #include "src/core.h"
+#include "src/historyexporter.h"
+#include "src/widget/form/historyretentiondialog.h"
+
+#include <QScrollBar>
+#include <QProgressDialog>
+#include <QMessageBox>
 
 GenericChatForm::GenericChatForm(QWidget *parent) :
     QWidget(parent),
-    earliestMessage(nullptr)
+    earliestMessage(nullptr),
+    exportProgress(nullptr),
+    historyType(HistoryKeeper::ctSingle),
+    historyTopReached(false),
+    historyDetached(false),
+    historyStarted(false),
+    loadingHistory(false)
 {
     curRow = 0;
 
@@ -138,11 +150,13 @@ GenericChatForm::GenericChatForm(QWidget *parent) :
     emoteButton->setAttribute(Qt::WA_LayoutUsesWidgetRect);
 
     menu.addAction(tr("Save chat log"), this, SLOT(onSaveLogClicked()));
+    menu.addAction(tr("History retention..."), this, SLOT(onRetentionClicked()));
     menu.addAction(tr("Clear displayed messages"), this, SLOT(clearChatArea(bool)));
     menu.addSeparator();
 
     connect(emoteButton,  SIGNAL(clicked()), this, SLOT(onEmoteButtonClicked()));
     connect(chatWidget, SIGNAL(customContextMenuRequested(QPoint)), this, SLOT(onChatContextMenuRequested(QPoint)));
+    connect(chatWidget->verticalScrollBar(), &QScrollBar::valueChanged, this, &GenericChatForm::onChatScrolled);
 
     chatWidget->document()->setDefaultStyleSheet(Style::getStylesheet(":ui/chatArea/innerStyle.css"));
     chatWidget->setStyleSheet(Style::getStylesheet(":/ui/chatArea/chatArea.css"));
@@ -166,6 +180,12 @@ void GenericChatForm::show(Ui::MainWindow &ui)
     ui.mainHead->layout()->addWidget(headWidget);
     headWidget->show();
     QWidget::show();
+
+    if (!historyStarted)
+    {
+        historyStarted = true;
+        loadOlderHistory();
+    }
 }
 
 void GenericChatForm::onChatContextMenuRequested(QPoint pos)
@@ -176,6 +196,68 @@ void GenericChatForm::onChatContextMenuRequested(QPoint pos)
 }
 
 void GenericChatForm::onSaveLogClicked()
+{
+    if (historyChat.isEmpty())
+    {
+        saveRenderedLog();
+        return;
+    }
+
+    if (exportProgress)
+        return; // one export at a time
+
+    QString path = QFileDialog::getSaveFileName(0, tr("Save chat log"), QString(),
+                                                tr("Text files (*.txt);;JSON lines (*.jsonl);;HTML (*.html)"));
+    if (path.isEmpty())
+        return;
+
+    HistoryExporter* exporter = new HistoryExporter(historyType, historyChat, path,
+                                                    HistoryExporter::formatForFile(path), getHistoryNames());
+
+    exportProgress = new QProgressDialog(tr("Saving chat log..."), tr("Cancel"), 0, 0, this);
+    exportProgress->setWindowModality(Qt::WindowModal);
+    exportProgress->setMinimumDuration(500);
+
+    connect(exportProgress, &QProgressDialog::canceled, exporter, &HistoryExporter::cancel, Qt::DirectConnection);
+    connect(exporter, &HistoryExporter::progress, exportProgress, [this](int exported, int total)
+    {
+        exportProgress->setMaximum(total);
+        exportProgress->setValue(exported);
+    });
+    connect(exporter, &HistoryExporter::finished, this, &GenericChatForm::onExportFinished);
+
+    exporter->start();
+}
+
+void GenericChatForm::onExportFinished(bool success, const QString &error)
+{
+    bool cancelled = exportProgress->wasCanceled();
+    exportProgress->deleteLater();
+    exportProgress = nullptr;
+
+    if (!success && !cancelled)
+        QMessageBox::warning(this, tr("Save chat log"), tr("The chat log couldn't be saved: %1").arg(error));
+}
+
+void GenericChatForm::onRetentionClicked()
+{
+    if (historyChat.isEmpty())
+        return;
+
+    HistoryKeeper::RetentionRule rule{0, 0};
+    bool hasRule = HistoryKeeper::getInstance()->getChatRetention(historyType, historyChat, rule);
+
+    HistoryRetentionDialog dialog(hasRule, rule, this);
+    if (dialog.exec())
+        HistoryKeeper::getInstance()->setChatRetention(historyType, historyChat, dialog.hasRule(), dialog.getRule());
+}
+
+QHash<QString, QString> GenericChatForm::getHistoryNames()
+{
+    return QHash<QString, QString>();
+}
+
+void GenericChatForm::saveRenderedLog()
 {
     QString path = QFileDialog::getSaveFileName(0, tr("Save chat log"));
     if (path.isEmpty())
@@ -203,12 +285,21 @@ void GenericChatForm::addMessage(const QString& author, const QString &message,
 
 void GenericChatForm::addMessage(const ToxID& author, const QString &message, bool isAction, const QDateTime &datetime)
 {
+    if (historyDetached)
+        return; // it's in the history, it will be shown once the view is scrolled down to it
+
     ChatActionPtr ca = genMessageActionAction(author, message, isAction, datetime);
     chatWidget->insertMessage(ca);
 }
 
 void GenericChatForm::addSelfMessage(const QString &message, bool isAction, const QDateTime &datetime)
 {
+    if (historyDetached)
+    {
+        returnToPresent(); // the message is already in the history
+        return;
+    }
+
     ChatActionPtr ca = genSelfActionAction(message, isAction, datetime);
     chatWidget->insertMessage(ca);
 }
@@ -291,6 +382,106 @@ void GenericChatForm::clearChatArea(bool notinform)
         delete earliestMessage;
         earliestMessage = nullptr;
     }
+
+    historyTop = historyBottom = HistoryKeeper::HistCursor();
+    historyTopReached = false;
+    historyDetached = false;
+}
+
+void GenericChatForm::onChatScrolled(int value)
+{
+    QScrollBar* scroll = chatWidget->verticalScrollBar();
+    if (value == scroll->minimum())
+        loadOlderHistory();
+    else if (value == scroll->maximum())
+        loadNewerHistory();
+}
+
+ChatActionPtr GenericChatForm::genHistoryAction(const HistoryKeeper::HistMessage &msg)
+{
+    return genMessageActionAction(ToxID::fromString(msg.sender), msg.message, false, msg.timestamp.toLocalTime());
+}
+
+void GenericChatForm::loadOlderHistory()
+{
+    if (historyChat.isEmpty() || historyTopReached || loadingHistory)
+        return;
+
+    loadingHistory = true;
+    QList<HistoryKeeper::HistMessage> msgs;
+    if (!historyTop.timestamp.isValid() && !earliestMessage)
+    {
+        // nothing shown yet, the newest page is usually in memory
+        msgs = HistoryKeeper::getInstance()->getRecentChatHistory(historyType, historyChat, HISTORY_PAGE_SIZE);
+    } else {
+        // continue right before the oldest message shown, those of this session don't have an id
+        if (!historyTop.timestamp.isValid())
+            historyTop = {*earliestMessage, -1};
+
+        msgs = HistoryKeeper::getInstance()->getChatHistoryBefore(historyType, historyChat, historyTop, HISTORY_PAGE_SIZE);
+    }
+    historyTopReached = msgs.size() < HISTORY_PAGE_SIZE;
+
+    if (!msgs.isEmpty())
+    {
+        historyTop = {msgs.first().timestamp, msgs.first().id};
+
+        ToxID storedPrevId;
+        std::swap(storedPrevId, previousId);
+        QList<ChatActionPtr> historyMessages;
+        for (const auto &it : msgs)
+            historyMessages.append(genHistoryAction(it));
+        std::swap(storedPrevId, previousId);
+
+        QScrollBar* scroll = chatWidget->verticalScrollBar();
+        int savedSliderPos = scroll->maximum() - scroll->value();
+
+        chatWidget->insertMessagesTop(historyMessages);
+
+        scroll->setValue(scroll->maximum() - savedSliderPos);
+    }
+    loadingHistory = false;
+}
+
+void GenericChatForm::loadNewerHistory()
+{
+    if (historyChat.isEmpty() || !historyDetached || loadingHistory)
+        return;
+
+    loadingHistory = true;
+    auto msgs = HistoryKeeper::getInstance()->getChatHistoryAfter(historyType, historyChat, historyBottom, HISTORY_PAGE_SIZE);
+    historyDetached = msgs.size() == HISTORY_PAGE_SIZE; // caught up, new messages are shown as they come again
+
+    if (!msgs.isEmpty())
+    {
+        historyBottom = {msgs.last().timestamp, msgs.last().id};
+
+        QList<ChatActionPtr> historyMessages;
+        for (const auto &it : msgs)
+            historyMessages.append(genHistoryAction(it));
+
+        chatWidget->insertMessagesBottom(historyMessages);
+    }
+    loadingHistory = false;
+}
+
+void GenericChatForm::seekHistory(const HistoryKeeper::HistCursor &at)
+{
+    clearChatArea(true);
+
+    // both cursors are exclusive, ids are whole numbers so the one right before at makes it the first message shown
+    historyTop = at;
+    historyBottom = {at.timestamp, at.id - 1};
+    historyDetached = true;
+
+    loadNewerHistory();
+    loadOlderHistory(); // some context above, the view stays on the first message shown
+}
+
+void GenericChatForm::returnToPresent()
+{
+    clearChatArea(true);
+    loadOlderHistory();
 }
 
 /**
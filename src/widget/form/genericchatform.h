@@ -21,15 +21,20 @@
 #include <QPoint>
 #include <QDateTime>
 #include <QMenu>
+#include <QHash>
 #include "src/widget/tool/chatactions/chataction.h"
 #include "src/corestructs.h"
+#include "src/historykeeper.h"
 
 // Spacing in px inserted when the author of the last message changes
 #define AUTHOR_CHANGE_SPACING 5 // why the hell is this a thing? surely the different font is enough?
+// Messages fetched at once when scrolling through the history
+#define HISTORY_PAGE_SIZE 100
 
 class QLabel;
 class QVBoxLayout;
 class QPushButton;
+class QProgressDialog;
 class CroppingLabel;
 class ChatTextEdit;
 class ChatAreaWidget;
@@ -55,6 +60,7 @@ public:
     void addAlertMessage(const QString& author, QString message, QDateTime datetime); ///< Deprecated
     void addAlertMessage(const ToxID& author, QString message, QDateTime datetime);
     int getNumberOfMessages();
+    void seekHistory(const HistoryKeeper::HistCursor &at); ///< Shows the history from that position on, loading more as the user scrolls
 
 signals:
     void sendMessage(int, QString);
@@ -69,6 +75,9 @@ protected slots:
     void onEmoteButtonClicked();
     void onEmoteInsertRequested(QString str);
     void clearChatArea(bool);
+    void onChatScrolled(int value);
+    void onExportFinished(bool success, const QString& error);
+    void onRetentionClicked();
 
 protected:
     QString getElidedName(const QString& name);
@@ -76,6 +85,13 @@ protected:
     ChatActionPtr genMessageActionAction(const ToxID& author, QString message, bool isAction, const QDateTime &datetime);
     ChatActionPtr genSelfActionAction(QString message, bool isAction, const QDateTime &datetime);
     ChatActionPtr genSystemInfoAction(const QString &message, const QString &type, const QDateTime &datetime);
+    virtual ChatActionPtr genHistoryAction(const HistoryKeeper::HistMessage &msg);
+    virtual QHash<QString, QString> getHistoryNames(); ///< Display names of the logged senders, for exports
+
+    void saveRenderedLog(); ///< Without a log to stream from, only what is shown can be saved
+    void loadOlderHistory();
+    void loadNewerHistory();
+    void returnToPresent();
 
     ToxID previousId;
     QMenu menu;
@@ -89,6 +105,15 @@ protected:
     QPushButton *sendButton;
     ChatAreaWidget *chatWidget;
     QDateTime *earliestMessage;
+    QProgressDialog* exportProgress; ///< Shown while the log is being saved
+
+    HistoryKeeper::ChatType historyType;
+    QString historyChat; ///< Empty if the chat has no history
+    HistoryKeeper::HistCursor historyTop, historyBottom;
+    bool historyTopReached;
+    bool historyDetached; ///< The view shows older messages, new ones come from the history as it's scrolled down
+    bool historyStarted;
+    bool loadingHistory;
 };
 
 #endif // GENERICCHATFORM_H
@@ -70,6 +70,15 @@ GroupChatForm::GroupChatForm(Group* chatGroup)
     connect(msgEdit, &ChatTextEdit::keyPressed, tabber, &TabCompleter::reset);
 
     setAcceptDrops(true);
+
+    historyType = HistoryKeeper::ctGroup;
+    setHistoryKey(group->historyKey);
+}
+
+void GroupChatForm::setHistoryKey(const QString& key)
+{
+    // Without a key that stays the same across sessions, there is no telling which earlier log is this group's
+    historyChat = key;
 }
 
 void GroupChatForm::onSendTriggered()
@@ -114,6 +123,21 @@ void GroupChatForm::onUserListChanged()
     }
 }
 
+ChatActionPtr GroupChatForm::genHistoryAction(const HistoryKeeper::HistMessage &msg)
+{
+    // group peers are logged with the name they had, they aren't friends we could look up
+    return genMessageActionAction(HistoryKeeper::getGroupSenderName(msg.sender), msg.message, false,
+                                  msg.timestamp.toLocalTime());
+}
+
+QHash<QString, QString> GroupChatForm::getHistoryNames()
+{
+    QHash<QString, QString> names;
+    names[historyChat] = group->widget->getName();
+
+    return names;
+}
+
 void GroupChatForm::dragEnterEvent(QDragEnterEvent *ev)
 {
     if (ev->mimeData()->hasFormat("friend"))
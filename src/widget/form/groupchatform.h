@@ -31,11 +31,15 @@ public:
     GroupChatForm(Group* chatGroup);
 
     void onUserListChanged();
+    void setHistoryKey(const QString& key); ///< Logs and pages the history of the group under it
 
 private slots:
     void onSendTriggered();
 
 protected:
+    virtual ChatActionPtr genHistoryAction(const HistoryKeeper::HistMessage &msg);
+    virtual QHash<QString, QString> getHistoryNames();
+
     // drag & drop
     void dragEnterEvent(QDragEnterEvent* ev);
     void dropEvent(QDropEvent* ev);
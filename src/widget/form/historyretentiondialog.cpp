@@ -0,0 +1,90 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+#include "historyretentiondialog.h"
+
+#include <QVBoxLayout>
+#include <QFormLayout>
+#include <QCheckBox>
+#include <QSpinBox>
+#include <QLabel>
+#include <QDialogButtonBox>
+
+HistoryRetentionDialog::HistoryRetentionDialog(bool hasRule, const HistoryKeeper::RetentionRule &rule, QWidget *parent) :
+    QDialog(parent)
+{
+    setWindowFlags(windowFlags() & ~Qt::WindowContextHelpButtonHint);
+    setWindowTitle(tr("History retention"));
+
+    useGlobal = new QCheckBox(tr("Use the rule from the privacy settings"), this);
+    useGlobal->setChecked(!hasRule);
+
+    maxAge = new QSpinBox(this);
+    maxAge->setSpecialValueText(tr("Never"));
+    maxAge->setSuffix(tr(" days"));
+    maxAge->setMaximum(36500);
+
+    maxMessages = new QSpinBox(this);
+    maxMessages->setSpecialValueText(tr("All"));
+    maxMessages->setMaximum(10000000);
+    maxMessages->setSingleStep(1000);
+
+    if (hasRule)
+    {
+        maxAge->setValue(rule.maxAgeDays);
+        maxMessages->setValue(rule.maxMessages);
+    }
+    onUseGlobalToggled(!hasRule);
+
+    QDialogButtonBox* buttons = new QDialogButtonBox(QDialogButtonBox::Ok | QDialogButtonBox::Cancel, this);
+
+    connect(useGlobal, &QCheckBox::toggled, this, &HistoryRetentionDialog::onUseGlobalToggled);
+    connect(buttons, &QDialogButtonBox::accepted, this, &HistoryRetentionDialog::accept);
+    connect(buttons, &QDialogButtonBox::rejected, this, &HistoryRetentionDialog::reject);
+
+    QFormLayout *ruleLayout = new QFormLayout();
+    ruleLayout->addRow(tr("Delete messages older than"), maxAge);
+    ruleLayout->addRow(tr("Messages kept"), maxMessages);
+
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->addWidget(useGlobal);
+    layout->addLayout(ruleLayout);
+    if (!HistoryKeeper::getInstance()->canShrinkFile())
+    {
+        QLabel* note = new QLabel(tr("This history was created by an older version of qTox: deleted messages free space "
+                                     "for new ones, but the file won't get smaller. Run historyrecompress once, "
+                                     "while qTox is closed, to change that."), this);
+        note->setWordWrap(true);
+        layout->addWidget(note);
+    }
+    layout->addWidget(buttons);
+}
+
+bool HistoryRetentionDialog::hasRule()
+{
+    return !useGlobal->isChecked();
+}
+
+HistoryKeeper::RetentionRule HistoryRetentionDialog::getRule()
+{
+    return {maxAge->value(), maxMessages->value()};
+}
+
+void HistoryRetentionDialog::onUseGlobalToggled(bool checked)
+{
+    maxAge->setEnabled(!checked);
+    maxMessages->setEnabled(!checked);
+}
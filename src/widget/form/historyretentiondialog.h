@@ -0,0 +1,45 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+#ifndef HISTORYRETENTIONDIALOG_H
+#define HISTORYRETENTIONDIALOG_H
+
+#include <QDialog>
+#include "src/historykeeper.h"
+
+class QCheckBox;
+class QSpinBox;
+
+/// Edits what is kept of one chat's history
+class HistoryRetentionDialog : public QDialog
+{
+    Q_OBJECT
+public:
+    HistoryRetentionDialog(bool hasRule, const HistoryKeeper::RetentionRule& rule, QWidget *parent = 0);
+
+    bool hasRule();
+    HistoryKeeper::RetentionRule getRule();
+
+private slots:
+    void onUseGlobalToggled(bool checked);
+
+private:
+    QCheckBox* useGlobal;
+    QSpinBox* maxAge;
+    QSpinBox* maxMessages;
+};
+
+#endif // HISTORYRETENTIONDIALOG_H
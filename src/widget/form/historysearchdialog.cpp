@@ -0,0 +1,103 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+#include "historysearchdialog.h"
+#include "src/friendlist.h"
+#include "src/friend.h"
+#include "src/grouplist.h"
+#include "src/group.h"
+#include "src/widget/groupwidget.h"
+#include "src/misc/settings.h"
+
+#include <QVBoxLayout>
+#include <QHBoxLayout>
+#include <QLineEdit>
+#include <QListWidget>
+#include <QPushButton>
+
+HistorySearchDialog::HistorySearchDialog(QWidget *parent) :
+    QDialog(parent),
+    selected(-1)
+{
+    setWindowFlags(windowFlags() & ~Qt::WindowContextHelpButtonHint);
+    setWindowTitle(tr("Search history"));
+
+    searchEdit = new QLineEdit(this);
+    searchEdit->setPlaceholderText(tr("Words to look for"));
+    QPushButton* searchButton = new QPushButton(tr("Search"), this);
+    searchButton->setDefault(true);
+    resultList = new QListWidget(this);
+
+    connect(searchEdit, &QLineEdit::returnPressed, this, &HistorySearchDialog::onSearchTriggered);
+    connect(searchButton, &QPushButton::clicked, this, &HistorySearchDialog::onSearchTriggered);
+    connect(resultList, &QListWidget::itemActivated, this, &HistorySearchDialog::onResultActivated);
+
+    QHBoxLayout *searchLayout = new QHBoxLayout();
+    searchLayout->addWidget(searchEdit);
+    searchLayout->addWidget(searchButton);
+
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->addLayout(searchLayout);
+    layout->addWidget(resultList);
+
+    resize(500, 400);
+}
+
+HistoryKeeper::SearchResult HistorySearchDialog::getSelectedResult()
+{
+    return results.value(selected);
+}
+
+void HistorySearchDialog::onSearchTriggered()
+{
+    results = HistoryKeeper::getInstance()->search(searchEdit->text(), HISTORY_SEARCH_LIMIT);
+
+    resultList->clear();
+    for (const HistoryKeeper::SearchResult& result : results)
+    {
+        QString date = result.msg.timestamp.toLocalTime().toString(Settings::getInstance().getTimestampFormat());
+        resultList->addItem(QString("%1 [%2] %3").arg(getChatName(result), date, result.msg.message.simplified()));
+    }
+
+    if (results.isEmpty())
+        resultList->addItem(tr("No messages found"));
+}
+
+void HistorySearchDialog::onResultActivated(QListWidgetItem *item)
+{
+    selected = resultList->row(item);
+    if (selected >= 0 && selected < results.size())
+        accept();
+}
+
+QString HistorySearchDialog::getChatName(const HistoryKeeper::SearchResult &result)
+{
+    if (result.ct == HistoryKeeper::ctSingle)
+    {
+        Friend* f = FriendList::findFriend(result.chat);
+        if (f)
+            return f->getName();
+    }
+    else
+    {
+        Group* g = GroupList::findGroupByHistoryKey(result.chat);
+        if (g)
+            return g->widget->getName();
+        return tr("Group chat", "A search result from a group we aren't in anymore");
+    }
+
+    return result.chat;
+}
@@ -0,0 +1,50 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+#ifndef HISTORYSEARCHDIALOG_H
+#define HISTORYSEARCHDIALOG_H
+
+#include <QDialog>
+#include "src/historykeeper.h"
+
+#define HISTORY_SEARCH_LIMIT 200
+
+class QLineEdit;
+class QListWidget;
+class QListWidgetItem;
+
+class HistorySearchDialog : public QDialog
+{
+    Q_OBJECT
+public:
+    explicit HistorySearchDialog(QWidget *parent = 0);
+
+    HistoryKeeper::SearchResult getSelectedResult();
+
+private slots:
+    void onSearchTriggered();
+    void onResultActivated(QListWidgetItem* item);
+
+private:
+    QString getChatName(const HistoryKeeper::SearchResult& result);
+
+    QLineEdit* searchEdit;
+    QListWidget* resultList;
+    QList<HistoryKeeper::SearchResult> results;
+    int selected;
+};
+
+#endif // HISTORYSEARCHDIALOG_H
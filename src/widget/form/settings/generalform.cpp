@@ -51,6 +51,7 @@ GeneralForm::GeneralForm(SettingsWidget *myParent) :
     bodyUI->statusChanges->setChecked(Settings::getInstance().getStatusChangeNotificationEnabled());
     bodyUI->useEmoticons->setChecked(Settings::getInstance().getUseEmoticons());
     bodyUI->autoacceptFiles->setChecked(Settings::getInstance().getAutoSaveEnabled());
+    bodyUI->resumeTransfers->setChecked(Settings::getInstance().getResumeTransfers());
     bodyUI->autoSaveFilesDir->setText(Settings::getInstance().getAutoSaveFilesDir());
     
     for (auto entry : SmileyPack::listSmileyPacks())
@@ -82,6 +83,7 @@ GeneralForm::GeneralForm(SettingsWidget *myParent) :
                                       ); //idiot proof enough?
     
     bodyUI->autoAwaySpinBox->setValue(Settings::getInstance().getAutoAwayTime());
+    bodyUI->uploadLimitSpinBox->setValue(Settings::getInstance().getFileUploadLimit());
     
     bodyUI->cbEnableUDP->setChecked(!Settings::getInstance().getForceTCP());
     bodyUI->proxyAddr->setText(Settings::getInstance().getProxyAddr());
@@ -101,6 +103,8 @@ GeneralForm::GeneralForm(SettingsWidget *myParent) :
     connect(bodyUI->statusChanges, &QCheckBox::stateChanged, this, &GeneralForm::onSetStatusChange);
     connect(bodyUI->autoAwaySpinBox, SIGNAL(editingFinished()), this, SLOT(onAutoAwayChanged()));
     connect(bodyUI->autoacceptFiles, &QCheckBox::stateChanged, this, &GeneralForm::onAutoAcceptFileChange);
+    connect(bodyUI->uploadLimitSpinBox, SIGNAL(editingFinished()), this, SLOT(onUploadLimitChanged()));
+    connect(bodyUI->resumeTransfers, &QCheckBox::stateChanged, this, &GeneralForm::onResumeTransfersChange);
     if(bodyUI->autoacceptFiles->isChecked())
         connect(bodyUI->autoSaveFilesDir, SIGNAL(clicked()), this, SLOT(onAutoSaveDirChange()));
     //theme
@@ -183,6 +187,17 @@ void GeneralForm::onAutoAwayChanged()
     Widget::getInstance()->setIdleTimer(minutes);
 }
 
+void GeneralForm::onUploadLimitChanged()
+{
+    // the file send scheduler reads it on every tick
+    Settings::getInstance().setFileUploadLimit(bodyUI->uploadLimitSpinBox->value());
+}
+
+void GeneralForm::onResumeTransfersChange()
+{
+    Settings::getInstance().setResumeTransfers(bodyUI->resumeTransfers->isChecked());
+}
+
 void GeneralForm::onAutoAcceptFileChange()
 {
     if(bodyUI->autoacceptFiles->isChecked() == true)
@@ -51,6 +51,8 @@ private slots:
     void onReconnectClicked();
     void onAutoAcceptFileChange();
     void onAutoSaveDirChange();
+    void onUploadLimitChanged();
+    void onResumeTransfersChange();
 
 private:
     Ui::GeneralSettings *bodyUI;
@@ -34,12 +34,20 @@ PrivacyForm::PrivacyForm() :
     bodyUI->cbKeepHistory->setChecked(Settings::getInstance().getEnableLogging());
     bodyUI->cbEncryptHistory->setChecked(Settings::getInstance().getEncryptLogs());
     bodyUI->cbEncryptHistory->setEnabled(Settings::getInstance().getEnableLogging());
+    bodyUI->cbCompressHistory->setChecked(Settings::getInstance().getCompressLogs());
+    bodyUI->cbCompressHistory->setEnabled(Settings::getInstance().getEnableLogging());
     bodyUI->cbEncryptTox->setChecked(Settings::getInstance().getEncryptTox());
+    bodyUI->sbHistoryMaxAge->setValue(Settings::getInstance().getHistoryMaxAge());
+    bodyUI->sbHistoryMaxMessages->setValue(Settings::getInstance().getHistoryMaxMessages());
+    bodyUI->retentionGroup->setEnabled(Settings::getInstance().getEnableLogging());
 
     connect(bodyUI->cbTypingNotification, SIGNAL(stateChanged(int)), this, SLOT(onTypingNotificationEnabledUpdated()));
     connect(bodyUI->cbKeepHistory, SIGNAL(stateChanged(int)), this, SLOT(onEnableLoggingUpdated()));
     connect(bodyUI->cbEncryptHistory, SIGNAL(clicked()), this, SLOT(onEncryptLogsUpdated()));
+    connect(bodyUI->cbCompressHistory, SIGNAL(stateChanged(int)), this, SLOT(onCompressLogsUpdated()));
     connect(bodyUI->cbEncryptTox, SIGNAL(clicked()), this, SLOT(onEncryptToxUpdated()));
+    connect(bodyUI->sbHistoryMaxAge, SIGNAL(editingFinished()), this, SLOT(onRetentionUpdated()));
+    connect(bodyUI->sbHistoryMaxMessages, SIGNAL(editingFinished()), this, SLOT(onRetentionUpdated()));
 }
 
 PrivacyForm::~PrivacyForm()
@@ -51,9 +59,25 @@ void PrivacyForm::onEnableLoggingUpdated()
 {
     Settings::getInstance().setEnableLogging(bodyUI->cbKeepHistory->isChecked());
     bodyUI->cbEncryptHistory->setEnabled(bodyUI->cbKeepHistory->isChecked());
+    bodyUI->cbCompressHistory->setEnabled(bodyUI->cbKeepHistory->isChecked());
+    bodyUI->retentionGroup->setEnabled(bodyUI->cbKeepHistory->isChecked());
     HistoryKeeper::getInstance()->resetInstance();
 }
 
+void PrivacyForm::onCompressLogsUpdated()
+{
+    // already stored messages are left as they are, see tools/historyrecompress
+    Settings::getInstance().setCompressLogs(bodyUI->cbCompressHistory->isChecked());
+    HistoryKeeper::getInstance()->setCompressMessages(bodyUI->cbCompressHistory->isChecked());
+}
+
+void PrivacyForm::onRetentionUpdated()
+{
+    Settings::getInstance().setHistoryMaxAge(bodyUI->sbHistoryMaxAge->value());
+    Settings::getInstance().setHistoryMaxMessages(bodyUI->sbHistoryMaxMessages->value());
+    HistoryKeeper::getInstance()->setRetention({bodyUI->sbHistoryMaxAge->value(), bodyUI->sbHistoryMaxMessages->value()});
+}
+
 void PrivacyForm::onTypingNotificationEnabledUpdated()
 {
     Settings::getInstance().setTypingNotification(bodyUI->cbTypingNotification->isChecked());
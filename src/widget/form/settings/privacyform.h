@@ -35,6 +35,8 @@ private slots:
     void onTypingNotificationEnabledUpdated();
 
     void onEncryptLogsUpdated();
+    void onCompressLogsUpdated();
+    void onRetentionUpdated();
     void onEncryptToxUpdated();
 
 private:
@@ -169,7 +169,9 @@ void FriendWidget::updateStatusLight()
 void FriendWidget::setChatForm(Ui::MainWindow &ui)
 {
     Friend* f = FriendList::findFriend(friendId);
-    f->chatForm->show(ui);
+    ChatForm* form = f->getChatForm();
+    form->show(ui);
+    form->focusInput();
 }
 
 void FriendWidget::resetEventFlags()
@@ -178,14 +180,10 @@ void FriendWidget::resetEventFlags()
     f->hasNewEvents = 0;
 }
 
-void FriendWidget::onAvatarChange(int FriendId, const QPixmap& pic)
+void FriendWidget::setAvatar(const QPixmap& pic, const QColor& background)
 {
-    if (FriendId != friendId)
-        return;
-
     isDefaultAvatar = false;
-    avatar->setPixmap(pic);
-    avatar->autopickBackground();
+    avatar->setPixmap(pic, background);
 }
 
 void FriendWidget::onAvatarRemoved(int FriendId)
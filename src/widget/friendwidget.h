@@ -34,6 +34,7 @@ public:
     void setAsInactiveChatroom();
     void updateStatusLight();
     void setChatForm(Ui::MainWindow &);
+    void setAvatar(const QPixmap& pic, const QColor& background);
     void resetEventFlags();
 
 signals:
@@ -42,7 +43,6 @@ signals:
     void copyFriendIdToClipboard(int friendId);
 
 public slots:
-    void onAvatarChange(int FriendId, const QPixmap& pic);
     void onAvatarRemoved(int FriendId);
 
 protected:
@@ -38,16 +38,26 @@ void MaskablePixmapWidget::autopickBackground()
     if (pic.isNull())
         return;
 
+    backgroundColor = pickBackground(pic);
+
+    update();
+}
+
+QColor MaskablePixmapWidget::pickBackground(const QImage& image)
+{
+    QImage pic = image.convertToFormat(QImage::Format_ARGB32);
+
     int r = 0;
     int g = 0;
     int b = 0;
     int weight = 0;
 
-    for (int x=0;x<pic.width();++x)
+    for (int y=0;y<pic.height();++y)
     {
-        for (int y=0;y<pic.height();++y)
+        const QRgb* line = reinterpret_cast<const QRgb*>(pic.constScanLine(y));
+        for (int x=0;x<pic.width();++x)
         {
-            QRgb color = pic.pixel(x,y);
+            QRgb color = line[x];
             r += qRed(color);
             g += qGreen(color);
             b += qBlue(color);
@@ -62,9 +72,7 @@ void MaskablePixmapWidget::autopickBackground()
     b /= weight;
 
     QColor color = QColor::fromRgb(r,g,b);
-    backgroundColor =  QColor::fromRgb(0xFFFFFF ^ color.rgb());
-
-    update();
+    return QColor::fromRgb(0xFFFFFF ^ color.rgb());
 }
 
 void MaskablePixmapWidget::setBackground(QColor color)
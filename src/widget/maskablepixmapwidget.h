@@ -26,6 +26,7 @@ public:
     MaskablePixmapWidget(QWidget *parent, QSize size, QString maskName = QString());
 
     void autopickBackground();
+    static QColor pickBackground(const QImage& image); ///< Thread safe, what autopickBackground() would pick for the image
     void setBackground(QColor color);
     void setClickable(bool clickable);
     void setPixmap(const QPixmap &pmap, QColor background);
@@ -17,7 +17,9 @@
 #include "widget.h"
 #include "ui_mainwindow.h"
 #include "src/core.h"
+#include "src/coredispatcher.h"
 #include "src/misc/settings.h"
+#include "src/misc/avatarcache.h"
 #include "src/friend.h"
 #include "src/friendlist.h"
 #include "tool/friendrequestdialog.h"
@@ -46,6 +48,7 @@
 #include <QStyleFactory>
 #include <QTranslator>
 #include "src/historykeeper.h"
+#include "src/misc/cdata.h"
 #include <tox/tox.h>
 #include "form/inputpassworddialog.h"
 
@@ -62,7 +65,7 @@ Widget::Widget(QWidget *parent)
 
 void Widget::init()
 {
-    
+    startupTimer.start();
     ui->setupUi(this);
     
     if (QSystemTrayIcon::isSystemTrayAvailable() == true)
@@ -191,6 +194,7 @@ void Widget::init()
     core = new Core(Camera::getInstance(), coreThread, profilePath);
     core->moveToThread(coreThread);
     connect(coreThread, &QThread::started, core, &Core::start);
+    dispatcher = new CoreDispatcher(core, this);
     
     filesForm = new FilesForm();
     addFriendForm = new AddFriendForm;
@@ -208,6 +212,7 @@ void Widget::init()
     connect(core, SIGNAL(fileUploadFinished(const QString&)), filesForm, SLOT(onFileUploadComplete(const QString&)));
     connect(core, &Core::friendAdded, this, &Widget::addFriend);
     connect(core, &Core::failedToAddFriend, this, &Widget::addFriendFailed);
+    connect(core, &Core::friendsLoaded, this, &Widget::onFriendsLoaded);
     connect(core, &Core::friendUsernameChanged, this, &Widget::onFriendUsernameChanged);
     connect(core, &Core::friendStatusChanged, this, &Widget::onFriendStatusChanged);
     connect(core, &Core::friendStatusMessageChanged, this, &Widget::onFriendStatusMessageChanged);
@@ -268,6 +273,7 @@ void Widget::setTranslation()
 Widget::~Widget()
 {
     core->saveConfiguration();
+    HistoryKeeper::resetInstance(); // commits the queued history entries
     coreThread->exit();
     coreThread->wait(500); // In case of deadlock (can happen with QtAudio/PA bugs)
     if (!coreThread->isFinished())
@@ -279,10 +285,10 @@ Widget::~Widget()
 
     for (Friend* f : FriendList::friendList)
         delete f;
-    FriendList::friendList.clear();
+    FriendList::clear();
     for (Group* g : GroupList::groupList)
         delete g;
-    GroupList::groupList.clear();
+    GroupList::clear();
     delete statusAway;
     delete statusBusy;
     delete statusOnline;
@@ -310,6 +316,11 @@ QThread* Widget::getCoreThread()
     return coreThread;
 }
 
+CoreDispatcher* Widget::getCoreDispatcher()
+{
+    return dispatcher;
+}
+
 void Widget::closeEvent(QCloseEvent *event)
 {
     if(Settings::getInstance().getCloseToTray() == true)
@@ -605,43 +616,9 @@ void Widget::addFriend(int friendId, const QString &userId)
     connect(newfriend->widget, SIGNAL(chatroomWidgetClicked(GenericChatroomWidget*)), this, SLOT(onChatroomWidgetClicked(GenericChatroomWidget*)));
     connect(newfriend->widget, SIGNAL(removeFriend(int)), this, SLOT(removeFriend(int)));
     connect(newfriend->widget, SIGNAL(copyFriendIdToClipboard(int)), this, SLOT(copyFriendIdToClipboard(int)));
-    connect(newfriend->widget, SIGNAL(chatroomWidgetClicked(GenericChatroomWidget*)), newfriend->chatForm, SLOT(focusInput()));
-    connect(newfriend->chatForm, SIGNAL(sendMessage(int,QString)), core, SLOT(sendMessage(int,QString)));
-    connect(newfriend->chatForm, &GenericChatForm::sendAction, core, &Core::sendAction);
-    connect(newfriend->chatForm, SIGNAL(sendFile(int32_t, QString, QString, long long)), core, SLOT(sendFile(int32_t, QString, QString, long long)));
-    connect(newfriend->chatForm, SIGNAL(answerCall(int)), core, SLOT(answerCall(int)));
-    connect(newfriend->chatForm, SIGNAL(hangupCall(int)), core, SLOT(hangupCall(int)));
-    connect(newfriend->chatForm, SIGNAL(startCall(int)), core, SLOT(startCall(int)));
-    connect(newfriend->chatForm, SIGNAL(startVideoCall(int,bool)), core, SLOT(startCall(int,bool)));
-    connect(newfriend->chatForm, SIGNAL(cancelCall(int,int)), core, SLOT(cancelCall(int,int)));
-    connect(newfriend->chatForm, SIGNAL(micMuteToggle(int)), core, SLOT(micMuteToggle(int)));
-    connect(newfriend->chatForm, SIGNAL(volMuteToggle(int)), core, SLOT(volMuteToggle(int)));
-    connect(core, &Core::fileReceiveRequested, newfriend->chatForm, &ChatForm::onFileRecvRequest);
-    connect(core, &Core::avInvite, newfriend->chatForm, &ChatForm::onAvInvite);
-    connect(core, &Core::avStart, newfriend->chatForm, &ChatForm::onAvStart);
-    connect(core, &Core::avCancel, newfriend->chatForm, &ChatForm::onAvCancel);
-    connect(core, &Core::avEnd, newfriend->chatForm, &ChatForm::onAvEnd);
-    connect(core, &Core::avRinging, newfriend->chatForm, &ChatForm::onAvRinging);
-    connect(core, &Core::avStarting, newfriend->chatForm, &ChatForm::onAvStarting);
-    connect(core, &Core::avEnding, newfriend->chatForm, &ChatForm::onAvEnding);
-    connect(core, &Core::avRequestTimeout, newfriend->chatForm, &ChatForm::onAvRequestTimeout);
-    connect(core, &Core::avPeerTimeout, newfriend->chatForm, &ChatForm::onAvPeerTimeout);
-    connect(core, &Core::avMediaChange, newfriend->chatForm, &ChatForm::onAvMediaChange);
-    connect(core, &Core::avCallFailed, newfriend->chatForm, &ChatForm::onAvCallFailed);
-    connect(core, &Core::avRejected, newfriend->chatForm, &ChatForm::onAvRejected);
-    connect(core, &Core::friendAvatarChanged, newfriend->chatForm, &ChatForm::onAvatarChange);
-    connect(core, &Core::friendAvatarChanged, newfriend->widget, &FriendWidget::onAvatarChange);
-    connect(core, &Core::friendAvatarRemoved, newfriend->chatForm, &ChatForm::onAvatarRemoved);
-    connect(core, &Core::friendAvatarRemoved, newfriend->widget, &FriendWidget::onAvatarRemoved);
-
-    // Try to get the avatar from the cache
-    QPixmap avatar = Settings::getInstance().getSavedAvatar(userId);
-    if (!avatar.isNull())
-    {
-        //qWarning() << "Widget: loadded avatar for id" << userId;
-        newfriend->chatForm->onAvatarChange(friendId, avatar);
-        newfriend->widget->onAvatarChange(friendId, avatar);
-    }
+
+    // The placeholder stays until the saved avatar is decoded
+    AvatarCache::getInstance().request(userId);
 }
 
 void Widget::addFriendFailed(const QString&)
@@ -649,6 +626,32 @@ void Widget::addFriendFailed(const QString&)
     QMessageBox::critical(0,"Error","Couldn't request friendship");
 }
 
+/// Resident memory in KiB, -1 where we can't tell
+static long residentMemory()
+{
+#ifdef Q_OS_LINUX
+    QFile status("/proc/self/status");
+    if (status.open(QIODevice::ReadOnly))
+    {
+        for (QByteArray line = status.readLine(); !line.isEmpty(); line = status.readLine())
+            if (line.startsWith("VmRSS:"))
+                return line.mid(6).trimmed().split(' ').first().toLong();
+    }
+#endif
+    return -1;
+}
+
+void Widget::onFriendsLoaded(int count)
+{
+    // Once per run, so that the cost of the contact list can be compared between list sizes
+    if (!startupTimer.isValid())
+        return;
+
+    qDebug() << "Widget:" << count << "friends shown" << startupTimer.elapsed() << "ms after startup, resident memory"
+             << residentMemory() << "KiB";
+    startupTimer.invalidate();
+}
+
 void Widget::onFriendStatusChanged(int friendId, Status status)
 {
     Friend* f = FriendList::findFriend(friendId);
@@ -661,7 +664,7 @@ void Widget::onFriendStatusChanged(int friendId, Status status)
     f->widget->updateStatusLight();
     
     //won't print the message if there were no messages before
-    if(f->chatForm->getNumberOfMessages() != 0
+    if(f->hasChatForm() && f->getChatForm()->getNumberOfMessages() != 0
             && Settings::getInstance().getStatusChangeNotificationEnabled() == true)
     {
         QString fStatus = "";
@@ -675,8 +678,8 @@ void Widget::onFriendStatusChanged(int friendId, Status status)
         default:
             fStatus = tr("online", "contact status"); break;
         }
-        f->chatForm->addSystemInfoMessage(tr("%1 is now %2", "e.g. \"Dubslow is now online\"").arg(f->getName()).arg(fStatus),
-                                          "white", QDateTime::currentDateTime());
+        f->getChatForm()->addSystemInfoMessage(tr("%1 is now %2", "e.g. \"Dubslow is now online\"").arg(f->getName()).arg(fStatus),
+                                               "white", QDateTime::currentDateTime());
     }
 }
 
@@ -716,6 +719,28 @@ void Widget::onChatroomWidgetClicked(GenericChatroomWidget *widget)
     widget->updateStatusLight();
 }
 
+void Widget::showHistoryMessage(const HistoryKeeper::SearchResult &result)
+{
+    if (result.ct == HistoryKeeper::ctGroup)
+    {
+        // only a group we're in this session has a form to show it in
+        Group* g = GroupList::findGroupByHistoryKey(result.chat);
+        if (!g)
+            return;
+
+        onChatroomWidgetClicked(g->widget);
+        g->chatForm->seekHistory({result.msg.timestamp, result.msg.id});
+        return;
+    }
+
+    Friend* f = FriendList::findFriend(result.chat);
+    if (!f)
+        return;
+
+    onChatroomWidgetClicked(f->widget);
+    f->getChatForm()->seekHistory({result.msg.timestamp, result.msg.id});
+}
+
 void Widget::onFriendMessageReceived(int friendId, const QString& message, bool isAction)
 {
     Friend* f = FriendList::findFriend(friendId);
@@ -723,7 +748,7 @@ void Widget::onFriendMessageReceived(int friendId, const QString& message, bool
         return;
 
     QDateTime timestamp = QDateTime::currentDateTime();
-    f->chatForm->addMessage(f->getToxID(), message, isAction, timestamp);
+    f->getChatForm()->addMessage(f->getToxID(), message, isAction, timestamp);
 
     if (isAction)
         HistoryKeeper::getInstance()->addChatEntry(f->userId, "/me " + message, f->userId, timestamp);
@@ -841,21 +866,41 @@ void Widget::onGroupInviteReceived(int32_t friendId, const uint8_t* publicKey,ui
         qWarning() << "Widget::onGroupInviteReceived: Unable to accept invitation";
         return;
     }
+
+    // Whatever toxcore puts before it, an invite ends with the key of the group, group numbers change every session
+    if (length < TOX_CLIENT_ID_SIZE)
+        return;
+    Group* g = GroupList::findGroup(groupId);
+    if (!g)
+        g = createGroup(groupId);
+    g->historyKey = CUserId::toString(publicKey + length - TOX_CLIENT_ID_SIZE);
+    g->chatForm->setHistoryKey(g->historyKey);
 }
 
-void Widget::onGroupMessageReceived(int groupnumber, const QString& message, const QString& author, bool isAction)
+void Widget::onGroupMessageReceived(int groupnumber, const QString& message, const QString& author, const QString& authorKey,
+                                    bool isAction)
 {
     Group* g = GroupList::findGroup(groupnumber);
     if (!g)
         return;
 
     QString name = core->getUsername();
+    QDateTime timestamp = QDateTime::currentDateTime();
 
     bool targeted = (author != name) && message.contains(name, Qt::CaseInsensitive);
     if (targeted)
-        g->chatForm->addAlertMessage(author, message, QDateTime::currentDateTime());
+        g->chatForm->addAlertMessage(author, message, timestamp);
     else
-        g->chatForm->addMessage(author, message, isAction, QDateTime::currentDateTime());
+        g->chatForm->addMessage(author, message, isAction, timestamp);
+
+    // our own messages come back through here too, so they are logged once
+    if (!g->historyKey.isEmpty() && !authorKey.isEmpty())
+    {
+        if (isAction)
+            HistoryKeeper::getInstance()->addGroupChatEntry(g->historyKey, "/me " + message, authorKey, author, timestamp);
+        else
+            HistoryKeeper::getInstance()->addGroupChatEntry(g->historyKey, message, authorKey, author, timestamp);
+    }
 
     if ((static_cast<GenericChatroomWidget*>(g->widget) != activeChatroomWidget) || isMinimized() || !isActiveWindow())
     {
@@ -1033,7 +1078,7 @@ void Widget::onMessageSendResult(int friendId, const QString& message, int messa
         return;
 
     if (!messageId)
-        f->chatForm->addSystemInfoMessage(tr("Message failed to send"), "red", QDateTime::currentDateTime());
+        f->getChatForm()->addSystemInfoMessage(tr("Message failed to send"), "red", QDateTime::currentDateTime());
 }
 
 void Widget::onGroupSendResult(int groupId, const QString& message, int result)
@@ -20,11 +20,13 @@
 #include <QMainWindow>
 #include <QSystemTrayIcon>
 #include <QMessageBox>
+#include <QElapsedTimer>
 #include "form/addfriendform.h"
 #include "form/settingswidget.h"
 #include "form/settings/identityform.h"
 #include "form/filesform.h"
 #include "src/corestructs.h"
+#include "src/historykeeper.h"
 
 #define PIXELS_TO_ACT 7
 
@@ -39,6 +41,7 @@ class QSplitter;
 class VideoSurface;
 class QMenu;
 class Core;
+class CoreDispatcher;
 class Camera;
 class FriendListWidget;
 class MaskablePixmapWidget;
@@ -55,6 +58,7 @@ public:
     QString getUsername();
     Core* getCore();
     QThread* getCoreThread();
+    CoreDispatcher* getCoreDispatcher();
     Camera* getCamera();
     static Widget* getInstance();
     void newMessageAlert();
@@ -67,6 +71,7 @@ public:
     Q_INVOKABLE QMessageBox::StandardButton showWarningMsgBox(const QString& title, const QString& msg,
                                               QMessageBox::StandardButtons buttonss = QMessageBox::Ok);
     Q_INVOKABLE void setEnabledThreadsafe(bool enabled);
+    void showHistoryMessage(const HistoryKeeper::SearchResult& result);
     ~Widget();
 
     virtual void closeEvent(QCloseEvent *event);
@@ -102,6 +107,7 @@ private slots:
     void setStatusMessage(const QString &statusMessage);
     void addFriend(int friendId, const QString& userId);
     void addFriendFailed(const QString& userId);
+    void onFriendsLoaded(int count);
     void onFriendStatusChanged(int friendId, Status status);
     void onFriendStatusMessageChanged(int friendId, const QString& message);
     void onFriendUsernameChanged(int friendId, const QString& username);
@@ -110,7 +116,8 @@ private slots:
     void onFriendRequestReceived(const QString& userId, const QString& message);
     void onEmptyGroupCreated(int groupId);
     void onGroupInviteReceived(int32_t friendId, const uint8_t *publicKey,uint16_t length);
-    void onGroupMessageReceived(int groupnumber, const QString& message, const QString& author, bool isAction);
+    void onGroupMessageReceived(int groupnumber, const QString& message, const QString& author, const QString& authorKey,
+                                bool isAction);
     void onGroupNamelistChanged(int groupnumber, int peernumber, uint8_t change);
     void removeFriend(int friendId);
     void copyFriendIdToClipboard(int friendId);
@@ -146,6 +153,7 @@ private:
     QPoint dragPosition;
     Core* core;
     QThread* coreThread;
+    CoreDispatcher* dispatcher;
     AddFriendForm* addFriendForm;
     SettingsWidget* settingsWidget;
     FilesForm* filesForm;
@@ -157,6 +165,7 @@ private:
     bool autoAwayActive = false;
     QTimer* idleTimer;
     QTranslator* translator;
+    QElapsedTimer startupTimer; ///< Until the saved friends are shown, invalid afterwards
 };
 
 #endif // WIDGET_H
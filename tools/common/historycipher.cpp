@@ -0,0 +1,78 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+#include "historycipher.h"
+
+#include <tox/toxencryptsave.h>
+#include <QFile>
+
+QByteArray HistoryCipher::key;
+
+void HistoryCipher::setPassword(const QString &password, const QByteArray &salt)
+{
+    QByteArray pass = password.toUtf8();
+    key.resize(tox_pass_key_length());
+
+    if (salt.isEmpty())
+        tox_derive_key_from_pass(reinterpret_cast<uint8_t*>(pass.data()), pass.size(),
+                                 reinterpret_cast<uint8_t*>(key.data()));
+    else
+        tox_derive_key_with_salt(reinterpret_cast<uint8_t*>(pass.data()), pass.size(),
+                                 reinterpret_cast<uint8_t*>(const_cast<char*>(salt.constData())),
+                                 reinterpret_cast<uint8_t*>(key.data()));
+}
+
+QByteArray HistoryCipher::readSalt(const QString &path)
+{
+    // same as Core::loadConfiguration, every encrypted block starts with the salt
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+
+    QByteArray data = file.read(tox_pass_encryption_extra_length());
+    QByteArray salt(tox_pass_salt_length(), 0);
+    if (data.size() < static_cast<int>(tox_pass_encryption_extra_length())
+            || tox_get_salt(reinterpret_cast<uint8_t*>(data.data()), reinterpret_cast<uint8_t*>(salt.data())) != 0)
+        return QByteArray();
+
+    return salt;
+}
+
+QByteArray HistoryCipher::encrypt(const QByteArray &data, const QByteArray &key)
+{
+    QByteArray encrypted(data.size() + tox_pass_encryption_extra_length(), 0);
+    if (tox_pass_key_encrypt(reinterpret_cast<const uint8_t*>(data.data()), data.size(),
+                             reinterpret_cast<const uint8_t*>(key.constData()),
+                             reinterpret_cast<uint8_t*>(encrypted.data())) == -1)
+        return QByteArray();
+
+    return encrypted;
+}
+
+QByteArray HistoryCipher::decrypt(const QByteArray &data, const QByteArray &key)
+{
+    int sz = data.size() - tox_pass_encryption_extra_length();
+    if (sz < 0)
+        return QByteArray();
+
+    QByteArray decrypted(sz, 0);
+    if (tox_pass_key_decrypt(reinterpret_cast<const uint8_t*>(data.data()), data.size(),
+                             reinterpret_cast<const uint8_t*>(key.constData()),
+                             reinterpret_cast<uint8_t*>(decrypted.data())) != sz)
+        return QByteArray();
+
+    return decrypted;
+}
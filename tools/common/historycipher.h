@@ -0,0 +1,41 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+#ifndef HISTORYCIPHER_H
+#define HISTORYCIPHER_H
+
+#include <QByteArray>
+#include <QString>
+
+/// The history key of Core::ptHistory for the tools, which run without a Core
+class HistoryCipher
+{
+public:
+    /// Without a salt a new one is generated, as for a new profile
+    static void setPassword(const QString& password, const QByteArray& salt = QByteArray());
+    /// The salt of an encrypted history file, empty if it has none
+    static QByteArray readSalt(const QString& path);
+
+    static QByteArray getKey() {return key;} ///< Of the last setPassword
+
+    static QByteArray encrypt(const QByteArray& data, const QByteArray& key);
+    static QByteArray decrypt(const QByteArray& data, const QByteArray& key);
+
+private:
+    static QByteArray key;
+};
+
+#endif // HISTORYCIPHER_H
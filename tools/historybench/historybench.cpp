@@ -0,0 +1,264 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+/*
+    Synthetic load for the history storage: fills a profile with the given number of
+    chats, aliases and messages through HistoryWriter, then times reopening it and reading
+    ranges back. One JSON object per storage mode is written, see main() for the options.
+*/
+
+#include "src/historywriter.h"
+#include "src/misc/db/encrypteddb.h"
+#include "tools/common/historycipher.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QThread>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QTextStream>
+#include <QDebug>
+#include <algorithm>
+
+struct BenchConfig
+{
+    int chats;
+    int aliases;
+    int messages;
+    int messageLength;
+    int days;
+    int reads;
+    int readDays;
+    bool compress;
+    QString password;
+    QString dir;
+};
+
+/// A fake public key, so that chats and aliases have realistic sizes
+static QString fakeId(int n)
+{
+    return QString("%1").arg(n, 64, 16, QChar('0')).toUpper();
+}
+
+static QString fakeMessage(int length)
+{
+    static const char* const words[] = {"tox", "hello", "the", "message", "history", "is", "a", "long", "test", "of", "qtox"};
+    QString msg;
+    while (msg.size() < length)
+        msg += QString(words[qrand() % 11]) + " ";
+
+    return msg.left(length);
+}
+
+/// The writer has to live on a thread of its own, its blocking calls would deadlock otherwise
+class BenchWriter
+{
+public:
+    BenchWriter(const QString &path, bool encrypted)
+    {
+        thread = new QThread();
+        writer = new HistoryWriter(path, encrypted);
+        writer->moveToThread(thread);
+        thread->start();
+    }
+
+    ~BenchWriter()
+    {
+        writer->close();
+        thread->quit();
+        thread->wait();
+
+        delete writer;
+        delete thread;
+    }
+
+    HistoryWriter* operator->() {return writer;}
+
+private:
+    QThread* thread;
+    HistoryWriter* writer;
+};
+
+static double percentile(QVector<double> values, double p)
+{
+    if (values.isEmpty())
+        return 0;
+
+    std::sort(values.begin(), values.end());
+    return values[qMin(values.size() - 1, static_cast<int>(values.size() * p))];
+}
+
+static QJsonObject runBench(const BenchConfig &cfg, bool encrypted)
+{
+    QJsonObject result;
+    result["mode"] = encrypted ? "encrypted" : "plain";
+    result["chats"] = cfg.chats;
+    result["aliases"] = cfg.aliases;
+    result["messages"] = cfg.messages;
+    result["message_length"] = cfg.messageLength;
+    result["compressed"] = cfg.compress;
+
+    QElapsedTimer timer;
+    if (encrypted)
+    {
+        // unlocking a profile is deriving the key from the password
+        timer.start();
+        HistoryCipher::setPassword(cfg.password);
+        result["unlock_ms"] = static_cast<double>(timer.nsecsElapsed()) / 1000000;
+
+        EncryptedDb::setCipher(HistoryCipher::encrypt, HistoryCipher::decrypt, HistoryCipher::getKey());
+    }
+
+    QString path = QDir(cfg.dir).filePath(encrypted ? "bench.qtox_history.encrypted" : "bench.qtox_history");
+    QFile::remove(path);
+
+    QDateTime end = QDateTime::currentDateTimeUtc();
+    QDateTime start = end.addDays(-cfg.days);
+    qint64 span = start.msecsTo(end);
+
+    {
+        BenchWriter writer(path, encrypted);
+        writer->setCompressMessages(cfg.compress);
+        writer->open();
+
+        timer.start();
+        for (int i = 0; i < cfg.messages; i++)
+        {
+            // evenly spread over the period, in the order they would arrive
+            QDateTime timestamp = start.addMSecs(span * i / qMax(1, cfg.messages));
+            writer->enqueue({HistoryKeeper::ctSingle, fakeId(qrand() % cfg.chats), fakeMessage(cfg.messageLength),
+                             fakeId(cfg.chats + qrand() % cfg.aliases), timestamp});
+        }
+        writer->flush();
+        qint64 insertNs = timer.nsecsElapsed();
+
+        result["insert_ms"] = static_cast<double>(insertNs) / 1000000;
+        result["insert_per_sec"] = insertNs > 0 ? cfg.messages * 1000000000.0 / insertNs : 0;
+        result["max_queue_depth"] = writer->getMaxQueueDepth();
+        result["max_commit_ms"] = static_cast<double>(writer->getMaxCommitLatency());
+    }
+
+    result["file_bytes"] = static_cast<double>(QFileInfo(path).size());
+
+    BenchWriter writer(path, encrypted);
+    timer.start();
+    writer->open();
+    result["cold_open_ms"] = static_cast<double>(timer.nsecsElapsed()) / 1000000;
+
+    QVector<double> readTimes;
+    qint64 rows = 0;
+    qint64 window = qMin(span, static_cast<qint64>(cfg.readDays) * 24 * 3600 * 1000);
+    for (int i = 0; i < cfg.reads; i++)
+    {
+        QDateTime from = start.addMSecs(static_cast<qint64>(qrand()) * (span - window) / RAND_MAX);
+
+        timer.start();
+        auto msgs = writer->getChatHistory(HistoryKeeper::ctSingle, fakeId(qrand() % cfg.chats), from, from.addMSecs(window));
+        readTimes.append(static_cast<double>(timer.nsecsElapsed()) / 1000000);
+        rows += msgs.size();
+    }
+
+    double total = 0;
+    for (double t : readTimes)
+        total += t;
+
+    result["reads"] = cfg.reads;
+    result["read_days"] = cfg.readDays;
+    result["read_mean_ms"] = readTimes.isEmpty() ? 0 : total / readTimes.size();
+    result["read_p50_ms"] = percentile(readTimes, 0.5);
+    result["read_p95_ms"] = percentile(readTimes, 0.95);
+    result["read_rows_mean"] = readTimes.isEmpty() ? 0 : static_cast<double>(rows) / readTimes.size();
+
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    app.setApplicationName("historybench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Times the qTox history storage on a synthetic profile");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("chats", "Number of chats.", "n", "20"));
+    parser.addOption(QCommandLineOption("aliases", "Number of senders.", "n", "20"));
+    parser.addOption(QCommandLineOption("messages", "Number of messages.", "n", "100000"));
+    parser.addOption(QCommandLineOption("length", "Length of a message, in characters.", "n", "80"));
+    parser.addOption(QCommandLineOption("days", "Period the messages are spread over.", "n", "365"));
+    parser.addOption(QCommandLineOption("reads", "Number of getChatHistory range reads.", "n", "200"));
+    parser.addOption(QCommandLineOption("read-days", "Length of a range read.", "n", "7"));
+    parser.addOption(QCommandLineOption("compress", "Store the messages compressed."));
+    parser.addOption(QCommandLineOption("mode", "plain, encrypted or both.", "mode", "both"));
+    parser.addOption(QCommandLineOption("password", "Password of the encrypted profile.", "password", "historybench"));
+    parser.addOption(QCommandLineOption("dir", "Where the profiles are created, a temporary directory by default.", "dir"));
+    parser.addOption(QCommandLineOption("output", "File the results are appended to as JSON lines, stdout by default.", "file"));
+    parser.addOption(QCommandLineOption("seed", "Seed of the generated content.", "n", "1"));
+    parser.process(app);
+
+    BenchConfig cfg;
+    cfg.chats = qMax(1, parser.value("chats").toInt());
+    cfg.aliases = qMax(1, parser.value("aliases").toInt());
+    cfg.messages = qMax(0, parser.value("messages").toInt());
+    cfg.messageLength = qMax(1, parser.value("length").toInt());
+    cfg.days = qMax(1, parser.value("days").toInt());
+    cfg.reads = qMax(0, parser.value("reads").toInt());
+    cfg.readDays = qMax(1, parser.value("read-days").toInt());
+    cfg.compress = parser.isSet("compress");
+    cfg.password = parser.value("password");
+
+    QTemporaryDir tmpDir;
+    cfg.dir = parser.isSet("dir") ? parser.value("dir") : tmpDir.path();
+
+    QString mode = parser.value("mode");
+    QList<bool> modes;
+    if (mode == "plain" || mode == "both")
+        modes << false;
+    if (mode == "encrypted" || mode == "both")
+        modes << true;
+    if (modes.isEmpty())
+    {
+        qWarning() << "historybench: unknown mode" << mode;
+        return 1;
+    }
+
+    QFile outFile;
+    if (parser.isSet("output"))
+    {
+        outFile.setFileName(parser.value("output"));
+        if (!outFile.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text))
+        {
+            qWarning() << "historybench: can't open" << outFile.fileName();
+            return 1;
+        }
+    } else {
+        outFile.open(stdout, QIODevice::WriteOnly | QIODevice::Text);
+    }
+
+    for (bool encrypted : modes)
+    {
+        qsrand(parser.value("seed").toUInt()); // both modes store the same content
+        QJsonObject result = runBench(cfg, encrypted);
+        outFile.write(QJsonDocument(result).toJson(QJsonDocument::Compact) + "\n");
+        outFile.flush();
+    }
+
+    return 0;
+}
@@ -0,0 +1,109 @@
+/*
+    Copyright (C) 2014 by Project Tox <https://tox.im>
+
+    This file is part of qTox, a Qt-based graphical interface for Tox.
+
+    This program is libre software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+    See the COPYING file for more details.
+*/
+
+/*
+    Rewrites the messages of an existing history file compressed, or back to text with
+    --decompress, in place. qTox must not be running, it keeps the file locked anyway.
+*/
+
+#include "src/historywriter.h"
+#include "src/misc/db/encrypteddb.h"
+#include "tools/common/historycipher.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFileInfo>
+#include <QThread>
+#include <QEventLoop>
+#include <QTextStream>
+#include <QDebug>
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    app.setApplicationName("historyrecompress");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Compresses the messages of a qTox history file in place");
+    parser.addHelpOption();
+    parser.addPositionalArgument("history", "The .qtox_history or .qtox_history.encrypted file.");
+    parser.addOption(QCommandLineOption("password", "Password of an encrypted history.", "password"));
+    parser.addOption(QCommandLineOption("decompress", "Store the messages as text again."));
+    parser.process(app);
+
+    if (parser.positionalArguments().size() != 1)
+        parser.showHelp(1);
+
+    QString path = parser.positionalArguments().first();
+    if (!QFileInfo(path).isFile())
+    {
+        qWarning() << "historyrecompress: no such file" << path;
+        return 1;
+    }
+
+    bool encrypted = path.endsWith(".encrypted");
+    if (encrypted)
+    {
+        QByteArray salt = HistoryCipher::readSalt(path);
+        if (salt.isEmpty() || !parser.isSet("password"))
+        {
+            qWarning() << "historyrecompress: an encrypted history needs its --password";
+            return 1;
+        }
+
+        HistoryCipher::setPassword(parser.value("password"), salt);
+        EncryptedDb::setCipher(HistoryCipher::encrypt, HistoryCipher::decrypt, HistoryCipher::getKey());
+        if (!EncryptedDb::check(path))
+        {
+            qWarning() << "historyrecompress: wrong password";
+            return 1;
+        }
+    }
+
+    qint64 sizeBefore = QFileInfo(path).size();
+
+    QThread thread;
+    HistoryWriter* writer = new HistoryWriter(path, encrypted);
+    writer->moveToThread(&thread);
+    thread.start();
+
+    QEventLoop loop;
+    int changed = 0;
+    QObject::connect(writer, &HistoryWriter::recompressProgress, &loop, [](int done, int total)
+    {
+        QTextStream(stdout) << "\r" << done << "/" << total << " messages" << flush;
+    });
+    QObject::connect(writer, &HistoryWriter::recompressFinished, &loop, [&](int count)
+    {
+        changed = count;
+        loop.quit();
+    });
+
+    writer->open();
+    writer->startRecompress(!parser.isSet("decompress"));
+    loop.exec();
+    QTextStream(stdout) << "\n";
+    // also switches an older file to incremental vacuum, so that the retention task can shrink it from then on
+    writer->vacuum();
+    writer->close();
+
+    thread.quit();
+    thread.wait();
+    delete writer;
+
+    QTextStream(stdout) << changed << " messages rewritten, " << sizeBefore << " -> " << QFileInfo(path).size() << " bytes\n";
+    return 0;
+}